@@ -0,0 +1,102 @@
+#!/bin/bash
+#
+# Run subconvert over a fixed set of synthetic dumps, printing one line
+# of JSON per run, so that results can be compared from build to build
+# without needing anyone's real repository.
+#
+# usage: bench.sh [SUBCONVERT] [WORKLOAD...]
+#
+# The dumps are generated by py/gen-dump.py from fixed seeds, and kept
+# in $BENCH_DIR (by default a directory in /dev/shm, so that conversions
+# write to tmpfs) for later runs.  Each workload is scanned, scanned
+# with checksum verification, and converted; a conversion's line
+# includes its --stats-json figures.
+
+set -o errexit
+
+TOP=$(cd "$(dirname "$0")/.." && pwd)
+SUBCONVERT=$(cd "$(dirname "${1:-./subconvert}")" && pwd)/$(basename "${1:-./subconvert}")
+shift || true
+
+if [[ -d /dev/shm ]]; then
+    BENCH_DIR=${BENCH_DIR:-/dev/shm/subconvert-bench}
+else
+    BENCH_DIR=${BENCH_DIR:-${TMPDIR:-/tmp}/subconvert-bench}
+fi
+mkdir -p "$BENCH_DIR"
+
+# The parameters of each workload.  Changing these changes the dumps;
+# add new workloads rather than altering old ones, so that results stay
+# comparable.
+workload() {
+    case $1 in
+        small)
+            echo --seed 1 --revisions 2000 --files 500 ;;
+        large-files)
+            echo --seed 2 --revisions 1000 --files 200 \
+                 --size-median 65536 --size-sigma 1.5 ;;
+        many-copies)
+            echo --seed 3 --revisions 5000 --files 1000 \
+                 --copy-every 10 --copy-distance 2000 ;;
+        wide)
+            echo --seed 4 --revisions 2000 --files 20000 --dirs 500 \
+                 --changes 20 ;;
+        *)
+            echo "Unknown workload: $1" >&2
+            exit 1 ;;
+    esac
+}
+
+if [[ $# -eq 0 ]]; then
+    set -- small large-files many-copies wide
+fi
+
+now() {
+    date +%s.%N
+}
+
+# Time a command, printing its result line: the command's own last line
+# of JSON, if it printed one, is included as "stats".
+run() {
+    local name=$1 command=$2
+    shift 2
+
+    local start=$(now)
+    "$@" > "$BENCH_DIR/$name.log" 2>&1 \
+        || { echo "$name $command failed; see $BENCH_DIR/$name.log" >&2;
+             exit 1; }
+    local end=$(now)
+
+    local stats=$(tr '\r' '\n' < "$BENCH_DIR/$name.log" | grep '^{' | tail -1)
+    printf '{"workload":"%s","command":"%s","seconds":%.3f,"bytes":%d%s}\n' \
+        "$name" "$command" "$(awk "BEGIN { print $end - $start }")" \
+        "$(stat -c %s "$BENCH_DIR/$name.dump" 2>/dev/null ||
+           stat -f %z "$BENCH_DIR/$name.dump")" \
+        "${stats:+,\"stats\":$stats}"
+}
+
+for name in "$@"; do
+    params=$(workload $name)
+
+    # Regenerate a dump only if its parameters have changed.
+    if [[ ! -f "$BENCH_DIR/$name.dump" ||
+          "$(cat "$BENCH_DIR/$name.params" 2>/dev/null)" != "$params" ]]; then
+        rm -f "$BENCH_DIR/$name.dump" "$BENCH_DIR/$name.dump.idx"
+        python3 "$TOP/py/gen-dump.py" $params                  \
+            --authors-file "$BENCH_DIR/$name.authors"          \
+            --branches-file "$BENCH_DIR/$name.branches"        \
+            "$BENCH_DIR/$name.dump"
+        echo "$params" > "$BENCH_DIR/$name.params"
+    fi
+
+    run $name scan        "$SUBCONVERT" -q scan "$BENCH_DIR/$name.dump"
+    run $name scan-verify "$SUBCONVERT" -q --verify scan \
+        "$BENCH_DIR/$name.dump"
+
+    rm -fr "$BENCH_DIR/$name.git"
+    git init -q --bare "$BENCH_DIR/$name.git"
+    run $name convert "$SUBCONVERT" -q --stats-json \
+        -A "$BENCH_DIR/$name.authors" -B "$BENCH_DIR/$name.branches"     \
+        convert "$BENCH_DIR/$name.dump" "$BENCH_DIR/$name.git"
+    rm -fr "$BENCH_DIR/$name.git"
+done
@@ -27,8 +27,26 @@ cd $BOOST
 (cd boost-modularize; git pull)
 
 svnsync --non-interactive sync file://$PWD/boost.svnrepo
-svnadmin dump -q boost.svnrepo > boost.svnrepo.dump
-#pxz -9ve boost.svnrepo.dump
+
+# If an earlier conversion is at hand, only the revisions since the last
+# one it converted need dumping and converting.
+LAST_REV=$(git --git-dir=boost-history.git log -1 --format=%B flat-history \
+               2>/dev/null | sed -n 's/^SVN-Revision: //p')
+HEAD_REV=$(svnlook youngest boost.svnrepo)
+
+if [[ -n "$LAST_REV" ]]; then
+    DUMP=$BOOST/boost.svnrepo.incr.dump
+    if [[ $LAST_REV -lt $HEAD_REV ]]; then
+        svnadmin dump -q --incremental -r $((LAST_REV + 1)):HEAD \
+            boost.svnrepo > $DUMP
+    else
+        : > $DUMP
+    fi
+else
+    DUMP=$BOOST/boost.svnrepo.dump
+    svnadmin dump -q boost.svnrepo > $DUMP
+    #pxz -9ve boost.svnrepo.dump
+fi
 
 perl -i -pe "s%url =.*%url = file://$PWD/boost.svnrepo%;" boost-clone/.git/config
 (cd boost-clone; git svn fetch; git reset --hard trunk)
@@ -45,11 +63,17 @@ if [[ -d $RAMDISK/cpp ]]; then
     mkdir $RAMDISK/cpp
     cd $RAMDISK/cpp
 
-    git init
-    if "$MIGRATE/subconvert" -q                                           \
+    if [[ -n "$LAST_REV" ]]; then
+        rsync -a $BOOST/boost-history.git/ .git/
+        INCREMENTAL=--incremental
+    else
+        git init
+        INCREMENTAL=
+    fi
+    if "$MIGRATE/subconvert" -q $INCREMENTAL                              \
            -A "$MIGRATE/doc/authors.txt"                                  \
            -B "$MIGRATE/doc/branches.txt"                                 \
-           convert $BOOST/boost.svnrepo.dump; then
+           convert $DUMP; then
         git symbolic-ref HEAD refs/heads/trunk
         git prune
         sleep 5
@@ -0,0 +1,278 @@
+#!/usr/bin/env python3
+#
+# Write a synthetic Subversion dump, for benchmarking subconvert without
+# needing a real repository's history.  The same parameters and seed
+# always produce the same dump, byte for byte.
+#
+# The repository has the usual trunk, branches and tags layout.  After
+# the first revision populates trunk, each revision either changes a few
+# files on trunk or on a live branch, adding and deleting some along the
+# way, or copies trunk as it stood some revisions ago to a new branch or
+# tag.  Authors and branches files for converting the dump can be
+# written alongside it.
+
+import argparse
+import bisect
+import hashlib
+import random
+import sys
+import time
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('output', help='dump file to write, or - for stdout')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--revisions', type=int, default=1000,
+                        help='number of revisions after r0')
+    parser.add_argument('--files', type=int, default=200,
+                        help='files initially on trunk')
+    parser.add_argument('--dirs', type=int, default=20,
+                        help='directories the files are spread across')
+    parser.add_argument('--changes', type=float, default=3.0,
+                        help='mean files changed per revision')
+    parser.add_argument('--size-median', type=int, default=2048,
+                        help='median size of a file text, in bytes')
+    parser.add_argument('--size-sigma', type=float, default=1.0,
+                        help='spread of the log-normal text sizes')
+    parser.add_argument('--copy-every', type=int, default=50,
+                        help='on average, one branch or tag copy every so '
+                        'many revisions; 0 for none')
+    parser.add_argument('--tag-ratio', type=float, default=0.5,
+                        help='fraction of copies which are tags')
+    parser.add_argument('--copy-distance', type=int, default=100,
+                        help='how many revisions back a copy may come from')
+    parser.add_argument('--branch-changes', type=float, default=0.2,
+                        help='fraction of changes made on a branch')
+    parser.add_argument('--authors', type=int, default=5,
+                        help='number of distinct committers')
+    parser.add_argument('--authors-file',
+                        help='write an authors file for the dump here')
+    parser.add_argument('--branches-file',
+                        help='write a branches file for the dump here')
+    return parser.parse_args()
+
+
+class DumpWriter(object):
+    def __init__(self, out):
+        self.out = out
+
+    def write(self, data):
+        self.out.write(data if isinstance(data, bytes) else data.encode())
+
+    @staticmethod
+    def props(items):
+        data = b''
+        for key, value in items:
+            key   = key.encode()
+            value = value.encode()
+            data += b'K %d\n%s\nV %d\n%s\n' % (len(key), key,
+                                              len(value), value)
+        return data + b'PROPS-END\n'
+
+    def header(self):
+        self.write('SVN-fs-dump-format-version: 2\n\n'
+                   'UUID: 00000000-0000-0000-0000-000000000000\n\n')
+
+    def revision(self, rev, author, date, log):
+        items = [('svn:date', date)]
+        if author is not None:
+            items = [('svn:author', author)] + items + [('svn:log', log)]
+        props = self.props(items)
+        self.write('Revision-number: %d\n'
+                   'Prop-content-length: %d\n'
+                   'Content-length: %d\n\n' % (rev, len(props), len(props)))
+        self.write(props)
+        self.write('\n')
+
+    def add_dir(self, path, from_path=None, from_rev=None):
+        self.write('Node-path: %s\nNode-kind: dir\nNode-action: add\n' % path)
+        if from_path is not None:
+            self.write('Node-copyfrom-rev: %d\nNode-copyfrom-path: %s\n\n\n'
+                       % (from_rev, from_path))
+        else:
+            props = self.props([])
+            self.write('Prop-content-length: %d\nContent-length: %d\n\n'
+                       % (len(props), len(props)))
+            self.write(props)
+            self.write('\n\n')
+
+    def file(self, path, action, text):
+        props = self.props([]) if action == 'add' else b''
+        self.write('Node-path: %s\nNode-kind: file\nNode-action: %s\n'
+                   % (path, action))
+        if props:
+            self.write('Prop-content-length: %d\n' % len(props))
+        self.write('Text-content-length: %d\n'
+                   'Text-content-md5: %s\n'
+                   'Content-length: %d\n\n'
+                   % (len(text), hashlib.md5(text).hexdigest(),
+                      len(props) + len(text)))
+        self.write(props)
+        self.write(text)
+        self.write('\n\n')
+
+    def delete(self, path):
+        self.write('Node-path: %s\nNode-action: delete\n\n\n' % path)
+
+
+class Generator(object):
+    def __init__(self, args, writer):
+        self.args    = args
+        self.writer  = writer
+        self.rng     = random.Random(args.seed)
+        self.authors = ['user%d' % n for n in range(args.authors)]
+
+        # Texts are slices of one block of random words, each headed by
+        # a line naming where it came from, so that every text differs.
+        words = ['%x' % self.rng.getrandbits(32) for _ in range(8192)]
+        self.filler = ' '.join(words).encode()
+        while len(self.filler) < 4 * 1024 * 1024:
+            self.filler += self.filler
+
+        self.trunk      = (set(), set()) # files and directories on trunk
+        self.trunk_past = []            # (rev, files, dirs) as trunk changes
+        self.branches   = {}            # branch name -> its files and dirs
+        self.tags       = []
+        self.next_file  = 0
+
+    def text(self, path, rev):
+        size = int(self.rng.lognormvariate(0, self.args.size_sigma) *
+                   self.args.size_median)
+        size = min(size, len(self.filler) // 2)
+        start = self.rng.randrange(len(self.filler) - size)
+        return (b'%s r%d\n' % (path.encode(), rev) +
+                self.filler[start:start + size])
+
+    def new_file(self):
+        name = 'dir%d/file%d.c' % (self.rng.randrange(self.args.dirs),
+                                   self.next_file)
+        self.next_file += 1
+        return name
+
+    def date(self, rev):
+        # An hour apart, from the start of 2005.
+        return time.strftime('%Y-%m-%dT%H:%M:%S.000000Z',
+                             time.gmtime(1104537600 + rev * 3600))
+
+    def trunk_at(self, rev):
+        i = bisect.bisect_right([past[0] for past in self.trunk_past], rev) - 1
+        return self.trunk_past[i][1:]
+
+    def trunk_changed(self, rev):
+        self.trunk_past.append((rev, frozenset(self.trunk[0]),
+                                frozenset(self.trunk[1])))
+
+    def populate(self, rev):
+        w = self.writer
+        for top in ('trunk', 'branches', 'tags'):
+            w.add_dir(top)
+        files, dirs = self.trunk
+        for _ in range(self.args.files):
+            path = self.new_file()
+            d = path.split('/')[0]
+            if d not in dirs:
+                dirs.add(d)
+                w.add_dir('trunk/' + d)
+            w.file('trunk/' + path, 'add', self.text(path, rev))
+            files.add(path)
+        self.trunk_changed(rev)
+
+    def copy(self, rev):
+        first = max(1, rev - self.args.copy_distance)
+        from_rev = self.rng.randint(first, rev - 1)
+        if self.rng.random() < self.args.tag_ratio:
+            name = 'tag%d' % len(self.tags)
+            self.tags.append(name)
+            path = 'tags/' + name
+        else:
+            name = 'branch%d' % len(self.branches)
+            files, dirs = self.trunk_at(from_rev)
+            self.branches[name] = (set(files), set(dirs))
+            path = 'branches/' + name
+        self.writer.add_dir(path, 'trunk', from_rev)
+
+    def change(self, rev):
+        if self.branches and self.rng.random() < self.args.branch_changes:
+            name        = self.rng.choice(sorted(self.branches))
+            files, dirs = self.branches[name]
+            root        = 'branches/' + name
+        else:
+            files, dirs = self.trunk
+            root        = 'trunk'
+
+        count = max(1, int(self.rng.expovariate(1.0 / self.args.changes)))
+        for _ in range(count):
+            roll = self.rng.random()
+            if roll < 0.1 or not files:
+                path = self.new_file()
+                d = path.split('/')[0]
+                if d not in dirs:
+                    dirs.add(d)
+                    self.writer.add_dir(root + '/' + d)
+                self.writer.file(root + '/' + path, 'add',
+                                 self.text(path, rev))
+                files.add(path)
+            elif roll < 0.15 and len(files) > 1:
+                path = self.rng.choice(sorted(files))
+                self.writer.delete(root + '/' + path)
+                files.discard(path)
+            else:
+                path = self.rng.choice(sorted(files))
+                self.writer.file(root + '/' + path, 'change',
+                                 self.text(path, rev))
+
+        if root == 'trunk':
+            self.trunk_changed(rev)
+
+    def run(self):
+        w = self.writer
+        w.header()
+        w.revision(0, None, self.date(0), None)
+        for rev in range(1, self.args.revisions + 1):
+            author = self.authors[self.rng.randrange(len(self.authors))]
+            w.revision(rev, author, self.date(rev), 'Change %d' % rev)
+            if rev == 1:
+                self.populate(rev)
+            elif (self.args.copy_every > 0 and
+                  self.rng.random() < 1.0 / self.args.copy_every):
+                self.copy(rev)
+            else:
+                self.change(rev)
+
+    def write_authors(self, pathname):
+        with open(pathname, 'w') as out:
+            for author in self.authors:
+                out.write('%s\t%s\t%s<>example~com\n'
+                          % (author, author.capitalize(), author))
+
+    def write_branches(self, pathname):
+        with open(pathname, 'w') as out:
+            out.write('branch\t1\t%s\t0\ttrunk\ttrunk\n' % self.date(1)[:10])
+            for name in sorted(self.branches):
+                out.write('branch\t1\t%s\t0\tbranches/%s\t%s\n'
+                          % (self.date(1)[:10], name, name))
+            for name in self.tags:
+                out.write('tag\t1\t%s\t0\ttags/%s\t%s\n'
+                          % (self.date(1)[:10], name, name))
+
+
+def main():
+    args = parse_args()
+    if args.output == '-':
+        out = sys.stdout.buffer
+    else:
+        out = open(args.output, 'wb')
+
+    generator = Generator(args, DumpWriter(out))
+    generator.run()
+    out.flush()
+
+    if args.authors_file:
+        generator.write_authors(args.authors_file)
+    if args.branches_file:
+        generator.write_branches(args.branches_file)
+
+
+if __name__ == '__main__':
+    main()
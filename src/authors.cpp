@@ -120,12 +120,33 @@ void Authors::operator()(const SvnDump::File& dump, const SvnDump::File::Node&)
   }
 }
 
+/**
+ * Fold in the counts gathered by another scanner over a different range
+ * of revisions.
+ */
+void Authors::merge(const Authors& partial)
+{
+  for (authors_map::const_iterator i = partial.authors.begin();
+       i != partial.authors.end();
+       ++i) {
+    authors_map::iterator j = authors.find((*i).first);
+    if (j != authors.end())
+      (*j).second.count += (*i).second.count;
+    else
+      authors.insert(*i);
+  }
+}
+
 void Authors::finish()
 {
   status->finish();
+  write(status->out);
+}
 
+void Authors::write(std::ostream& out) const
+{
   for (authors_map::const_iterator i = authors.begin();
        i != authors.end();
        ++i)
-    status->out << (*i).first << "\t\t\t" << (*i).second.count << '\n';
+    out << (*i).first << "\t\t\t" << (*i).second.count << '\n';
 }
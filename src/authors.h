@@ -61,7 +61,9 @@ struct Authors
   int load_authors(const filesystem::path& pathname);
 
   void operator()(const SvnDump::File& dump, const SvnDump::File::Node&);
+  void merge(const Authors& partial);
   void finish();
+  void write(std::ostream& out) const;
 };
 
 #endif // _AUTHORS_H
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _BLOBCACHE_H
+#define _BLOBCACHE_H
+
+#include "svndump.h"
+#include "tokenizer.h"
+#include "gitutil.h"
+#include "lrucache.h"
+
+/**
+ * A bounded, least-recently-used map from the checksums a dump records
+ * for a text (Text-content-length, -sha1 and -md5) to the Git blob
+ * already made from that text.  Dumps repeat identical contents
+ * all the time -- reverts, vendor drops, copies replayed as full text --
+ * and a hit yields the blob without hashing, compressing or writing the
+ * text again, or even applying its delta.
+ *
+ * The checksums are those of the full text, also for deltas, so they
+ * name the same contents wherever they appear.  Both must be present:
+ * different files do share a SHA-1 (the SHAttered PDFs were committed to
+ * WebKit's repository) or an MD5, but not both at once.  The length is
+ * that of the delta for a delta, so it only ever narrows the match.
+ */
+class BlobCache : public LruCache<std::string, Git::BlobPtr>
+{
+  // Roughly what each entry costs, besides its key: the list node, the
+  // map node, the strings' own storage and the blob itself.
+  static const std::size_t ENTRY_OVERHEAD = 128 + sizeof(Git::Blob);
+
+  static bool key(const SvnDump::File::Node& node, std::string& k) {
+    if (! node.has_sha1() || ! node.has_md5())
+      return false;
+
+    unsigned char digest[20 + 16];
+    if (! SvnDump::decode_hex(node.get_text_sha1(), digest, 20) ||
+        ! SvnDump::decode_hex(node.get_text_md5(), digest + 20, 16))
+      return false;
+
+    std::uint64_t length = node.get_text_length();
+    k.assign(reinterpret_cast<const char *>(&length), sizeof(length));
+    k.append(reinterpret_cast<const char *>(digest), sizeof(digest));
+    return true;
+  }
+
+public:
+  BlobCache(std::size_t max_bytes = 32 * 1024 * 1024)
+    : LruCache(max_bytes) {}
+
+  /**
+   * The blob is returned as is, possibly still with the pack writer's
+   * workers, so that a hit never waits for one.  Give it a name of its
+   * own with copy_to_name().
+   */
+  Git::BlobPtr find(const SvnDump::File::Node& node) {
+    std::string k;
+    if (! key(node, k))
+      return nullptr;
+
+    Git::BlobPtr * blob = LruCache::find(k);
+    return blob ? *blob : nullptr;
+  }
+
+  void insert(const SvnDump::File::Node& node, Git::BlobPtr blob) {
+    std::string k;
+    if (key(node, k))
+      LruCache::insert(k, blob, 2 * k.length() + ENTRY_OVERHEAD);
+  }
+};
+
+#endif // _BLOBCACHE_H
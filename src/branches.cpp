@@ -82,17 +82,12 @@ int Branches::load_branches(const filesystem::path& pathname,
     if (! converter.repository->find_branch_by_path(branch->prefix, branch))
       ++errors;
 
-    for (filesystem::path dirname(branch->prefix.parent_path());
-         ! dirname.empty();
-         dirname = dirname.parent_path()) {
-      Git::Repository::branches_path_map::iterator i =
-        converter.repository->branches_by_path.find(dirname);
-      if (i != converter.repository->branches_by_path.end()) {
-        status.warn(std::string("Parent of branch prefix ") +
-                    branch->prefix.string() + " exists: " +
-                    (*i).second->prefix.string());
-        ++errors;
-      }
+    if (Git::BranchPtr parent = converter.repository->find_branch_within
+        (branch->prefix.parent_path())) {
+      status.warn(std::string("Parent of branch prefix ") +
+                  branch->prefix.string() + " exists: " +
+                  parent->prefix.string());
+      ++errors;
     }
   }
   return errors;
@@ -101,45 +96,23 @@ int Branches::load_branches(const filesystem::path& pathname,
 void Branches::apply_action(int rev, std::time_t date,
                             const filesystem::path& pathname)
 {
-  optional<branches_map::iterator> branch;
-
-  branches_map::iterator i = branches.find(pathname);
-  if (i != branches.end()) {
-    branch = i;
-  } else {
-    std::vector<filesystem::path> to_remove;
-
-    for (branches_map::iterator j = branches.begin();
-         j != branches.end();
-         ++j)
-      if (starts_with((*j).first.string(), pathname.string() + '/'))
-        to_remove.push_back((*j).first);
-
-    for (std::vector<filesystem::path>::iterator j = to_remove.begin();
-         j != to_remove.end();
-         ++j)
-      branches.erase(*j);
-
-    for (branches_map::iterator j = branches.begin();
-         j != branches.end();
-         ++j)
-      if (starts_with(pathname.string(), (*j).first.string() + '/')) {
-        branch = j;
-        break;
-      }
+  BranchInfo * branch = branches.find(pathname);
+  if (! branch) {
+    // An action at a path takes in any branches beneath it, and belongs
+    // to the branch above it, if there is one.
+    branches.erase_below(pathname);
 
+    branch = branches.find_within(pathname);
     if (! branch) {
-      std::pair<branches_map::iterator, bool> result =
-        branches.insert(branches_value(pathname, BranchInfo()));
-      assert(result.second);
-      branch = result.first;
+      branches.insert(pathname, BranchInfo());
+      branch = branches.find(pathname);
     }
   }
 
-  if ((**branch).second.last_rev != rev) {
-    (**branch).second.last_rev  = rev;
-    (**branch).second.last_date = date;
-    ++(**branch).second.changes;
+  if (branch->last_rev != rev) {
+    branch->last_rev  = rev;
+    branch->last_date = date;
+    ++branch->changes;
   }
 }
 
@@ -154,27 +127,55 @@ void Branches::operator()(const SvnDump::File&       dump,
 
   if (node.get_action() != SvnDump::File::Node::ACTION_DELETE &&
       (node.get_kind()  == SvnDump::File::Node::KIND_FILE ||
-       node.has_copy_from()))
-    apply_action(rev, dump.get_rev_date(),
-                 node.get_kind() == SvnDump::File::Node::KIND_DIR ?
-                 node.get_path() : node.get_path().parent_path());
+       node.has_copy_from())) {
+    filesystem::path pathname(node.get_kind() == SvnDump::File::Node::KIND_DIR ?
+                              node.get_path() : node.get_path().parent_path());
+    if (! deferred) {
+      apply_action(rev, dump.get_rev_date(), pathname);
+    }
+    // Repeating an action within the same revision has no effect, so
+    // only the first of a run needs to be kept.
+    else if (actions.empty() || actions.back().rev != rev ||
+             actions.back().pathname != pathname) {
+      Action action;
+      action.rev      = rev;
+      action.date     = dump.get_rev_date();
+      action.pathname = pathname;
+      actions.push_back(action);
+    }
+  }
+}
+
+/**
+ * Apply the actions recorded by a deferred scanner, which must cover the
+ * revisions immediately following those already seen here.
+ */
+void Branches::replay(const actions_vector& partial)
+{
+  for (actions_vector::const_iterator i = partial.begin();
+       i != partial.end();
+       ++i)
+    apply_action((*i).rev, (*i).date, (*i).pathname);
 }
 
 void Branches::finish()
 {
   status.finish();
+  write(status.out);
+}
 
-  for (branches_map::const_iterator i = branches.begin();
-       i != branches.end();
-       ++i) {
-    char buf[64];
-    struct tm * then = std::gmtime(&(*i).second.last_date);
-    std::strftime(buf, 63, "%Y-%m-%d", then);
-
-    status.out << ((*i).second.changes == 1 ? "tag" : "branch") << '\t'
-               << (*i).second.last_rev << '\t' << buf << '\t'
-               << (*i).second.changes << '\t'
-               << (*i).first.string() << '\t' << (*i).first.string()
-               << '\n';
-  }
+void Branches::write(std::ostream& out) const
+{
+  branches.for_each([&out](const filesystem::path& pathname,
+                           const BranchInfo&       info) {
+      char buf[64];
+      struct tm * then = std::gmtime(&info.last_date);
+      std::strftime(buf, 63, "%Y-%m-%d", then);
+
+      out << (info.changes == 1 ? "tag" : "branch") << '\t'
+          << info.last_rev << '\t' << buf << '\t'
+          << info.changes << '\t'
+          << pathname.string() << '\t' << pathname.string()
+          << '\n';
+    });
 }
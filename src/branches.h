@@ -49,14 +49,27 @@ struct Branches
     BranchInfo() : last_rev(0), changes(0), last_date(0) {}
   };
 
-  typedef std::map<filesystem::path, BranchInfo> branches_map;
-  typedef branches_map::value_type branches_value;
+  typedef Git::PathTrie<BranchInfo> branches_trie;
 
-  branches_map   branches;      // only used for the "branches" command
+  // Each action depends on all those before it, so a scanner covering
+  // only part of the dump records its actions, to be replayed in order
+  // on the scanner covering everything before it.
+  struct Action {
+    int              rev;
+    std::time_t      date;
+    filesystem::path pathname;
+  };
+
+  typedef std::vector<Action> actions_vector;
+
+  branches_trie  branches;      // only used for the "branches" command
+  actions_vector actions;       // only used if `deferred'
   StatusDisplay& status;
   int            last_rev;
+  bool           deferred;
 
-  Branches(StatusDisplay& _status) : status(_status), last_rev(-1) {}
+  Branches(StatusDisplay& _status, bool _deferred = false)
+    : status(_status), last_rev(-1), deferred(_deferred) {}
 
   static int load_branches(const filesystem::path& pathname,
                            ConvertRepository& converter,
@@ -66,7 +79,9 @@ struct Branches
                     const filesystem::path& pathname);
   void operator()(const SvnDump::File&       dump,
                   const SvnDump::File::Node& node);
+  void replay(const actions_vector& partial);
   void finish();
+  void write(std::ostream& out) const;
 };
 
 #endif // _BRANCHES_H
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "checkpoint.h"
+
+namespace {
+  const char CHECKPOINT_MAGIC[8] = { 'S', 'V', 'N', 'C', 'K', 'P', '0', '1' };
+  const char REV_TREES_MAGIC[8]  = { 'S', 'V', 'N', 'R', 'E', 'V', '0', '1' };
+
+  struct CheckpointHeader {
+    char          magic[8];
+    std::int32_t  last_rev;
+    std::uint32_t has_history;
+    git_oid       history;
+    std::uint32_t rev_tree_count;
+    std::uint32_t copy_from_count;
+    std::uint32_t branch_count;
+    std::uint32_t copies_known;
+  };
+}
+
+bool Checkpoint::load(const filesystem::path& pathname)
+{
+  system::error_code ec;
+  std::uint64_t size = filesystem::file_size(pathname, ec);
+  if (ec)
+    return false;
+
+  filesystem::ifstream in(pathname, std::ios::binary);
+  if (! in.good())
+    return false;
+
+  CheckpointHeader header;
+  in.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (! in.good() ||
+      std::memcmp(header.magic, CHECKPOINT_MAGIC,
+                  sizeof(CHECKPOINT_MAGIC)) != 0)
+    return false;
+
+  // The counts come from disk, so don't allocate for them unless the
+  // file really holds that much; the branches' names follow, each
+  // checked against what remains.
+  std::uint64_t used =
+    sizeof(header) +
+    std::uint64_t(header.rev_tree_count) * sizeof(RevTree) +
+    std::uint64_t(header.copy_from_count) * 2 * sizeof(std::int32_t);
+  if (used > size)
+    return false;
+
+  last_rev     = header.last_rev;
+  has_history  = header.has_history != 0;
+  history      = header.history;
+  copies_known = header.copies_known != 0;
+
+  rev_trees.resize(header.rev_tree_count);
+  if (header.rev_tree_count > 0)
+    in.read(reinterpret_cast<char *>(&rev_trees[0]),
+            static_cast<std::streamsize>(sizeof(RevTree) *
+                                         header.rev_tree_count));
+
+  std::vector<std::int32_t> pairs(std::size_t(header.copy_from_count) * 2);
+  if (! pairs.empty())
+    in.read(reinterpret_cast<char *>(&pairs[0]),
+            static_cast<std::streamsize>(sizeof(std::int32_t) * pairs.size()));
+  copy_from.clear();
+  for (std::size_t i = 0; i < pairs.size(); i += 2)
+    copy_from.push_back(copy_from_value(pairs[i], pairs[i + 1]));
+
+  branches.clear();
+  for (std::uint32_t i = 0; i < header.branch_count && in.good(); ++i) {
+    git_oid       oid;
+    std::uint32_t len;
+    in.read(reinterpret_cast<char *>(&oid), sizeof(oid));
+    in.read(reinterpret_cast<char *>(&len), sizeof(len));
+
+    used += sizeof(oid) + sizeof(len) + len;
+    if (used > size)
+      return false;
+
+    std::string name(len, '\0');
+    if (len > 0)
+      in.read(&name[0], static_cast<std::streamsize>(len));
+    branches.push_back(branch_value(name, oid));
+  }
+
+  return in.good();
+}
+
+bool Checkpoint::save(const filesystem::path& pathname) const
+{
+  CheckpointHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+  header.last_rev        = last_rev;
+  header.has_history     = has_history ? 1 : 0;
+  if (has_history)
+    header.history       = history;
+  header.rev_tree_count  = static_cast<std::uint32_t>(rev_trees.size());
+  header.copy_from_count = static_cast<std::uint32_t>(copy_from.size());
+  header.branch_count    = static_cast<std::uint32_t>(branches.size());
+  header.copies_known    = copies_known ? 1 : 0;
+
+  std::vector<std::int32_t> pairs;
+  pairs.reserve(copy_from.size() * 2);
+  for (copy_from_vector::const_iterator i = copy_from.begin();
+       i != copy_from.end();
+       ++i) {
+    pairs.push_back((*i).first);
+    pairs.push_back((*i).second);
+  }
+
+  filesystem::path temp(pathname.string() + ".tmp");
+  {
+    filesystem::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    if (! out.good())
+      return false;
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    if (! rev_trees.empty())
+      out.write(reinterpret_cast<const char *>(&rev_trees[0]),
+                static_cast<std::streamsize>(sizeof(RevTree) *
+                                             rev_trees.size()));
+    if (! pairs.empty())
+      out.write(reinterpret_cast<const char *>(&pairs[0]),
+                static_cast<std::streamsize>(sizeof(std::int32_t) *
+                                             pairs.size()));
+
+    for (branches_vector::const_iterator i = branches.begin();
+         i != branches.end();
+         ++i) {
+      std::uint32_t len = static_cast<std::uint32_t>((*i).first.length());
+      out.write(reinterpret_cast<const char *>(&(*i).second),
+                sizeof((*i).second));
+      out.write(reinterpret_cast<const char *>(&len), sizeof(len));
+      out.write((*i).first.data(), static_cast<std::streamsize>(len));
+    }
+
+    out.flush();
+    if (! out.good())
+      return false;
+  }
+
+  system::error_code ec;
+  filesystem::rename(temp, pathname, ec);
+  return ! ec;
+}
+
+bool Checkpoint::load_rev_trees(const filesystem::path& pathname,
+                                rev_trees_vector&       rev_trees)
+{
+  system::error_code ec;
+  std::uint64_t size = filesystem::file_size(pathname, ec);
+  if (ec)
+    return false;
+
+  filesystem::ifstream in(pathname, std::ios::binary);
+  if (! in.good())
+    return false;
+
+  char          magic[8];
+  std::uint64_t count;
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char *>(&count), sizeof(count));
+  if (! in.good() ||
+      std::memcmp(magic, REV_TREES_MAGIC, sizeof(REV_TREES_MAGIC)) != 0)
+    return false;
+
+  // Likewise, the file must hold exactly the trees it claims to.
+  if (count > (size - sizeof(magic) - sizeof(count)) / sizeof(RevTree) ||
+      sizeof(magic) + sizeof(count) + count * sizeof(RevTree) != size)
+    return false;
+
+  rev_trees.resize(count);
+  if (count > 0)
+    in.read(reinterpret_cast<char *>(&rev_trees[0]),
+            static_cast<std::streamsize>(sizeof(RevTree) * count));
+  if (! in.good()) {
+    rev_trees.clear();
+    return false;
+  }
+  return true;
+}
+
+bool Checkpoint::save_rev_trees(const filesystem::path& pathname,
+                                const rev_trees_vector& rev_trees)
+{
+  std::uint64_t count = rev_trees.size();
+
+  filesystem::path temp(pathname.string() + ".tmp");
+  {
+    filesystem::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    if (! out.good())
+      return false;
+
+    out.write(REV_TREES_MAGIC, sizeof(REV_TREES_MAGIC));
+    out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    if (count > 0)
+      out.write(reinterpret_cast<const char *>(&rev_trees[0]),
+                static_cast<std::streamsize>(sizeof(RevTree) * count));
+
+    out.flush();
+    if (! out.good())
+      return false;
+  }
+
+  system::error_code ec;
+  filesystem::rename(temp, pathname, ec);
+  return ! ec;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+
+#include "system.hpp"
+
+using namespace boost;
+
+/**
+ * The state of a conversion as of the end of one revision: the commit
+ * of every branch, the trees kept for later copies, and the copies still
+ * to come.  Only object ids are recorded, since everything they name has
+ * been written to the repository before the checkpoint is saved (as
+ * subconvert.checkpoint in its Git directory); resuming reads the
+ * objects back from there.
+ *
+ * Like the dump index, a checkpoint is stored in native byte order, and
+ * is replaced only by renaming a completely written file over it.
+ */
+struct Checkpoint
+{
+  struct RevTree {
+    std::int32_t rev;
+    git_oid      oid;           // all zeroes for an empty tree
+  };
+
+  typedef std::vector<RevTree> rev_trees_vector;
+
+  typedef std::pair<int, int>          copy_from_value;
+  typedef std::vector<copy_from_value> copy_from_vector;
+
+  typedef std::pair<std::string, git_oid> branch_value;
+  typedef std::vector<branch_value>       branches_vector;
+
+  int              last_rev;
+  bool             has_history;
+  git_oid          history;     // the flat-history commit, if any
+  rev_trees_vector rev_trees;
+  copy_from_vector copy_from;
+  bool             copies_known; // copy_from lists every copy to come
+  branches_vector  branches;    // only those with commits
+
+  Checkpoint() : last_rev(-1), has_history(false), copies_known(false) {}
+
+  static filesystem::path checkpoint_path(const filesystem::path& git_dir) {
+    return git_dir / "subconvert.checkpoint";
+  }
+  static filesystem::path rev_trees_path(const filesystem::path& git_dir) {
+    return git_dir / "subconvert.revtrees";
+  }
+
+  bool load(const filesystem::path& pathname);
+  bool save(const filesystem::path& pathname) const;
+
+  /**
+   * The flat history's tree for every revision of a finished conversion
+   * is kept beside the checkpoint, in the same form, so that a later
+   * incremental conversion can read back whichever of them it copies
+   * from.
+   */
+  static bool load_rev_trees(const filesystem::path& pathname,
+                             rev_trees_vector& rev_trees);
+  static bool save_rev_trees(const filesystem::path& pathname,
+                             const rev_trees_vector& rev_trees);
+};
+
+#endif // _CHECKPOINT_H
@@ -31,86 +31,272 @@
  */
 
 #include "converter.h"
+#include "modules.h"
+#include "stats.h"
+#include "svndiff.h"
 
 #ifndef ASSERTS
 #undef assert
 #define assert(x)
 #endif
 
+volatile std::sig_atomic_t ConvertRepository::interrupted = 0;
+
+namespace {
+  /**
+   * The revision named by the last SVN-Revision: line of a commit
+   * message, or -1 if there is none or its number is malformed.
+   */
+  int svn_revision(const std::string& message)
+  {
+    std::string::size_type pos = message.rfind("SVN-Revision: ");
+    if (pos == std::string::npos)
+      return -1;
+
+    const char * begin = message.c_str() + pos + 14;
+    const char * end   = message.c_str() + message.length();
+    const char * p     = begin;
+    while (p < end && static_cast<unsigned>(*p - '0') < 10)
+      ++p;
+    if (p == begin || p - begin > 9 || (p < end && *p != '\n'))
+      return -1;
+
+    return SvnDump::parse_number(begin, p);
+  }
+}
+
 void ConvertRepository::free_past_trees()
 {
+  Stats::Timer timer(Stats::FREE_PAST_TREES);
+
   // jww (2012-04-20): We could also free branches here that we know
   // will never receive another commit.
 
-  // We no longer need copy-from target revisions if we're passed it,
-  // _and_ we're passed the revision that needed it.
-  int popped = -1;
-  while (! copy_from.empty() &&
-         last_rev > copy_from.front().second &&
-         last_rev > copy_from.front().first) {
+  // Every copy made by a revision up to `last_rev' has been done, so
+  // the revision it copied from has one use fewer.
+  while (! copy_from.empty() && copy_from.front().first <= last_rev) {
     if (status.debug_mode()) {
       std::ostringstream buf;
       buf << "r" << copy_from.front().first
           << " no longer needs r" << copy_from.front().second;
       status.info(buf.str());
     }
-    popped = copy_from.front().second;
+
+    int source = copy_from.front().second;
     copy_from.pop_front();
-  }
 
-  if (popped >= 0) {
-    if (status.debug_mode()) {
-      std::ostringstream buf;
-      buf << copy_from.size() << " tree reservations remain";
-      status.info(buf.str());
+    copy_sources_map::iterator i = copy_sources.find(source);
+    if (i != copy_sources.end() && --(*i).second == 0) {
+      copy_sources.erase(i);
+      release_tree(tree_rev_for(source));
     }
+  }
 
-    if (status.debug_mode()) {
-      std::ostringstream buf;
-      buf << "rev_trees exist from r"
-          << (*rev_trees.begin()).first
-          << " to r"
-          << (*rev_trees.rbegin()).first;
-      status.info(buf.str());
+  if (opts.spill_after > 0)
+    spill_past_trees();
+}
+
+/**
+ * Return the revision of the tree kept for `rev': the one recorded at
+ * or most recently before it, whether in memory or spilled, or -1 if
+ * there is none.
+ */
+int ConvertRepository::tree_rev_for(int rev) const
+{
+  int tree_rev = -1;
+
+  rev_trees_map::const_iterator i = rev_trees.upper_bound(rev);
+  if (i != rev_trees.begin())
+    tree_rev = (*--i).first;
+
+  spilled_trees_map::const_iterator j = spilled_trees.upper_bound(rev);
+  if (j != spilled_trees.begin() && (*--j).first > tree_rev)
+    tree_rev = (*j).first;
+
+  return tree_rev;
+}
+
+/**
+ * Free the tree kept for revision `tree_rev' unless some revision still
+ * to be copied from resolves to it, being at or after it and before the
+ * next tree kept.  Without knowing which revisions are still to be
+ * copied from, every past tree must be kept.
+ */
+void ConvertRepository::release_tree(int tree_rev)
+{
+  if (! copies_known || tree_rev == -1)
+    return;
+
+  int next_rev = std::numeric_limits<int>::max();
+
+  rev_trees_map::const_iterator i = rev_trees.upper_bound(tree_rev);
+  if (i != rev_trees.end())
+    next_rev = (*i).first;
+
+  spilled_trees_map::const_iterator j = spilled_trees.upper_bound(tree_rev);
+  if (j != spilled_trees.end() && (*j).first < next_rev)
+    next_rev = (*j).first;
+
+  copy_sources_map::const_iterator k = copy_sources.lower_bound(tree_rev);
+  if (k != copy_sources.end() && (*k).first < next_rev)
+    return;
+
+  if (rev_trees.erase(tree_rev) == 0)
+    spilled_trees.erase(tree_rev);
+}
+
+/**
+ * The tree for a revision is the one recorded at or most recently before
+ * it, so keep only those trees which are that for some revision still to
+ * be copied from, whether in memory or spilled.  This is done once, when
+ * the copies become known; after that, free_past_trees() and
+ * begin_revision() free each tree as soon as it is no longer needed.
+ */
+void ConvertRepository::keep_needed_trees()
+{
+  std::set<int> needed;
+  for (const copy_sources_map::value_type& value : copy_sources) {
+    int tree_rev = tree_rev_for(value.first);
+    if (tree_rev != -1)
+      needed.insert(tree_rev);
+  }
+
+  std::size_t freed = 0;
+  for (rev_trees_map::iterator i = rev_trees.begin(); i != rev_trees.end();) {
+    if (needed.find((*i).first) == needed.end()) {
+      rev_trees.erase(i++);
+      ++freed;
+    } else {
+      ++i;
     }
+  }
+  for (spilled_trees_map::iterator i = spilled_trees.begin();
+       i != spilled_trees.end();) {
+    if (needed.find((*i).first) == needed.end()) {
+      spilled_trees.erase(i++);
+      ++freed;
+    } else {
+      ++i;
+    }
+  }
 
-    // Remove all past trees except the oldest one we need to refer to.
-    rev_trees_map::iterator i = rev_trees.upper_bound(popped);
-
-    if (i != rev_trees.begin()) {
-      --i;
-      if (i != rev_trees.begin()) {
-        if (status.debug_mode()) {
-          std::ostringstream buf;
-          buf << "Deleting rev_trees from r"
-              << (*rev_trees.begin()).first
-              << " to r" << (*i).first;
-          status.info(buf.str());
-        }
-        rev_trees.erase(rev_trees.begin(), i);
-      }
+  if (freed > 0 && status.debug_mode()) {
+    std::ostringstream buf;
+    buf << "Freed " << freed << " past trees; " << needed.size()
+        << " kept for " << copy_sources.size() << " revisions still to be "
+        << "copied from";
+    status.info(buf.str());
+  }
+}
+
+/**
+ * Trees kept for copies still far in the future need not be held in
+ * memory meanwhile: once written, each is reduced to its id, and only
+ * what is copied from it is read back later.  The trees of the most
+ * recent revisions, which are the most likely to be copied from again
+ * soon, stay as they are.
+ */
+void ConvertRepository::spill_past_trees()
+{
+  std::size_t spilled = 0;
+  for (rev_trees_map::iterator i = rev_trees.begin();
+       i != rev_trees.end() && last_rev - (*i).first >= opts.spill_after;) {
+    // An empty tree costs nothing to keep, and has no id of its own.
+    if ((*i).second->empty()) {
+      ++i;
+      continue;
     }
+
+    (*i).second->write();
+    spilled_trees.insert(spilled_trees_map::value_type
+                         ((*i).first, *(*i).second->get_oid()));
+    rev_trees.erase(i++);
+    ++spilled;
+  }
+
+  if (spilled > 0 && status.debug_mode()) {
+    std::ostringstream buf;
+    buf << "Spilled " << spilled << " past trees; " << rev_trees.size()
+        << " remain in memory and " << spilled_trees.size() << " on disk";
+    status.info(buf.str());
   }
 }
 
-Git::TreePtr ConvertRepository::get_past_tree()
+/**
+ * Look up `from_path' as it stood in the revision the current node
+ * copies from.  The tree for that revision is the one recorded at or
+ * most recently before it.  It is either held in memory, or known only
+ * by its id, having been spilled or converted by an earlier run; in the
+ * latter case only the part of it being copied is read back.
+ */
+Git::ObjectPtr
+ConvertRepository::lookup_past(const filesystem::path& from_path)
 {
-  rev_trees_map::const_iterator i =
-    rev_trees.upper_bound(node->get_copy_from_rev());
-  if (i == rev_trees.end()) {
-    if (! rev_trees.empty())
-      return (*rev_trees.rbegin()).second;
+  int from_rev = node->get_copy_from_rev();
+  int tree_rev = -1;
+
+  Git::TreePtr    tree;
+  const git_oid * root = nullptr;
+
+  rev_trees_map::iterator i = rev_trees.upper_bound(from_rev);
+  if (i != rev_trees.begin()) {
+    --i;
+    tree_rev = (*i).first;
+    tree     = (*i).second;
   }
-  else if (i != rev_trees.begin()) {
-    return (*--i).second;
+
+  spilled_trees_map::iterator j = spilled_trees.upper_bound(from_rev);
+  if (j != spilled_trees.begin() && (*--j).first > tree_rev) {
+    tree_rev = (*j).first;
+    root     = &(*j).second;
   }
 
-  std::ostringstream buf;
-  buf << "Could not find tree for " << node->get_copy_from_path()
-      << ", r" << node->get_copy_from_rev();
-  status.error(buf.str());
+  // A tree converted by an earlier run, unless a later one is at hand,
+  // is read back from the repository.
+  rev_tree_ids_vector::const_iterator k =
+    std::upper_bound(rev_tree_ids.begin(), rev_tree_ids.end(), from_rev,
+                     [](int r, const Checkpoint::RevTree& rev_tree) {
+                       return r < rev_tree.rev;
+                     });
+  if (k != rev_tree_ids.begin() && (*(k - 1)).rev <= base_rev &&
+      (*(k - 1)).rev > tree_rev) {
+    --k;
+    tree_rev = (*k).rev;
+    root     = &(*k).oid;
+  }
 
-  return nullptr;
+  if (tree_rev == -1) {
+    std::ostringstream buf;
+    buf << "Could not find tree for " << node->get_copy_from_path()
+        << ", r" << node->get_copy_from_rev();
+    status.error(buf.str());
+    return nullptr;
+  }
+
+  if (root == nullptr)
+    return tree->lookup(from_path);
+
+  static const git_oid empty_oid = {{ 0 }};
+  if (Git::oid_equal()(*root, empty_oid))
+    return nullptr;
+
+  git_oid      oid;
+  unsigned int attributes;
+  bool         is_tree;
+  if (! repository->read_entry(root, from_path, &oid, &attributes, &is_tree))
+    return nullptr;
+
+  std::string name(from_path.filename().string());
+  if (! is_tree)
+    return new Git::Blob(repository, &oid, name, attributes);
+
+  Git::TreePtr subtree(tree_cache.find(&oid));
+  if (! subtree) {
+    Git::Repository::trees_by_oid seen;
+    subtree = repository->read_tree(&oid, seen, name);
+    tree_cache.insert(&oid, subtree);
+  }
+  return subtree->name == name ? subtree : subtree->copy_to_name(name);
 }
 
 void ConvertRepository::establish_commit_info()
@@ -202,12 +388,82 @@ void ConvertRepository::update_object(Git::Repository *       repo,
   filesystem::path       subpath(path_len == subpath_len ?
                                  pathname : std::string(pathname.string(),
                                                         subpath_len + 1));
+  if (module) {
+    update_module(branch, branch_commit,
+                  path_len == subpath_len ? filesystem::path() : subpath, obj);
+    return;
+  }
+
   if (obj)
     branch_commit->update(subpath, obj);
   else
     branch_commit->remove(subpath);
 }
 
+/**
+ * Apply a change at `subpath' within `branch' to the module's copy of
+ * that branch, which is laid out by the module's mappings rather than as
+ * in Subversion.  The history branch, already updated, holds just those
+ * parts of the Subversion filesystem which were routed to this module.
+ */
+void ConvertRepository::update_module(Git::BranchPtr          branch,
+                                      Git::CommitPtr          branch_commit,
+                                      const filesystem::path& subpath,
+                                      Git::ObjectPtr          obj)
+{
+  // A change within a mapping lands at the same place within its target.
+  filesystem::path        rest;
+  const Module::Mapping * within = module->find_mapping(subpath, rest);
+
+  if (within && ! (within->target.empty() && rest.empty())) {
+    filesystem::path target(within->target / rest);
+    if (obj) {
+      if (obj->name.get() != target.filename().string())
+        obj = obj->copy_to_name(target.filename().string());
+      branch_commit->update(target, obj);
+    } else {
+      branch_commit->remove(target);
+    }
+    return;
+  }
+
+  // Otherwise the change takes in whole mappings, which are rebuilt from
+  // the history tree.  Replacing the module's root would also remove the
+  // targets of every other mapping, so if that happens they are all
+  // rebuilt, after the root.
+  bool everything = false;
+  for (const Module::Mapping& mapping : module->mappings)
+    if (mapping.target.empty() &&
+        (&mapping == within || mapping.is_within(subpath)))
+      everything = true;
+
+  Git::CommitPtr history_commit(history_branch->get_commit());
+
+  for (int root = 1; root >= 0; --root) {
+    for (const Module::Mapping& mapping : module->mappings) {
+      if (mapping.target.empty() != static_cast<bool>(root))
+        continue;
+      if (! everything && &mapping != within && ! mapping.is_within(subpath))
+        continue;
+
+      Git::ObjectPtr source(history_commit->lookup(branch->prefix /
+                                                   mapping.source));
+      if (mapping.target.empty()) {
+        branch_commit->remove("");
+        if (source && source->is_tree())
+          branch_commit->update("", source);
+      }
+      else if (source) {
+        branch_commit->update(mapping.target, source->copy_to_name
+                              (mapping.target.filename().string()));
+      }
+      else {
+        branch_commit->remove(mapping.target);
+      }
+    }
+  }
+}
+
 std::string
 ConvertRepository::describe_change(SvnDump::File::Node::Kind   kind,
                                    SvnDump::File::Node::Action action)
@@ -243,21 +499,24 @@ bool ConvertRepository::add_file(Git::Repository * repo,
   Git::ObjectPtr obj;
   if (node->has_copy_from()) {
     filesystem::path from_path(node->get_copy_from_path());
-    Git::TreePtr     past_tree(get_past_tree());
 
-    obj = past_tree->lookup(from_path);
+    obj = lookup_past(from_path);
     if (! obj) {
       std::ostringstream buf;
       buf << "Could not find " << from_path << " in tree r"
-          << node->get_copy_from_rev() << ":";
+          << node->get_copy_from_rev();
       status.warn(buf.str());
-
-      past_tree->dump_tree(std::cerr);
     }
 
     assert(obj);
     assert(obj->is_blob());
-    obj = obj->copy_to_name(pathname.filename().string());
+
+    // A file which was copied and then modified carries its new text;
+    // if that text is a delta, the copy source is its base.
+    if (node->has_text())
+      obj = create_blob(repo, pathname, obj);
+    else
+      obj = obj->copy_to_name(pathname.filename().string());
 
     update_object(repo, pathname, obj,
                   find_branch(repo, from_path), debug_text);
@@ -265,9 +524,15 @@ bool ConvertRepository::add_file(Git::Repository * repo,
   }
   else if (! (node->get_action() == SvnDump::File::Node::ACTION_CHANGE &&
               ! node->has_text())) {
-    obj = repo->create_blob(pathname.filename().string(),
-                            node->has_text() ? node->get_text() : "",
-                            node->has_text() ? node->get_text_length() : 0);
+    Git::ObjectPtr base;
+    if (node->is_text_delta() &&
+        node->get_action() == SvnDump::File::Node::ACTION_CHANGE) {
+      base = current_object(pathname);
+      if (! base || ! base->is_blob())
+        status.error(std::string("Could not find the base text for ") +
+                     pathname.string());
+    }
+    obj = create_blob(repo, pathname, base);
 
     update_object(repo, pathname, obj, nullptr, debug_text);
     return true;
@@ -275,6 +540,64 @@ bool ConvertRepository::add_file(Git::Repository * repo,
   return false;
 }
 
+/**
+ * Look up `pathname' in the Subversion filesystem as it stands, which
+ * includes any changes already made by the current revision.
+ */
+Git::ObjectPtr ConvertRepository::current_object(const filesystem::path& pathname)
+{
+  Git::CommitPtr commit(history_branch->next_commit ?
+                        history_branch->next_commit : history_branch->commit);
+  return commit ? commit->lookup(pathname) : nullptr;
+}
+
+/**
+ * Create a blob holding the text of the current node.  If that text is
+ * an svndiff delta, it is first applied to the contents of `base' (or to
+ * an empty text, if there is no base) to recover the file's contents.
+ */
+Git::ObjectPtr ConvertRepository::create_blob(Git::Repository *       repo,
+                                              const filesystem::path& pathname,
+                                              Git::ObjectPtr          base)
+{
+  Stats::Timer timer(Stats::CREATE_BLOB);
+
+  std::string name(pathname.filename().string());
+
+  if (node->has_text())
+    if (Git::BlobPtr blob = blob_cache.find(*node))
+      return blob->copy_to_name(name);
+
+  if (! node->is_text_delta() || ! node->has_text()) {
+    Git::BlobPtr blob
+      (repo->create_blob(name,
+                         node->has_text() ? node->get_text() : "",
+                         node->has_text() ? node->get_text_length() : 0));
+    if (node->has_text())
+      blob_cache.insert(*node, blob);
+    return blob;
+  }
+
+  std::string         read_text;
+  const std::string * base_text = &read_text;
+  if (base) {
+    base_text = text_cache.find(base->get_oid());
+    if (! base_text) {
+      repo->read_blob(base->get_oid(), read_text);
+      base_text = &read_text;
+    }
+  }
+
+  std::string text;
+  SvnDump::apply_svndiff(node->get_text(), node->get_text_length(),
+                         base_text->data(), base_text->length(), text);
+
+  Git::BlobPtr blob(repo->create_blob(name, text.data(), text.length()));
+  text_cache.insert(blob->get_oid(), text);
+  blob_cache.insert(*node, blob);
+  return blob;
+}
+
 bool ConvertRepository::add_directory(Git::Repository * repo,
                                       const filesystem::path& pathname)
 {
@@ -292,7 +615,7 @@ bool ConvertRepository::add_directory(Git::Repository * repo,
   // `obj' could be nullptr here, if the directory we're copying from had
   // no files in it.
   filesystem::path from_path(node->get_copy_from_path());
-  if (Git::ObjectPtr obj = get_past_tree()->lookup(from_path)) {
+  if (Git::ObjectPtr obj = lookup_past(from_path)) {
     assert(obj->is_tree());
     update_object(repo, pathname,
                   obj->copy_to_name(pathname.filename().string()),
@@ -310,13 +633,100 @@ bool ConvertRepository::delete_item(Git::Repository * repo,
   return true;
 }
 
-int ConvertRepository::prescan(SvnDump::File::Node& _node)
+/**
+ * Gather the texts of every file at or under `obj', which is at
+ * `relpath' relative to the path being collected.
+ */
+void ConvertRepository::collect_files(Git::ObjectPtr          obj,
+                                      const filesystem::path& relpath,
+                                      imported_files&         files)
+{
+  if (! obj)
+    return;
+
+  if (obj->is_blob()) {
+    files.push_back(imported_file(relpath, std::string()));
+    if (const std::string * text = text_cache.find(obj->get_oid()))
+      files.back().second = *text;
+    else
+      repository->read_blob(obj->get_oid(), files.back().second);
+  }
+  else if (obj->is_tree()) {
+    Git::TreePtr tree(static_cast<Git::Tree *>(obj.get()));
+    for (const Git::ObjectPtr& entry : *tree)
+      collect_files(entry, relpath / entry->name.get(), files);
+  }
+}
+
+/**
+ * Convert `_node', a copy into this module from a path which was never
+ * routed to it, by adding the files the flat conversion found at the
+ * copy's destination instead.
+ */
+void ConvertRepository::import_files(SvnDump::File::Node&  _node,
+                                     const imported_files& files)
 {
   node = &_node;
 
-  int errors = 0;
+  begin_revision();
 
-  status.update(node->get_rev_nr());
+  const filesystem::path& pathname(node->get_path());
+  for (const imported_file& file : files) {
+    filesystem::path path(file.first.empty() ?
+                          pathname : pathname / file.first);
+
+    Git::BlobPtr blob(repository->create_blob(path.filename().string(),
+                                              file.second.data(),
+                                              file.second.length()));
+    text_cache.insert(blob->get_oid(), file.second);
+
+    update_object(repository, path, blob, nullptr,
+                  std::string("FI: ") + path.string());
+  }
+}
+
+/**
+ * Note that revision `rev' copies from revision `from_rev', so the tree
+ * for `from_rev' must be kept until `rev' has been converted.
+ */
+void ConvertRepository::add_copy_from(int rev, int from_rev)
+{
+  if (copy_from.empty() ||
+      ! (copy_from.back().first == rev &&
+         copy_from.back().second == from_rev))
+    copy_from.push_back(copy_from_value(rev, from_rev));
+}
+
+/**
+ * Once every copy has been noted, order them by the revisions making
+ * them, and count the uses of each revision copied from, so that
+ * free_past_trees() keeps the tree for a revision until exactly its last
+ * use, and no other.
+ */
+void ConvertRepository::plan_copies()
+{
+  copy_from.sort([](const copy_from_value& left,
+                    const copy_from_value& right) {
+                   return left.first < right.first;
+                 });
+
+  copy_sources.clear();
+  for (const copy_from_value& value : copy_from)
+    ++copy_sources[value.second];
+
+  copies_known = true;
+  keep_needed_trees();
+}
+
+/**
+ * Check that a node's author and branches are known.  Each problem is
+ * reported as a warning, and the number of problems returned.
+ */
+int ConvertRepository::validate(SvnDump::File::Node& _node)
+{
+  node = &_node;
+
+  int errors = 0;
 
   if (! authors.authors.empty()) {
     std::string author_id(node->get_rev_author());
@@ -330,22 +740,6 @@ int ConvertRepository::prescan(SvnDump::File::Node& _node)
     }
   }
 
-  if (node->has_copy_from()) {
-    if (status.debug_mode()) {
-      std::ostringstream buf;
-      buf << "Copy from: " << node->get_rev_nr()
-          << " <- " << node->get_copy_from_rev();
-      status.debug(buf.str());
-    }
-
-    if (copy_from.empty() ||
-        ! (copy_from.back().first == node->get_rev_nr() &&
-           copy_from.back().second == node->get_copy_from_rev())) {
-      copy_from.push_back(copy_from_value(node->get_rev_nr(),
-                                          node->get_copy_from_rev()));
-    }
-  }
-
   if (! repository->branches_by_path.empty()) {
     // Ignore pathname which only add or modify directories, but
     // do care about all entries which add or modify files, and
@@ -375,6 +769,28 @@ int ConvertRepository::prescan(SvnDump::File::Node& _node)
   return errors;
 }
 
+int ConvertRepository::prescan(SvnDump::File::Node& _node)
+{
+  node = &_node;
+
+  status.update(node->get_rev_nr());
+
+  int errors = validate(*node);
+
+  if (node->has_copy_from()) {
+    if (status.debug_mode()) {
+      std::ostringstream buf;
+      buf << "Copy from: " << node->get_rev_nr()
+          << " <- " << node->get_copy_from_rev();
+      status.debug(buf.str());
+    }
+
+    add_copy_from(node->get_rev_nr(), node->get_copy_from_rev());
+  }
+
+  return errors;
+}
+
 void ConvertRepository::process_change(Git::Repository * repo,
                                        const filesystem::path& pathname)
 {
@@ -405,56 +821,369 @@ void ConvertRepository::operator()(SvnDump::File::Node& _node)
 {
   node = &_node;
 
+  // Without a preflight scan, stop at the first node which could not be
+  // converted correctly, rather than producing a broken repository.
+  if (opts.validate && validate(*node) > 0)
+    status.error("Please correct the errors listed above and run again.");
+
   const filesystem::path& pathname(node->get_path());
   if (! pathname.empty()) {
-    rev = node->get_rev_nr();
-    if (rev != last_rev) {
-      // Commit any changes to the repository's index.  If there were no
-      // Git-visible changes, this will be a no-op.
-      if (repository->write(last_rev)) {
-        // Record the state of the "historical tree", the one that mirrors
-        // the entire state of the Subversion filesystem.  This is
-        // necessary when we encounters revisions that copy data from
-        // older states of the tree.
+    begin_revision();
+    process_change(repository, pathname);
+  }
+}
+
+/**
+ * Before the first node of each revision, write out the one before it.
+ */
+void ConvertRepository::begin_revision()
+{
+  rev = node->get_rev_nr();
+  if (rev != last_rev) {
+    // Commit any changes to the repository's index.  If there were no
+    // Git-visible changes, this will be a no-op.
+    bool history_changed = static_cast<bool>(history_branch->next_commit);
+    bool written         = repository->write(last_rev);
+
+    if (history_changed) {
+      // Record the state of the "historical tree", the one that mirrors
+      // the entire state of the Subversion filesystem.  This is
+      // necessary when we encounters revisions that copy data from
+      // older states of the tree.  A module's history, which holds only
+      // some paths, may have been emptied.
 #ifdef ASSERTS
-        std::pair<rev_trees_map::iterator, bool> result =
+      std::pair<rev_trees_map::iterator, bool> result =
 #endif
-          rev_trees.insert(rev_trees_map::value_type
-                           (last_rev, history_branch->commit->tree));
+        rev_trees.insert(rev_trees_map::value_type
+                         (last_rev, history_branch->commit ?
+                          history_branch->commit->tree :
+                          repository->create_tree()));
 #ifdef ASSERTS
-        assert(result.second);
+      assert(result.second);
 #endif
 
-        if (opts.collect && rev % opts.collect == 0) {
-          repository->write_branches();
-          repository->garbage_collect();
-        }
+      // The tree before it now serves only the revisions up to this
+      // one, and this one only those after it, so either may be needed
+      // no longer.
+      release_tree(tree_rev_for(last_rev - 1));
+      release_tree(last_rev);
+
+      Stats::rev_trees(rev_trees.size() + spilled_trees.size());
+
+      // Every revision's tree is also remembered by its id, so that a
+      // later incremental conversion can copy from it.
+      if (rev_tree_ids_complete && ! module) {
+        Checkpoint::RevTree rev_tree;
+        rev_tree.rev = last_rev;
+        if (history_branch->commit)
+          rev_tree.oid = *history_branch->commit->tree->get_oid();
+        else
+          std::memset(&rev_tree.oid, 0, sizeof(rev_tree.oid));
+        rev_tree_ids.push_back(rev_tree);
       }
+    }
+
+    if (written && opts.collect && rev % opts.collect == 0) {
+      repository->write_branches();
+      repository->garbage_collect();
+    }
 
-      free_past_trees();
+    free_past_trees();
 
-      status.update(rev);
-      last_rev = rev;
+    if (last_rev != -1 && ! module &&
+        (interrupted ||
+         (opts.checkpoint && last_rev >= last_checkpoint + opts.checkpoint))) {
+      save_checkpoint();
+      if (interrupted) {
+        std::ostringstream buf;
+        buf << "Interrupted after r" << last_rev
+            << "; use --resume to carry on from there";
+        status.error(buf.str());
+      }
+    }
 
-      establish_commit_info();
+    if (opts.stats_every > 0 && last_rev > 0 && ! module &&
+        last_rev % opts.stats_every == 0) {
+      status.newline();
+      status.out << Stats::json(last_rev) << std::endl;
     }
 
-    process_change(repository, pathname);
+    status.update(rev);
+    last_rev = rev;
+
+    establish_commit_info();
   }
 }
 
+filesystem::path ConvertRepository::checkpoint_path() const
+{
+  return Checkpoint::checkpoint_path(git_repository_path(*repository));
+}
+
+/**
+ * Record the state of the conversion as of `last_rev', all of whose
+ * changes have been committed, so that a later run given --resume can
+ * carry on from the revision after it.  Everything the checkpoint names
+ * is written out first, and the branches' refs are updated, so that
+ * nothing it needs looks unreachable to git.
+ */
+void ConvertRepository::save_checkpoint()
+{
+  Checkpoint checkpoint;
+  checkpoint.last_rev = last_rev;
+
+  for (const rev_trees_value& value : rev_trees) {
+    Checkpoint::RevTree rev_tree;
+    rev_tree.rev = value.first;
+    if (value.second->empty()) {
+      std::memset(&rev_tree.oid, 0, sizeof(rev_tree.oid));
+    } else {
+      value.second->write();
+      rev_tree.oid = *value.second->get_oid();
+    }
+    checkpoint.rev_trees.push_back(rev_tree);
+  }
+  for (const spilled_trees_map::value_type& value : spilled_trees) {
+    Checkpoint::RevTree rev_tree;
+    rev_tree.rev = value.first;
+    rev_tree.oid = value.second;
+    checkpoint.rev_trees.push_back(rev_tree);
+  }
+
+  for (const copy_from_value& value : copy_from)
+    checkpoint.copy_from.push_back(value);
+  checkpoint.copies_known = copies_known;
+
+  if (history_branch->commit) {
+    checkpoint.has_history = true;
+    checkpoint.history     = *history_branch->commit->get_oid();
+  }
+
+  for (const Git::Repository::branches_name_value& value :
+         repository->branches_by_name)
+    if (value.second->commit)
+      checkpoint.branches.push_back
+        (Checkpoint::branch_value(value.first,
+                                  *value.second->commit->get_oid()));
+
+  repository->write_branches();
+  repository->flush_objects();
+
+  if (! checkpoint.save(checkpoint_path()))
+    status.error(std::string("Could not save checkpoint: ") +
+                 checkpoint_path().string());
+
+  last_checkpoint = last_rev;
+
+  std::ostringstream buf;
+  buf << "Saved checkpoint after r" << last_rev;
+  status.info(buf.str());
+}
+
+/**
+ * Restore the state saved by the last checkpoint, returning the revision
+ * to carry on from, or -1 if there is no checkpoint.  The authors and
+ * branches must have been loaded already; each branch picks up again
+ * from the commit the checkpoint recorded for it.
+ */
+int ConvertRepository::resume()
+{
+  Checkpoint checkpoint;
+  if (! checkpoint.load(checkpoint_path()))
+    return -1;
+
+  static const git_oid empty_oid = {{ 0 }};
+
+  Git::Repository::trees_by_oid seen;
+  for (const Checkpoint::RevTree& rev_tree : checkpoint.rev_trees) {
+    Git::TreePtr tree;
+    if (Git::oid_equal()(rev_tree.oid, empty_oid)) {
+      tree = repository->create_tree();
+    }
+    else if (opts.spill_after > 0 &&
+             checkpoint.last_rev - rev_tree.rev >= opts.spill_after) {
+      spilled_trees.insert(spilled_trees_map::value_type(rev_tree.rev,
+                                                         rev_tree.oid));
+      continue;
+    }
+    else {
+      tree = repository->read_tree(&rev_tree.oid, seen);
+    }
+    rev_trees.insert(rev_trees_value(rev_tree.rev, tree));
+  }
+
+  copy_from.assign(checkpoint.copy_from.begin(), checkpoint.copy_from.end());
+  if (checkpoint.copies_known)
+    plan_copies();
+
+  // Branches which had no commit at the checkpoint have none now, even
+  // if an earlier conversion left them one.
+  history_branch->commit = nullptr;
+  for (const Git::Repository::branches_name_value& value :
+         repository->branches_by_name)
+    value.second->commit = nullptr;
+
+  if (checkpoint.has_history) {
+    history_branch->commit = repository->read_commit(&checkpoint.history,
+                                                     seen);
+    history_branch->commit->branch = history_branch;
+  }
+
+  for (const Checkpoint::branch_value& value : checkpoint.branches) {
+    Git::Repository::branches_name_map::iterator i =
+      repository->branches_by_name.find(value.first);
+    if (i == repository->branches_by_name.end())
+      status.error(std::string("Branch in checkpoint is no longer known: ") +
+                   value.first);
+
+    (*i).second->commit = repository->read_commit(&value.second, seen);
+    (*i).second->commit->branch = (*i).second;
+  }
+
+  last_rev        = checkpoint.last_rev;
+  last_checkpoint = checkpoint.last_rev;
+
+  // The ids of the trees before the checkpoint are not kept in it.
+  rev_tree_ids_complete = false;
+
+  std::ostringstream buf;
+  buf << "Resuming after r" << last_rev << ", with "
+      << rev_trees.size() + spilled_trees.size() << " past trees and " << checkpoint.branches.size() << " branches";
+  status.info(buf.str());
+
+  return last_rev + 1;
+}
+
+/**
+ * Carry on from a repository converted by an earlier run, for a dump
+ * made with --incremental.  Each branch picks up from the commit its ref
+ * names, and the flat history from its tag, whose SVN-Revision: line
+ * gives the last revision converted.  Returns the revision to carry on
+ * from, or -1 if the repository has no flat history.
+ */
+int ConvertRepository::load_refs()
+{
+  git_oid oid;
+  if (! repository->read_ref(std::string("refs/tags/") + history_branch->name,
+                             &oid))
+    return -1;
+
+  Git::Repository::trees_by_oid seen;
+
+  history_branch->commit = repository->read_commit(&oid, seen);
+  history_branch->commit->branch = history_branch;
+
+  last_rev = svn_revision(history_branch->commit->get_message());
+  if (last_rev == -1)
+    status.error(std::string("No valid SVN-Revision: line in the last "
+                             "commit of ") + history_branch->name);
+
+  for (const Git::Repository::branches_name_value& value :
+         repository->branches_by_name) {
+    const Git::BranchPtr& branch(value.second);
+    if (repository->read_ref((branch->is_tag ? "refs/tags/" : "refs/heads/") +
+                             branch->name, &oid)) {
+      branch->commit = repository->read_commit(&oid, seen);
+      branch->commit->branch = branch;
+    }
+  }
+
+  base_rev        = last_rev;
+  last_checkpoint = last_rev;
+
+  std::ostringstream buf;
+  buf << "Continuing after r" << last_rev;
+  status.info(buf.str());
+
+  return last_rev + 1;
+}
+
+/**
+ * Learn the id of the flat history's tree in every revision up to
+ * `base_rev', so that copies from them can be read back as needed.
+ * They are saved by each finished conversion; failing that, they are
+ * found from the SVN-Revision: lines of the flat history's commits.
+ */
+void ConvertRepository::load_rev_tree_ids()
+{
+  rev_tree_ids.clear();
+
+  filesystem::path pathname
+    (Checkpoint::rev_trees_path(git_repository_path(*repository)));
+  if (Checkpoint::load_rev_trees(pathname, rev_tree_ids) &&
+      ! rev_tree_ids.empty() && rev_tree_ids.back().rev >= base_rev) {
+    while (! rev_tree_ids.empty() && rev_tree_ids.back().rev > base_rev)
+      rev_tree_ids.pop_back();
+    return;
+  }
+
+  rev_tree_ids.clear();
+  if (! history_branch->commit)
+    return;
+
+  status.info("Reading the revisions of " + history_branch->name);
+
+  repository->read_history
+    (history_branch->commit->get_oid(),
+     [this](const git_oid * tree_oid, const std::string& message) {
+      Checkpoint::RevTree rev_tree;
+      rev_tree.rev = svn_revision(message);
+      if (rev_tree.rev == -1) {
+        status.warn("Skipping a commit of " + history_branch->name +
+                    " with no valid SVN-Revision: line");
+        return;
+      }
+      rev_tree.oid = *tree_oid;
+      rev_tree_ids.push_back(rev_tree);
+    });
+
+  std::reverse(rev_tree_ids.begin(), rev_tree_ids.end());
+}
+
 void ConvertRepository::finish()
 {
   repository->write(last_rev);
+
+  // A module's history holds only those paths routed to it.  The tag's
+  // ref is written along with the branches'.
+  if (history_branch->commit && ! module) {
+    repository->create_tag(history_branch->commit, history_branch->name);
+    status.info(std::string("Wrote tag ") + history_branch->name);
+  }
+
   repository->write_branches();
 
   if (opts.collect)
     repository->garbage_collect();
+  repository->close();
 
-  if (history_branch->commit) {
-    repository->create_tag(history_branch->commit, history_branch->name);
-    status.info(std::string("Wrote tag ") + history_branch->name);
+  // Once the conversion is complete, there is nothing left to resume,
+  // but a later incremental conversion will want every revision's tree.
+  if (! module) {
+    system::error_code ec;
+    filesystem::remove(checkpoint_path(), ec);
+
+    if (rev_tree_ids_complete &&
+        ! Checkpoint::save_rev_trees
+          (Checkpoint::rev_trees_path(git_repository_path(*repository)),
+           rev_tree_ids))
+      status.warn("Could not save the revisions' trees");
   }
 
+  std::ostringstream buf;
+  buf << "Blob cache: " << blob_cache.hits << " hits, "
+      << blob_cache.misses << " misses, " << blob_cache.size()
+      << " entries";
+  status.info(buf.str());
+  if (! module)
+    status.info(Git::ObjectPool::statistics());
+
   status.finish();
+
+  if (! module) {
+    if (opts.stats_json || opts.stats_every > 0)
+      status.out << Stats::json(last_rev) << std::endl;
+    if (opts.stats)
+      status.out << Stats::report();
+  }
 }
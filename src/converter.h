@@ -37,14 +37,28 @@
 #include "gitutil.h"
 #include "status.h"
 #include "authors.h"
+#include "textcache.h"
+#include "treecache.h"
+#include "blobcache.h"
+#include "checkpoint.h"
+
+struct Module;
 
 struct ConvertRepository
 {
   typedef std::map<int, Git::TreePtr> rev_trees_map;
   typedef rev_trees_map::value_type   rev_trees_value;
+  typedef std::map<int, git_oid>      spilled_trees_map;
+
+  typedef Checkpoint::rev_trees_vector rev_tree_ids_vector;
 
   typedef std::pair<int, int>        copy_from_value;
   typedef std::list<copy_from_value> copy_from_list;
+  typedef std::map<int, int>         copy_sources_map;
+
+  // The files under a path, relative to it, with their texts.
+  typedef std::pair<filesystem::path, std::string> imported_file;
+  typedef std::vector<imported_file>               imported_files;
 
   SvnDump::File::Node *     node;
   StatusDisplay&            status;
@@ -52,21 +66,61 @@ struct ConvertRepository
   Authors                   authors;
   int                       rev;
   int                       last_rev;
+  int                       last_checkpoint;
   rev_trees_map             rev_trees;
-  copy_from_list            copy_from;
+  spilled_trees_map         spilled_trees; // written, and known by id
+  TreeCache                 tree_cache; // subtrees read back from those
+  rev_tree_ids_vector       rev_tree_ids; // each revision's tree, by id
+  bool                      rev_tree_ids_complete; // else not saved
+  int                       base_rev;   // last converted by an earlier run
+  copy_from_list            copy_from;  // by the revision copying
+  copy_sources_map          copy_sources; // uses left of each source
+  bool                      copies_known; // else keep every past tree
   Git::Repository *         repository; // let it leak!
   Git::BranchPtr            history_branch;
   std::string               commit_log;
   shared_ptr<git_signature> signature;
+  TextCache                 text_cache; // base texts for svndiff deltas
+  BlobCache                 blob_cache; // blobs by their texts' checksums
+  const Module *            module;     // if converting only one module
 
   ConvertRepository(const filesystem::path& pathname,
                     StatusDisplay&          _status,
                     const Options&          _opts = Options())
-    : status(_status), opts(_opts), last_rev(-1),
+    : status(_status), opts(_opts), last_rev(-1), last_checkpoint(0),
+      rev_tree_ids_complete(! opts.fast_import), base_rev(-1),
+      copies_known(false),
       repository(new Git::Repository
                  (pathname, status,
                   bind(&ConvertRepository::set_commit_info, this, _1))),
-      history_branch(new Git::Branch(repository, "flat-history", true)) {}
+      history_branch(new Git::Branch(repository, "flat-history", true)),
+      module(nullptr) {
+#ifdef USE_THREADS
+    unsigned workers = opts.jobs > 0 ? opts.jobs
+                                     : thread::hardware_concurrency();
+#endif
+
+    if (opts.fast_import) {
+      repository->use_fast_import(opts.fast_import_output);
+    }
+    else {
+      if (! opts.loose) {
+        if (! repository->use_pack_writer
+            (static_cast<std::uint64_t>(opts.pack_size) * 1024 * 1024)) {
+          status.info("Pack writing is unavailable; writing loose objects");
+        } else {
+#ifdef USE_THREADS
+          if (workers > 1)
+            repository->use_blob_workers(workers);
+#endif
+        }
+      }
+#ifdef USE_THREADS
+      if (workers > 1)
+        repository->use_tree_workers(workers);
+#endif
+    }
+  }
 
   ~ConvertRepository() {
 #ifdef ASSERTS
@@ -74,8 +128,12 @@ struct ConvertRepository
 #endif
   }
 
-  void         free_past_trees();
-  Git::TreePtr get_past_tree();
+  void           free_past_trees();
+  int            tree_rev_for(int rev) const;
+  void           release_tree(int tree_rev);
+  void           keep_needed_trees();
+  void           spill_past_trees();
+  Git::ObjectPtr lookup_past(const filesystem::path& from_path);
 
   void establish_commit_info();
   void set_commit_info(Git::CommitPtr commit);
@@ -89,12 +147,22 @@ struct ConvertRepository
                      Git::BranchPtr          from_branch    = nullptr,
                      std::string             debug_text     = "");
 
+  void update_module(Git::BranchPtr          branch,
+                     Git::CommitPtr          branch_commit,
+                     const filesystem::path& subpath,
+                     Git::ObjectPtr          obj);
+
   void process_change(Git::Repository *       repo,
                       const filesystem::path& pathname);
 
   std::string describe_change(SvnDump::File::Node::Kind   kind,
                               SvnDump::File::Node::Action action);
 
+  Git::ObjectPtr current_object(const filesystem::path& pathname);
+  Git::ObjectPtr create_blob(Git::Repository *       repo,
+                             const filesystem::path& pathname,
+                             Git::ObjectPtr          base = nullptr);
+
   bool add_file(Git::Repository *       repo,
                 const filesystem::path& pathname);
 
@@ -104,7 +172,26 @@ struct ConvertRepository
   bool delete_item(Git::Repository *       repo,
                    const filesystem::path& pathname);
 
+  void collect_files(Git::ObjectPtr           obj,
+                     const filesystem::path&  relpath,
+                     imported_files&          files);
+  void import_files(SvnDump::File::Node& node, const imported_files& files);
+
+  // Set by a signal handler, to save a checkpoint and stop at the end of
+  // the current revision.
+  static volatile std::sig_atomic_t interrupted;
+
+  filesystem::path checkpoint_path() const;
+  void save_checkpoint();
+  int  resume();
+  int  load_refs();
+  void load_rev_tree_ids();
+
+  void add_copy_from(int rev, int from_rev);
+  void plan_copies();
+  int  validate(SvnDump::File::Node& node);
   int  prescan(SvnDump::File::Node& node);
+  void begin_revision();
   void operator()(SvnDump::File::Node& node);
 
   void finish();
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "dumpindex.h"
+#include "config.h"
+
+#ifndef ASSERTS
+#undef assert
+#define assert(x)
+#endif
+
+namespace SvnDump {
+
+namespace {
+  const char INDEX_MAGIC[8] = { 'S', 'V', 'N', 'I', 'D', 'X', '0', '2' };
+
+  struct IndexHeader {
+    char          magic[8];
+    std::uint64_t dump_size;
+    std::int64_t  dump_mtime;
+    std::int32_t  last_rev;
+    std::uint32_t count;
+    std::uint32_t copy_from_count;
+    std::uint32_t reserved;
+  };
+
+  bool stat_dump(const filesystem::path& dump_file,
+                 std::uint64_t& size, std::int64_t& mtime)
+  {
+    system::error_code ec;
+    size = filesystem::file_size(dump_file, ec);
+    if (ec)
+      return false;
+    mtime = filesystem::last_write_time(dump_file, ec);
+    return ! ec;
+  }
+}
+
+bool Index::load(const filesystem::path& dump_file)
+{
+  clear();
+
+  std::uint64_t size;
+  std::int64_t  mtime;
+  if (! stat_dump(dump_file, size, mtime))
+    return false;
+
+  filesystem::path pathname(index_path(dump_file));
+  system::error_code ec;
+  std::uint64_t index_size = filesystem::file_size(pathname, ec);
+  if (ec)
+    return false;
+
+  filesystem::ifstream in(pathname, std::ios::binary);
+  if (! in.good())
+    return false;
+
+  IndexHeader header;
+  in.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (! in.good() ||
+      std::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+      header.dump_size != size || header.dump_mtime != mtime)
+    return false;
+
+  // The counts come from disk, so don't allocate for them unless the
+  // file really holds that many entries; otherwise the index is rebuilt.
+  if (sizeof(header) +
+      std::uint64_t(header.count) * sizeof(Entry) +
+      std::uint64_t(header.copy_from_count) * 2 * sizeof(std::int32_t)
+      != index_size)
+    return false;
+
+  entries.resize(header.count);
+  if (header.count > 0)
+    in.read(reinterpret_cast<char *>(&entries[0]),
+            static_cast<std::streamsize>(sizeof(Entry) * header.count));
+
+  std::vector<std::int32_t> pairs(std::size_t(header.copy_from_count) * 2);
+  if (! pairs.empty())
+    in.read(reinterpret_cast<char *>(&pairs[0]),
+            static_cast<std::streamsize>(sizeof(std::int32_t) * pairs.size()));
+  for (std::size_t i = 0; i < pairs.size(); i += 2)
+    copy_from.push_back(copy_from_value(pairs[i], pairs[i + 1]));
+
+  if (! in.good()) {
+    clear();
+    return false;
+  }
+
+  last_rev = header.last_rev;
+  complete = true;
+  return true;
+}
+
+bool Index::save(const filesystem::path& dump_file) const
+{
+  assert(complete);
+
+  IndexHeader header;
+  std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  if (! stat_dump(dump_file, header.dump_size, header.dump_mtime))
+    return false;
+  header.last_rev        = last_rev;
+  header.count           = static_cast<std::uint32_t>(entries.size());
+  header.copy_from_count = static_cast<std::uint32_t>(copy_from.size());
+  header.reserved        = 0;
+
+  std::vector<std::int32_t> pairs;
+  pairs.reserve(copy_from.size() * 2);
+  for (copy_from_vector::const_iterator i = copy_from.begin();
+       i != copy_from.end();
+       ++i) {
+    pairs.push_back((*i).first);
+    pairs.push_back((*i).second);
+  }
+
+  // Write to a temporary name first, so that an interrupted write can
+  // never leave behind an index that looks valid.
+  filesystem::path pathname(index_path(dump_file));
+  filesystem::path temp(pathname.string() + ".tmp");
+  {
+    filesystem::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    if (! out.good())
+      return false;
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    if (! entries.empty())
+      out.write(reinterpret_cast<const char *>(&entries[0]),
+                static_cast<std::streamsize>(sizeof(Entry) * entries.size()));
+    if (! pairs.empty())
+      out.write(reinterpret_cast<const char *>(&pairs[0]),
+                static_cast<std::streamsize>(sizeof(std::int32_t) *
+                                             pairs.size()));
+    if (! out.good())
+      return false;
+  }
+
+  system::error_code ec;
+  filesystem::rename(temp, pathname, ec);
+  return ! ec;
+}
+
+const Index::Entry * Index::find(int rev) const
+{
+  entries_vector::const_iterator i =
+    std::lower_bound(entries.begin(), entries.end(), rev,
+                     [](const Entry& entry, int r) { return entry.rev < r; });
+  return i == entries.end() ? nullptr : &*i;
+}
+
+} // namespace SvnDump
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _DUMPINDEX_H
+#define _DUMPINDEX_H
+
+#include "system.hpp"
+
+using namespace boost;
+
+namespace SvnDump
+{
+  /**
+   * A sidecar index of a dump file, mapping each revision number to the
+   * byte offset of its revision record, along with the number of nodes
+   * in that revision.  It also records every (revision, copy-from
+   * revision) pair, which is all the converter needs to know ahead of
+   * time in order to free old trees.  It is built as a side-effect of
+   * the first full scan, and saved next to the dump file (as DUMP.idx)
+   * so that later runs can seek directly to any revision.
+   *
+   * The index is stored in native byte order; it is a cache, not an
+   * interchange format.  It is only trusted if the size and mtime of the
+   * dump file match those recorded when it was built.
+   */
+  class Index
+  {
+  public:
+    struct Entry {
+      int           rev;
+      int           nodes;
+      std::uint64_t offset;
+    };
+
+    typedef std::vector<Entry> entries_vector;
+
+    typedef std::pair<int, int>          copy_from_value;
+    typedef std::vector<copy_from_value> copy_from_vector;
+
+  private:
+    entries_vector   entries;
+    copy_from_vector copy_from;
+    int              last_rev;
+    bool             complete;
+
+  public:
+    Index() : last_rev(-1), complete(false) {}
+
+    static filesystem::path index_path(const filesystem::path& dump_file) {
+      return filesystem::path(dump_file.string() + ".idx");
+    }
+
+    bool load(const filesystem::path& dump_file);
+    bool save(const filesystem::path& dump_file) const;
+
+    void clear() {
+      entries.clear();
+      copy_from.clear();
+      last_rev = -1;
+      complete = false;
+    }
+
+    void add_revision(int rev, std::uint64_t offset, int prev_nodes) {
+      if (! entries.empty())
+        entries.back().nodes = prev_nodes;
+
+      Entry entry;
+      entry.rev    = rev;
+      entry.nodes  = 0;
+      entry.offset = offset;
+      entries.push_back(entry);
+    }
+
+    void add_copy_from(int rev, int from_rev) {
+      if (copy_from.empty() ||
+          ! (copy_from.back().first == rev &&
+             copy_from.back().second == from_rev))
+        copy_from.push_back(copy_from_value(rev, from_rev));
+    }
+
+    void finish(int prev_nodes, int _last_rev) {
+      if (! entries.empty())
+        entries.back().nodes = prev_nodes;
+      last_rev = _last_rev;
+      complete = true;
+    }
+
+    bool empty() const {
+      return entries.empty();
+    }
+    bool is_complete() const {
+      return complete;
+    }
+    int get_last_rev_nr() const {
+      return last_rev;
+    }
+    int get_final_rev_nr() const {
+      return entries.empty() ? -1 : entries.back().rev;
+    }
+    const entries_vector& get_entries() const {
+      return entries;
+    }
+    const copy_from_vector& get_copy_from() const {
+      return copy_from;
+    }
+
+    /**
+     * Find the first indexed revision at or after `rev'.
+     */
+    const Entry * find(int rev) const;
+  };
+}
+
+#endif // _DUMPINDEX_H
@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fastimport.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#ifdef HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif
+
+#ifndef ASSERTS
+#undef assert
+#define assert(x)
+#endif
+
+namespace Git {
+
+namespace {
+  const std::size_t BUFFER_SIZE = 1024 * 1024;
+
+  const char null_sha1[] = "0000000000000000000000000000000000000000";
+
+  std::string sha1_of(const git_oid * oid) {
+    char checksum[41];
+    git_oid_fmt(checksum, oid);
+    checksum[40] = '\0';
+    return checksum;
+  }
+}
+
+FastImport::~FastImport()
+{
+  try {
+    close();
+  }
+  catch (...) {}
+}
+
+void FastImport::open(const filesystem::path& output)
+{
+  destination = output;
+
+  if (output == "-") {
+    out = stdout;
+  } else {
+    out = std::fopen(output.string().c_str(), "wb");
+    if (! out)
+      throw std::runtime_error("Cannot write " + output.string());
+  }
+  std::setvbuf(out, nullptr, _IOFBF, BUFFER_SIZE);
+
+  // Have git refuse a stream which ends early, say because we failed
+  std::fputs("feature done\n", out);
+}
+
+void FastImport::spawn(const filesystem::path& git_dir)
+{
+#ifdef HAVE_SYS_WAIT_H
+  destination = git_dir;
+
+  int commands[2];
+  int replies[2];
+  if (::pipe(commands) != 0)
+    throw std::runtime_error("Cannot create a pipe for git fast-import");
+  if (::pipe(replies) != 0) {
+    ::close(commands[0]);
+    ::close(commands[1]);
+    throw std::runtime_error("Cannot create a pipe for git fast-import");
+  }
+
+#ifdef F_SETPIPE_SZ
+  ::fcntl(commands[1], F_SETPIPE_SZ, static_cast<int>(BUFFER_SIZE));
+#endif
+
+  std::string git_dir_arg("--git-dir=" + git_dir.string());
+  std::string replies_arg("--cat-blob-fd=" + lexical_cast<std::string>(replies[1]));
+
+  pid_t pid = ::fork();
+  if (pid < 0) {
+    ::close(commands[0]);
+    ::close(commands[1]);
+    ::close(replies[0]);
+    ::close(replies[1]);
+    throw std::runtime_error("Cannot run git fast-import");
+  }
+
+  if (pid == 0) {
+    ::dup2(commands[0], STDIN_FILENO);
+    ::close(commands[0]);
+    ::close(commands[1]);
+    ::close(replies[0]);
+    ::execlp("git", "git", git_dir_arg.c_str(), "fast-import", "--quiet",
+             replies_arg.c_str(), static_cast<char *>(nullptr));
+    ::_exit(127);
+  }
+
+  ::close(commands[0]);
+  ::close(replies[1]);
+
+  // If git dies, find out from the failed write rather than be killed
+  ::signal(SIGPIPE, SIG_IGN);
+
+  out       = ::fdopen(commands[1], "wb");
+  responses = ::fdopen(replies[0], "rb");
+  child     = pid;
+
+  std::setvbuf(out, nullptr, _IOFBF, BUFFER_SIZE);
+  std::fputs("feature done\n", out);
+#else
+  (void)git_dir;
+  throw std::runtime_error("Running git fast-import is not supported "
+                           "on this platform; use --fast-import-output");
+#endif
+}
+
+void FastImport::close()
+{
+  if (! out)
+    return;
+
+  std::fputs("done\n", out);
+  bool failed = std::fflush(out) != 0 || std::ferror(out);
+  if (out != stdout)
+    failed = std::fclose(out) != 0 || failed;
+  out = nullptr;
+
+  if (responses) {
+    std::fclose(responses);
+    responses = nullptr;
+  }
+
+#ifdef HAVE_SYS_WAIT_H
+  if (child != -1) {
+    int status = 0;
+    while (::waitpid(child, &status, 0) < 0 && errno == EINTR)
+      ;
+    child = -1;
+    if (! WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      throw std::runtime_error("git fast-import failed in " +
+                               destination.string());
+  }
+#endif
+
+  if (failed)
+    throw std::runtime_error("Could not write the fast-import stream to " +
+                             destination.string());
+}
+
+void FastImport::write_data(const char * data, std::size_t len)
+{
+  std::fprintf(out, "data %lu\n", static_cast<unsigned long>(len));
+  if (len > 0)
+    std::fwrite(data, 1, len, out);
+  std::fputc('\n', out);
+
+  if (std::ferror(out))
+    throw std::runtime_error("Could not write the fast-import stream to " +
+                             destination.string());
+}
+
+void FastImport::write_ident(const char * field,
+                             const git_signature * signature)
+{
+  if (signature) {
+    int offset = signature->when.offset;
+    std::fprintf(out, "%s %s <%s> %lld %c%02d%02d\n", field,
+                 signature->name, signature->email,
+                 static_cast<long long>(signature->when.time),
+                 offset < 0 ? '-' : '+', std::abs(offset) / 60,
+                 std::abs(offset) % 60);
+  } else {
+    std::fprintf(out, "%s Unknown <unknown@unknown.org> 0 +0000\n", field);
+  }
+}
+
+/**
+ * Write a pathname as the last field of a command, quoting it the way
+ * git does if it would otherwise be misread.
+ */
+void FastImport::write_path(const std::string& pathname)
+{
+  if (pathname.find_first_of("\n\\") == std::string::npos &&
+      (pathname.empty() || pathname[0] != '"')) {
+    std::fputs(pathname.c_str(), out);
+    return;
+  }
+
+  std::fputc('"', out);
+  for (std::string::const_iterator i = pathname.begin();
+       i != pathname.end();
+       ++i) {
+    switch (*i) {
+    case '"':  std::fputs("\\\"", out); break;
+    case '\\': std::fputs("\\\\", out); break;
+    case '\n': std::fputs("\\n", out);  break;
+    default:   std::fputc(*i, out);     break;
+    }
+  }
+  std::fputc('"', out);
+}
+
+void FastImport::blob(git_oid * oid, const char * data, std::size_t len)
+{
+  if (git_odb_hash(oid, data, len, GIT_OBJ_BLOB) != 0)
+    throw std::logic_error(giterr_last()->message);
+
+  if (blobs.insert(*oid).second) {
+    std::fputs("blob\n", out);
+    write_data(data, len);
+  }
+}
+
+int FastImport::commit(const std::string& refname,
+                       const git_signature * signature,
+                       const std::string& message, int from_mark)
+{
+  // A commit without a `from' would continue from the branch's last
+  // commit, so a parentless one must start the branch over.
+  if (from_mark == 0)
+    std::fprintf(out, "reset %s\n\n", refname.c_str());
+
+  int mark = ++last_mark;
+  std::fprintf(out, "commit %s\nmark :%d\n", refname.c_str(), mark);
+  write_ident("author", signature);
+  write_ident("committer", signature);
+  write_data(message.data(), message.length());
+  if (from_mark != 0)
+    std::fprintf(out, "from :%d\n", from_mark);
+
+  return mark;
+}
+
+void FastImport::file_modify(unsigned int mode, const git_oid * oid,
+                             const std::string& pathname)
+{
+  std::fprintf(out, "M %o %s ", mode, sha1_of(oid).c_str());
+  write_path(pathname);
+  std::fputc('\n', out);
+}
+
+void FastImport::file_delete(const std::string& pathname)
+{
+  std::fputs("D ", out);
+  write_path(pathname);
+  std::fputc('\n', out);
+}
+
+void FastImport::file_delete_all()
+{
+  std::fputs("deleteall\n", out);
+}
+
+void FastImport::end_commit()
+{
+  std::fputc('\n', out);
+}
+
+void FastImport::reset(const std::string& refname, int mark)
+{
+  if (mark != 0)
+    std::fprintf(out, "reset %s\nfrom :%d\n\n", refname.c_str(), mark);
+  else
+    std::fprintf(out, "reset %s\nfrom %s\n\n", refname.c_str(), null_sha1);
+}
+
+void FastImport::tag(const std::string& name, int mark,
+                     const git_signature * signature)
+{
+  std::fprintf(out, "tag %s\nfrom :%d\n", name.c_str(), mark);
+  write_ident("tagger", signature);
+  write_data("", 0);
+}
+
+void FastImport::checkpoint()
+{
+  std::fputs("checkpoint\n\n", out);
+}
+
+void FastImport::cat_blob(const git_oid * oid, std::string& data)
+{
+  if (! responses)
+    throw std::runtime_error("Blobs can only be read back while running "
+                             "git fast-import; use --fast-import without "
+                             "--fast-import-output");
+
+  std::string sha1(sha1_of(oid));
+  std::fprintf(out, "cat-blob %s\n", sha1.c_str());
+  std::fflush(out);
+
+  // The reply is "<sha1> blob <size>\n<contents>\n"
+  char header[128];
+  if (! std::fgets(header, sizeof(header), responses))
+    throw std::runtime_error("git fast-import did not answer for " + sha1);
+
+  char type[16];
+  unsigned long size;
+  if (std::sscanf(header, "%*40s %15s %lu", type, &size) != 2 ||
+      std::strcmp(type, "blob") != 0)
+    throw std::runtime_error("git fast-import could not find blob " + sha1);
+
+  data.resize(size);
+  if ((size > 0 && std::fread(&data[0], 1, size, responses) != size) ||
+      std::fgetc(responses) != '\n')
+    throw std::runtime_error("Short reply from git fast-import for " + sha1);
+}
+
+} // namespace Git
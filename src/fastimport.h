@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _FASTIMPORT_H
+#define _FASTIMPORT_H
+
+#include "system.hpp"
+#include "oidhash.h"
+
+#include <cstdio>
+#include <sys/types.h>
+
+using namespace boost;
+
+namespace Git
+{
+  /**
+   * Writes a git fast-import stream, either to a file (or standard
+   * output) or to a `git fast-import' process run on the target
+   * repository.  In the latter case that process does the compression,
+   * delta search and packing alongside the conversion, and can also send
+   * back the contents of blobs already written (used to get the base
+   * text of a delta that has dropped out of the text cache).
+   *
+   * Blobs are referred to by their ids, which are computed here, so each
+   * is only sent once; commits are referred to by marks.
+   */
+  class FastImport : public noncopyable
+  {
+    typedef std::unordered_set<git_oid, oid_hash, oid_equal> oids_set;
+
+    FILE *           out;
+    FILE *           responses;   // cat-blob replies from our own child
+    pid_t            child;
+    filesystem::path destination;
+    int              last_mark;
+    oids_set         blobs;
+
+    void write_data(const char * data, std::size_t len);
+    void write_ident(const char * field, const git_signature * signature);
+    void write_path(const std::string& pathname);
+
+  public:
+    FastImport()
+      : out(nullptr), responses(nullptr), child(-1), last_mark(0) {}
+    ~FastImport();
+
+    /**
+     * Write the stream to `output', or to standard output if it is "-".
+     */
+    void open(const filesystem::path& output);
+
+    /**
+     * Run `git fast-import' on the repository at `git_dir', and write
+     * the stream to it.
+     */
+    void spawn(const filesystem::path& git_dir);
+
+    /**
+     * End the stream and, if git is importing it, wait for it to finish.
+     */
+    void close();
+
+    bool is_open() const {
+      return out != nullptr;
+    }
+
+    /**
+     * Send a blob, unless one with the same contents was already sent.
+     * Either way, `oid' is set to its id.
+     */
+    void blob(git_oid * oid, const char * data, std::size_t len);
+
+    /**
+     * Begin a commit on `refname', returning its mark.  Without a parent
+     * (`from_mark' of 0), it starts from an empty tree.  Its changes
+     * follow, and then end_commit().
+     */
+    int  commit(const std::string& refname, const git_signature * signature,
+                const std::string& message, int from_mark);
+    void file_modify(unsigned int mode, const git_oid * oid,
+                     const std::string& pathname);
+    void file_delete(const std::string& pathname);
+    void file_delete_all();
+    void end_commit();
+
+    /**
+     * Point `refname' at the commit with `mark', or delete it if `mark'
+     * is 0.
+     */
+    void reset(const std::string& refname, int mark);
+    void tag(const std::string& name, int mark,
+             const git_signature * signature);
+    void checkpoint();
+
+    /**
+     * Read back the contents of a blob already sent.  This is only
+     * possible when git is being run by spawn().
+     */
+    void cat_blob(const git_oid * oid, std::string& data);
+  };
+}
+
+#endif // _FASTIMPORT_H
@@ -32,6 +32,7 @@
 
 #include "converter.h"
 #include "branches.h"
+#include "treewatcher.h"
 
 #include <fnmatch.h>
 
@@ -64,6 +65,72 @@ namespace {
     return false;
   }
 
+  /**
+   * Whether `pathname' is ignored, by Git or for being within a
+   * submodule, in which case `ignored_dir' is set to it, or to whichever
+   * of its parents is ignored, followed by a slash.
+   */
+  bool is_ignored(Git::Repository& repo, const fs::path& pathname,
+                  const vector<string>& ignore_list, string& ignored_dir) {
+    for (fs::path subpath(pathname);
+         ! subpath.empty();
+         subpath = subpath.parent_path()) {
+      int ignored = 0;
+      Git::git_check
+        (git_status_should_ignore(repo, subpath.string().c_str(), &ignored));
+      if (ignored || is_ignored_file(subpath, ignore_list)) {
+        ignored_dir = subpath.string() + "/";
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Record the file at `pathname' in the snapshot, unless it is there
+   * already with the same contents and mode, and return whether it was.
+   * A snapshot already written is first cloned into a new one.
+   */
+  bool update_file(Git::Repository& repo, Git::CommitPtr& commit,
+                   const fs::path& pathname, fs::perms permissions) {
+    git_oid blob_oid;
+    if (git_blob_create_fromfile(&blob_oid, repo,
+                                 pathname.string().c_str()) != 0)
+      return false;             // it went away before it could be read
+
+    unsigned int attributes =
+      0100000 + (permissions & fs::owner_exe ? 0755 : 0644);
+
+    Git::ObjectPtr current(commit->lookup(pathname));
+    if (current && ! current->is_tree() &&
+        current->attributes == attributes &&
+        git_oid_cmp(current->get_oid(), &blob_oid) == 0)
+      return false;
+
+    if (commit->is_written())
+      commit = commit->clone();
+
+    commit->update(pathname,
+                   new Git::Blob(&repo, &blob_oid,
+                                 pathname.filename().string(), attributes));
+    return true;
+  }
+
+  /**
+   * Remove whatever the snapshot has at `pathname', returning whether
+   * there was anything.
+   */
+  bool remove_path(Git::CommitPtr& commit, const fs::path& pathname) {
+    if (! commit->lookup(pathname))
+      return false;
+
+    if (commit->is_written())
+      commit = commit->clone();
+
+    commit->remove(pathname);
+    return true;
+  }
+
   string head_ref(Git::Repository& repo) {
     git_reference * head;
     Git::git_check(git_reference_lookup(&head, repo, "HEAD"));
@@ -85,6 +152,8 @@ int main(int argc, char *argv[])
   ios::sync_with_stdio(false);
 
   size_t interval = 300;
+  bool   watch    = true;
+  int    debounce = 1000;       // milliseconds
 
   Options opts;
   vector<string> args;
@@ -100,6 +169,10 @@ int main(int argc, char *argv[])
           opts.debug = 1;
         else if (strcmp(&argv[i][2], "interval") == 0)
           interval = lexical_cast<size_t>(argv[++i]);
+        else if (strcmp(&argv[i][2], "poll") == 0)
+          watch = false;
+        else if (strcmp(&argv[i][2], "debounce") == 0)
+          debounce = lexical_cast<int>(argv[++i]);
       }
       else if (strcmp(&argv[i][1], "v") == 0)
         opts.verbose = true;
@@ -117,6 +190,43 @@ int main(int argc, char *argv[])
   StatusDisplay   status(cerr, opts);
   Git::Repository repo(args.empty() ? "." : args[0].c_str(), status);
 
+  vector<string> ignore_list;
+  time_t         ignore_mtime(0);
+
+#define UPD_IGN_LIST(pathvar, listvar, timevar)                 \
+    if (fs::is_regular_file(pathvar)) {                         \
+      time_t timevar ## now(fs::last_write_time(pathvar));      \
+      if (timevar ## now != timevar) {                          \
+        (listvar).clear();                                      \
+        read_submodules_file((pathvar), (listvar));             \
+        timevar = timevar ## now;                               \
+      }                                                         \
+    }
+
+  UPD_IGN_LIST(".gitmodules", ignore_list, ignore_mtime);
+
+#ifdef HAVE_TREE_WATCHER
+  // With a watch on the tree, only the paths which changed are looked
+  // at, as soon as they change; the tree is walked just at first, and
+  // again should any changes be missed.
+  boost::shared_ptr<TreeWatcher> watcher;
+  if (watch) {
+    watcher.reset(new TreeWatcher([&](const fs::path& dir) {
+          string ignored_dir;
+          return (dir.filename() == ".git" ||
+                  is_ignored_file(dir.string() + "/", ignore_list) ||
+                  is_ignored(repo, dir, ignore_list, ignored_dir));
+        }));
+    if (! watcher->watch()) {
+      status.warn("Could not watch every directory; polling instead");
+      watcher.reset();
+    }
+  }
+#else
+  if (watch)
+    status.debug("Watching for changes is unavailable; polling instead");
+#endif
+
  restart:
   string         target(head_ref(repo));
   Git::Branch    snapshots(&repo, target);
@@ -143,11 +253,11 @@ int main(int argc, char *argv[])
     }
   }
 
-  vector<string> ignore_list;
-  time_t         ignore_mtime(0);
-
   time_t latest_write_time(0);
 
+  bool          walk_tree(true);
+  set<fs::path> changed;
+
   while (true) {
     string curr_target(head_ref(repo));
     if (target != curr_target) {
@@ -157,91 +267,87 @@ int main(int argc, char *argv[])
     }
 
     time_t previous_write_time(latest_write_time);
+    time_t snapshot_time(0);
     size_t updated = 0;
 
-#define UPD_IGN_LIST(pathvar, listvar, timevar)                 \
-    if (fs::is_regular_file(pathvar)) {                         \
-      time_t timevar ## now(fs::last_write_time(pathvar));      \
-      if (timevar ## now != timevar) {                          \
-        (listvar).clear();                                      \
-        read_submodules_file((pathvar), (listvar));             \
-        timevar = timevar ## now;                               \
-      }                                                         \
-    }
-
     UPD_IGN_LIST(".gitmodules", ignore_list, ignore_mtime);
 
-    string last_ignored;
+    if (walk_tree) {
+      string last_ignored;
 
-    for (fs::recursive_directory_iterator end, entry("./");
-         entry != end;
-         ++entry) {
-      const fs::path& pathname(string((*entry).path().string(), 2));
-      if (! fs::is_regular_file(pathname))
-        continue;
-
-      const string& path_str(pathname.string());
+      for (fs::recursive_directory_iterator end, entry("./");
+           entry != end;
+           ++entry) {
+        const fs::path& pathname(string((*entry).path().string(), 2));
+        if (! fs::is_regular_file(pathname))
+          continue;
 
-      if (*pathname.begin() == ".git" || contains(path_str, "/.git/") ||
-          (! last_ignored.empty() && starts_with(path_str, last_ignored)))
-        continue;
+        const string& path_str(pathname.string());
 
-      vector<fs::path> paths;
-      paths.push_back(pathname);
-      for (fs::path dirname(pathname);
-           ! dirname.empty();
-           dirname = dirname.parent_path())
-        paths.push_back(dirname);
+        if (*pathname.begin() == ".git" || contains(path_str, "/.git/") ||
+            (! last_ignored.empty() && starts_with(path_str, last_ignored)))
+          continue;
 
-      int ignored = 0;
-      for (const fs::path& subpath : paths) {
-        Git::git_check
-          (git_status_should_ignore(repo, subpath.string().c_str(), &ignored));
-        if (ignored) {
-          last_ignored = subpath.string() + "/";
-          break;
+        if (is_ignored(repo, pathname, ignore_list, last_ignored)) {
+          status.debug(string("Ignoring ") + path_str);
+          continue;
         }
 
-        if (is_ignored_file(subpath, ignore_list)) {
-          last_ignored = subpath.string() + "/";
-          ignored = 1;
-          break;
-        }
-      }
-      if (ignored) {
-        status.debug(string("Ignoring ") + path_str);
-        continue;
-      }
-
-      status.debug(string("Considering regular file ") + path_str);
-
-      time_t when = fs::last_write_time(pathname);
-      if (when > previous_write_time) {
-        status.info(string("Updating snapshot for ") + path_str);
-
-        git_oid blob_oid;
-        git_blob_create_fromfile(&blob_oid, repo, path_str.c_str());
-        Git::BlobPtr blob
-          (new Git::Blob(&repo, &blob_oid, pathname.filename().string(),
-                         0100000 + ((*entry).status().permissions() &
-                                    fs::owner_exe ? 0755 : 0644)));
-
-        if (latest_write_time && ! updated)
-          commit = commit->clone();
-        ++updated;
+        status.debug(string("Considering regular file ") + path_str);
 
-        commit->update(pathname, blob);
+        time_t when = fs::last_write_time(pathname);
+        if (when > previous_write_time) {
+          if (update_file(repo, commit, pathname,
+                          (*entry).status().permissions())) {
+            status.info(string("Updating snapshot for ") + path_str);
+            ++updated;
+          }
 
-        if (when > latest_write_time)
-          latest_write_time = when;
+          if (when > latest_write_time)
+            latest_write_time = when;
+        }
       }
+      snapshot_time = latest_write_time;
+    } else {
+      for (const fs::path& pathname : changed) {
+        const string& path_str(pathname.string());
+
+        string ignored_dir;
+        if (*pathname.begin() == ".git" || contains(path_str, "/.git/") ||
+            is_ignored(repo, pathname, ignore_list, ignored_dir))
+          continue;
+
+        system::error_code ec;
+        fs::file_status file_status(fs::status(pathname, ec));
+
+        if (fs::is_regular_file(file_status)) {
+          if (update_file(repo, commit, pathname, file_status.permissions())) {
+            status.info(string("Updating snapshot for ") + path_str);
+            ++updated;
+
+            time_t when = fs::last_write_time(pathname, ec);
+            if (! ec && when > latest_write_time)
+              latest_write_time = when;
+            if (! ec && when > snapshot_time)
+              snapshot_time = when;
+          }
+        }
+        else if (! fs::exists(file_status)) {
+          if (remove_path(commit, pathname)) {
+            status.info(string("Removing from snapshot ") + path_str);
+            ++updated;
+            snapshot_time = std::max(snapshot_time, std::time(nullptr));
+          }
+        }
+      }
+      changed.clear();
     }
 
-    if (updated) {
+    if (updated && commit->tree && ! commit->tree->empty()) {
       ostringstream buf;
       buf << "Checkpointed " << updated << " files";
       commit->set_message(buf.str());
-      commit->set_author("git-monitor", "git-monitor@localhost", latest_write_time);
+      commit->set_author("git-monitor", "git-monitor@localhost", snapshot_time);
       commit->write();            // create the commit object and its trees
 
       snapshots.update(commit, target); // update the snapshots ref
@@ -251,6 +357,17 @@ int main(int argc, char *argv[])
       status.debug("No changes noticed...");
     }
 
+#ifdef HAVE_TREE_WATCHER
+    if (watcher) {
+      status.debug("Waiting for changes...");
+      walk_tree = ! watcher->wait(changed, static_cast<int>(interval),
+                                  debounce);
+      if (walk_tree)
+        status.info("Some changes were missed; looking over the whole tree");
+      continue;
+    }
+#endif
+
     if (status.debug_mode()) {
       ostringstream buf;
       buf << "Sleeping for " << interval << " second(s)...";
@@ -63,6 +63,11 @@
  */
 
 #include "gitutil.h"
+#include "stats.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
 
 #ifndef ASSERTS
 #undef assert
@@ -90,12 +95,10 @@ bool check_size(const Repository& repository, const Tree& tree)
     std::cerr << "Mismatch in written entries for " << tree.name
               << " (" << &tree << ")" << std::endl;
 
-    for (Tree::entries_map::const_iterator i = tree.entries.begin();
+    for (TreeEntries::const_iterator i = tree.entries.begin();
          i != tree.entries.end();
-         ++i) {
-      assert((*i).first == (*i).second->name);
-      std::cerr << "entry = " << (*i).first << std::endl;
-    }
+         ++i)
+      std::cerr << "entry = " << (*i)->name << std::endl;
 
     int len = git_tree_entrycount(tree);
     for (int i = 0; i < len; ++i) {
@@ -116,15 +119,102 @@ bool check_size(const Repository& repository, const Tree& tree)
 }
 #endif
 
+/**
+ * The chunk which holds, or would hold, an entry named `name': the last
+ * one starting at or before it, or else the first.
+ */
+TreeEntries::chunks_vector::iterator
+TreeEntries::chunk_for(const std::string& name)
+{
+  chunks_vector::iterator i =
+    std::upper_bound(chunks.begin(), chunks.end(), name, chunk_greater);
+  return i == chunks.begin() ? i : i - 1;
+}
+
+TreeEntries::chunks_vector::const_iterator
+TreeEntries::chunk_for(const std::string& name) const
+{
+  chunks_vector::const_iterator i =
+    std::upper_bound(chunks.begin(), chunks.end(), name, chunk_greater);
+  return i == chunks.begin() ? i : i - 1;
+}
+
+ObjectPtr TreeEntries::find(const std::string& name) const
+{
+  chunks_vector::const_iterator chunk = chunk_for(name);
+  if (chunk == chunks.end())
+    return nullptr;
+
+  chunk_type::const_iterator i =
+    std::lower_bound((*chunk)->begin(), (*chunk)->end(), name, entry_less);
+  if (i != (*chunk)->end() && (*i)->name.get() == name)
+    return *i;
+  return nullptr;
+}
+
+void TreeEntries::set(ObjectPtr obj)
+{
+  const std::string& name(obj->name.get());
+
+  chunks_vector::iterator chunk = chunk_for(name);
+  if (chunk == chunks.end()) {
+    chunks.push_back(chunk_ptr(new chunk_type(1, obj)));
+    ++count;
+    return;
+  }
+
+  chunk_type& entries(unshare(chunk));
+  chunk_type::iterator i =
+    std::lower_bound(entries.begin(), entries.end(), name, entry_less);
+  if (i != entries.end() && (*i)->name.get() == name) {
+    *i = obj;
+    return;
+  }
+
+  entries.insert(i, obj);
+  ++count;
+
+  if (entries.size() > MAX_CHUNK) {
+    chunk_ptr upper(new chunk_type(entries.begin() + MAX_CHUNK / 2,
+                                   entries.end()));
+    entries.resize(MAX_CHUNK / 2);
+    chunks.insert(chunk + 1, upper);
+  }
+}
+
+bool TreeEntries::erase(const std::string& name)
+{
+  chunks_vector::iterator chunk = chunk_for(name);
+  if (chunk == chunks.end())
+    return false;
+
+  chunk_type::iterator i =
+    std::lower_bound((*chunk)->begin(), (*chunk)->end(), name, entry_less);
+  if (i == (*chunk)->end() || (*i)->name.get() != name)
+    return false;
+
+  if ((*chunk)->size() == 1) {
+    chunks.erase(chunk);
+  } else {
+    chunk_type::difference_type pos = i - (*chunk)->begin();
+    chunk_type& entries(unshare(chunk));
+    entries.erase(entries.begin() + pos);
+  }
+  --count;
+  return true;
+}
+
 /**
  * Given a pair of path iterators describing segments of a path, update
  * the current tree so the Git entry corresponding to that path is set
  * to 'obj'.
  *
  * Trees use a copy-on-write optimization, and share as much structure
- * as possible with previous versions of the tree.
+ * as possible with previous versions of the tree.  Only the trees along
+ * the updated path lose their ids and must be written again; every
+ * other subtree keeps the id it was last written with.
  */
-bool Tree::do_update(filesystem::path::iterator segment,
+void Tree::do_update(filesystem::path::iterator segment,
                      filesystem::path::iterator end, ObjectPtr obj)
 {
   assert(check_size(*repository, *this));
@@ -132,65 +222,27 @@ bool Tree::do_update(filesystem::path::iterator segment,
   std::string entry_name = (*segment).string();
   assert(! entry_name.empty());
 
-  entries_map::iterator i = entries.find(entry_name);
   if (++segment == end) {
-    assert(entry_name == obj->name);
-
-    if (i == entries.end()) {
-      entries.insert(entries_pair(entry_name, obj));
-
-      written = false;        // force the whole tree to be rewritten
-    } else {
-      if (builder == nullptr)
-        git_check(git_treebuilder_create(&builder, nullptr));
-
-      // If the object we're updating is just a blob, the tree doesn't
-      // need to be regnerated entirely, it will just get updated by
-      // git_object_write.
-      if (written && obj->is_blob()) {
-        ObjectPtr curr_obj((*i).second);
-
-        git_check(git_treebuilder_insert(nullptr, builder, obj->name.c_str(),
-                                         *obj, obj->attributes));
-
-        if (entry_name != obj->name) {
-          entries.erase(i);
-          git_check(git_treebuilder_remove(builder, entry_name.c_str()));
-
-#ifdef ASSERTS
-          std::pair<entries_map::iterator, bool> result =
-#endif
-            entries.insert(entries_pair(obj->name, obj));
-          assert(result.second);
-        } else {
-          (*i).second = obj;
-        }
+    assert(entry_name == obj->name.get());
 
-      } else {
-        (*i).second = obj;
-
-        written = false;      // force the whole tree to be rewritten
-      }
-    }
+    if (entry_name != obj->name.get())
+      entries.erase(entry_name);
+    entries.set(obj);
   } else {
+    ObjectPtr curr_obj(entries.find(entry_name));
+
     TreePtr tree;
-    if (i == entries.end()) {
+    if (! curr_obj)
       tree = repository->create_tree(entry_name);
-      entries.insert(entries_pair(entry_name, tree));
-    } else {
-      tree = dynamic_cast<Tree *>((*i).second.get());
-      (*i).second = tree = tree->copy();
-    }
-    assert(tree->is_tree());
+    else
+      tree = as_tree(curr_obj)->copy();
+    entries.set(tree);
 
-    written = tree->do_update(segment, end, obj);
+    tree->do_update(segment, end, obj);
   }
 
-  assert(check_size(*repository, *this));
-
+  written  = false;
   modified = true;
-
-  return written;
 }
 
 /**
@@ -204,123 +256,156 @@ void Tree::do_remove(filesystem::path::iterator segment,
 
   std::string entry_name = (*segment).string();
 
-  entries_map::iterator i   = entries.find(entry_name);
-  entries_map::iterator del = entries.end();
-
   // It's OK for remove not to find what it's looking for, because it
   // may be that Subversion wishes to remove an empty directory, which
   // would never have been added in the first place.
-  if (i != del) {
-    if (++segment == end) {
-      del = i;
-    } else {
-      assert((*i).second->is_tree());
-      TreePtr subtree = dynamic_cast<Tree *>((*i).second.get());
-      (*i).second = subtree = subtree->copy();
+  ObjectPtr curr_obj(entries.find(entry_name));
+  if (curr_obj) {
+    bool del = true;
 
+    if (++segment != end) {
+      TreePtr subtree(as_tree(curr_obj)->copy());
       subtree->do_remove(segment, end);
 
-      if (subtree->empty())
-        del = i;
-    }
-
-    if (del != entries.end()) {
-      entries.erase(del);
-
-      if (written) {
-        assert(builder != nullptr);
-        git_check(git_treebuilder_remove(builder, entry_name.c_str()));
+      if (! subtree->empty()) {
+        entries.set(subtree);
+        del = false;
       }
     }
 
-    assert(check_size(*repository, *this));
+    if (del)
+      entries.erase(entry_name);
 
+    written  = false;
     modified = true;
   }
 }
 
 /**
- * Write out a Git tree to disk.
+ * Git sorts tree entries by name, except that a subtree sorts as though
+ * its name ended in a slash.
+ */
+bool Tree::git_less(const Object * left, const Object * right)
+{
+  const std::string& l(left->name.get());
+  const std::string& r(right->name.get());
+
+  std::size_t len = std::min(l.length(), r.length());
+  int         cmp = std::memcmp(l.data(), r.data(), len);
+  if (cmp != 0)
+    return cmp < 0;
+
+  unsigned char lc = l.length() > len ? static_cast<unsigned char>(l[len]) :
+                     left->is_tree() ? '/' : '\0';
+  unsigned char rc = r.length() > len ? static_cast<unsigned char>(r[len]) :
+                     right->is_tree() ? '/' : '\0';
+  return lc < rc;
+}
+
+/**
+ * Encode this tree in Git's format, from the ids its entries have
+ * now; every entry must already have been written, or at least hashed.
  *
- * It is only at this time that we bother sorting the tree entries to
- * match Git's expectations, to save time.  Plus, if we've written this
- * tree in the past and the *structure* of the tree has not changed --
- * just the contents of some of its files -- we don't have to sort at
- * all.  We just write out the same structure, only with modified
- * hashes.
+ * Entries are kept in plain name order, which matches Git's except
+ * where a subtree's name is a prefix of a sibling's, so only then do
+ * they need sorting.
  */
-void Tree::write()
+void Tree::encode(std::string& data) const
 {
-  if (empty()) return;
+  std::vector<const Object *> sorted;
+  sorted.reserve(entries.size());
 
-  if (written) {
-    if (modified) {
-      assert(! entries.empty());
-      assert(check_size(*repository, *this));
-      assert(builder != nullptr);
-      git_check(git_treebuilder_write(&oid, *repository, builder));
-    }
-  } else {
-    assert(check_size(*repository, *this));
-
-    // `written' may be false now because of a change which requires us
-    // to rewrite the entire tree.  To be on the safe side, just clear
-    // out any existing entries in the git tree, and rewrite the entries
-    // known to the Tree object.
-    if (builder)
-      git_treebuilder_clear(builder);
-    else
-      git_check(git_treebuilder_create(&builder, nullptr));
+  for (TreeEntries::const_iterator i = entries.begin();
+       i != entries.end();
+       ++i)
+    sorted.push_back((*i).get());
 
-    for (entries_map::const_iterator i = entries.begin();
-         i != entries.end();
-         ++i) {
-      ObjectPtr obj((*i).second);
-      assert(obj->name == (*i).first);
+  if (! std::is_sorted(sorted.begin(), sorted.end(), git_less))
+    std::sort(sorted.begin(), sorted.end(), git_less);
 
-      if (! obj->is_written())
-        obj->write();
+  data.clear();
+  data.reserve(sorted.size() * 48);
 
-      try {
-        git_check(git_treebuilder_insert(nullptr, builder, obj->name.c_str(),
-                                         *obj, obj->attributes));
-      }
-      catch (std::logic_error&) {
-        std::cerr << "Entries map contains " << entries.size()
-                  << " elements" << std::endl;
-        std::cerr << "Failed to insert '" << obj->name
-                  << "' for tree '" << name << "':" << std::endl;
-        dump_tree(std::cerr);
-        throw;
-      }
-    }
+  for (std::vector<const Object *>::const_iterator i = sorted.begin();
+       i != sorted.end();
+       ++i) {
+    char mode[16];
+    data.append(mode, static_cast<std::size_t>
+                (std::snprintf(mode, sizeof mode, "%o ", (*i)->attributes)));
+    data.append((*i)->name.get());
+    data.push_back('\0');
+    data.append(reinterpret_cast<const char *>((*i)->get_oid()->id), 20);
+  }
+}
 
-    assert(check_size(*repository, *this));
-    git_check(git_treebuilder_write(&oid, *repository, builder));
-    assert(check_size(*repository, *this));
+/**
+ * Write out a Git tree, after writing whichever of its subtrees have
+ * changed since they were last written; the rest are not visited.  The
+ * tree object is serialized here directly, rather than by way of a
+ * treebuilder.
+ */
+void Tree::write()
+{
+  if (empty() || is_written())
+    return;
 
-    written = true;
-  }
+  Stats::Timer timer(Stats::TREE_WRITE);
+
+  for (TreeEntries::const_iterator i = entries.begin();
+       i != entries.end();
+       ++i)
+    if (! (*i)->is_written())
+      (*i)->write();
+
+  std::string data;
+  encode(data);
 
+  repository->write_object(&oid, data.data(), data.length(), GIT_OBJ_TREE);
+  assert(check_size(*repository, *this));
+
+  written  = true;
   modified = false;
 }
 
+/**
+ * Send every file in this tree to a fast-import commit, under `prefix'.
+ * With `replace', whatever was at the path of each subtree is deleted
+ * first, as Tree::update does when merging one tree into another.
+ */
+void Tree::import_entries(FastImport& fast_import, const std::string& prefix,
+                          bool replace) const
+{
+  for (TreeEntries::const_iterator i = entries.begin();
+       i != entries.end();
+       ++i) {
+    std::string pathname(prefix + (*i)->name.get());
+
+    if ((*i)->is_tree()) {
+      if (replace)
+        fast_import.file_delete(pathname);
+      as_tree(*i)->import_entries(fast_import, pathname + "/");
+    } else {
+      fast_import.file_modify((*i)->attributes, **i, pathname);
+    }
+  }
+}
+
 /**
  * Debug routine that dumps a tree's contents to an output stream.
  */
 void Tree::dump_tree(std::ostream& out, int depth)
 {
-  for (entries_map::const_iterator i = entries.begin();
+  for (TreeEntries::const_iterator i = entries.begin();
        i != entries.end();
        ++i) {
     for (int j = 0; j < depth; ++j)
       out << "  ";
 
-    out << (*i).first;
+    out << (*i)->name;
 
-    if ((*i).second->is_tree()) {
+    if ((*i)->is_tree()) {
       out << "/\n";
-      dynamic_cast<Tree *>((*i).second.get())->dump_tree(out, depth + 1);
+      as_tree(*i)->dump_tree(out, depth + 1);
     } else {
       out << '\n';
     }
@@ -336,6 +421,9 @@ void Commit::update(const filesystem::path& pathname, ObjectPtr obj)
   if (! tree)
     tree = repository->create_tree();
   tree->update(pathname, obj);
+
+  if (repository->get_fast_import())
+    changes.push_back(change_value(pathname, obj));
 }
 
 void Commit::remove(const filesystem::path& pathname)
@@ -345,6 +433,9 @@ void Commit::remove(const filesystem::path& pathname)
     if (tree->empty())
        tree = nullptr;
   }
+
+  if (repository->get_fast_import())
+    changes.push_back(change_value(pathname, nullptr));
 }
 
 /**
@@ -353,7 +444,7 @@ void Commit::remove(const filesystem::path& pathname)
  */
 bool Commit::has_tree() const
 {
-  return tree;
+  return static_cast<bool>(tree);
 }
 
 /**
@@ -373,37 +464,123 @@ CommitPtr Commit::clone(bool with_copy)
   return new_commit;
 }
 
+namespace {
+  /**
+   * Append a signature line, such as a commit's author, as libgit2 would
+   * write it.
+   */
+  void append_signature(std::string& data, const char * header,
+                        const git_signature * sig)
+  {
+    int  offset = sig->when.offset;
+    char sign   = offset < 0 ? '-' : '+';
+    if (offset < 0)
+      offset = -offset;
+
+    char when[64];
+    std::snprintf(when, sizeof when, " %u %c%02d%02d\n",
+                  static_cast<unsigned>(sig->when.time), sign,
+                  offset / 60, offset % 60);
+
+    data.append(header);
+    data.append(sig->name);
+    data.append(" <");
+    data.append(sig->email);
+    data.push_back('>');
+    data.append(when);
+  }
+}
+
 void Commit::write()
 {
+  Stats::Timer timer(Stats::COMMIT_WRITE);
+
   assert(! is_written());
   assert(tree);
 
+  if (FastImport * fast_import = repository->get_fast_import()) {
+    write_fast_import(*fast_import);
+    return;
+  }
+
   assert(! tree->empty());
   if (! tree->is_written())
     tree->write();
 
-  git_tree * tree_obj;
-  git_check(git_tree_lookup(&tree_obj, *repository, tree->get_oid()));
+  // The commit is serialized here from the ids of its tree and parent,
+  // as git_commit_create would, without looking either of them up.
+  std::string data;
+  data.reserve(256 + message_str.length());
 
-  git_commit * parent_obj = nullptr;
+  data.append("tree ");
+  data.append(tree->sha1());
+  data.push_back('\n');
   if (parent) {
     assert(parent->is_written());
-    git_check(git_commit_lookup(&parent_obj, *repository, parent->get_oid()));
+    data.append("parent ");
+    data.append(parent->sha1());
+    data.push_back('\n');
   }
 
-  git_check(git_commit_create_v(&oid, *repository, nullptr, signature.get(),
-                                signature.get(), nullptr, message_str.c_str(),
-                                tree_obj, parent_obj ? 1 : 0, parent_obj));
+  append_signature(data, "author ", signature.get());
+  append_signature(data, "committer ", signature.get());
+  data.push_back('\n');
+  data.append(message_str);
 
-  if (parent_obj)
-    git_commit_free(parent_obj);
-  git_tree_free(tree_obj);
+  repository->write_object(&oid, data.data(), data.length(), GIT_OBJ_COMMIT);
 
   // Once written, we no longer need the parent
   parent  = nullptr;
   written = true;
 }
 
+/**
+ * Write this commit as a fast-import commit on its branch's ref, giving
+ * as its changes the same updates and removals that were applied to its
+ * tree.  No Git trees are built here; fast-import builds them.
+ */
+void Commit::write_fast_import(FastImport& fast_import)
+{
+  std::string refname(! branch ? std::string("refs/heads/master") :
+                      (branch->is_tag ? "refs/tags/" : "refs/heads/") +
+                      branch->name);
+
+  assert(! parent || parent->is_written());
+  mark = fast_import.commit(refname, signature.get(), message_str,
+                            parent ? parent->mark : 0);
+
+  for (std::vector<change_value>::const_iterator i = changes.begin();
+       i != changes.end();
+       ++i) {
+    const std::string& pathname((*i).first.string());
+    ObjectPtr          obj((*i).second);
+
+    if (! obj) {
+      if (pathname.empty())
+        fast_import.file_delete_all();
+      else
+        fast_import.file_delete(pathname);
+    }
+    else if (obj->is_tree()) {
+      const Tree * subtree = static_cast<const Tree *>(obj.get());
+      if (pathname.empty()) {
+        subtree->import_entries(fast_import, "", /* replace= */ true);
+      } else {
+        fast_import.file_delete(pathname);
+        subtree->import_entries(fast_import, pathname + "/");
+      }
+    }
+    else {
+      fast_import.file_modify(obj->attributes, *obj, pathname);
+    }
+  }
+  fast_import.end_commit();
+  changes.clear();
+
+  parent  = nullptr;
+  written = true;
+}
+
 /**
  * Get the commit object for the given branch to which changes should be
  * applied.  It is expected that they will be applied, and so the commit
@@ -466,6 +643,8 @@ CommitPtr Branch::get_commit(BranchPtr from_branch)
  */
 void Branch::update(CommitPtr ptr, std::string refname)
 {
+  Stats::Timer timer(Stats::BRANCH_UPDATE);
+
   if (ptr)
     commit = ptr;
 
@@ -473,24 +652,345 @@ void Branch::update(CommitPtr ptr, std::string refname)
   assert(commit);
   assert(commit->is_written());
 
-  git_check(git_reference_create_oid
-            (&git_ref, *repository,
-             refname.empty() ?
-             (std::string("refs/heads/") + name).c_str() : refname.c_str(),
-             commit->get_oid(), 1));
+  if (FastImport * fast_import = repository->get_fast_import()) {
+    fast_import->reset(refname.empty() ?
+                       std::string("refs/heads/") + name : refname,
+                       commit->mark);
+    return;
+  }
+
+  repository->set_ref(refname.empty() ?
+                      std::string("refs/heads/") + name : refname,
+                      commit->get_oid());
+}
+
+Repository::~Repository()
+{
+  close();
+
+  // The pack writer's backend is freed along with the repository, so it
+  // must outlive it.
+  if (repo != nullptr)
+    git_repository_free(repo);
+#ifdef HAVE_PACK_WRITER
+  checked_delete(pack_writer);
+#endif
+  checked_delete(fast_import);
+}
+
+/**
+ * Stream all objects written from now on into packfiles of up to
+ * `max_pack_size' bytes each, rather than writing them as loose objects.
+ * Returns false if subconvert was built without zlib or OpenSSL, in
+ * which case objects stay loose.
+ */
+bool Repository::use_pack_writer(std::uint64_t max_pack_size)
+{
+#ifdef HAVE_PACK_WRITER
+  if (pack_writer == nullptr)
+    pack_writer = new PackWriter(repo, max_pack_size);
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Have `count' threads hash and compress blobs, which the pack writer
+ * then adds to its pack in the order they were created.  Returns false if
+ * that is not possible, because objects are not being packed or
+ * subconvert was built without threads.
+ */
+bool Repository::use_blob_workers(unsigned count)
+{
+#ifdef HAVE_BLOB_WORKERS
+  if (pack_writer == nullptr)
+    return false;
+  pack_writer->start_workers(count);
+  return true;
+#else
+  (void)count;
+  return false;
+#endif
+}
+
+/**
+ * Write a fast-import stream instead of using libgit2 to write objects
+ * and refs, either to `output' or, if that is empty, to a git
+ * fast-import process run on this repository.
+ */
+void Repository::use_fast_import(const filesystem::path& output)
+{
+  if (fast_import == nullptr) {
+    fast_import = new FastImport;
+    if (output.empty())
+      fast_import->spawn(git_repository_path(repo));
+    else
+      fast_import->open(output);
+  }
+}
+
+/**
+ * Make every object written so far visible to Git: finish any pack being
+ * written, or have fast-import write out what it has.
+ */
+void Repository::flush_objects()
+{
+  if (fast_import != nullptr) {
+    if (fast_import->is_open())
+      fast_import->checkpoint();
+    return;
+  }
+
+#ifdef HAVE_PACK_WRITER
+  if (pack_writer == nullptr)
+    return;
+
+  pack_writer->finish();
+
+  if (! pack_writer->get_failure().empty())
+    log.warn(std::string("Some objects were written loose: ") +
+             pack_writer->get_failure());
+
+  std::ostringstream buf;
+  buf << "Packed " << pack_writer->objects << " objects ("
+      << pack_writer->duplicates << " duplicates skipped) into "
+      << pack_writer->packs_written << " packs, "
+      << pack_writer->bytes_in / 1024 << " KB compressed to "
+      << pack_writer->bytes_out / 1024 << " KB";
+  log.info(buf.str());
+#endif
+}
+
+/**
+ * Called once the conversion is done, to finish writing objects.  In
+ * fast-import mode, this waits for git to finish the import.
+ */
+void Repository::close()
+{
+  if (fast_import != nullptr)
+    fast_import->close();
+  else
+    flush_objects();
 }
 
 BlobPtr Repository::create_blob(const std::string& blob_name, const char * data,
                                 std::size_t len, unsigned int attributes)
 {
+  Stats::bytes_written(len);
+
+#ifdef HAVE_BLOB_WORKERS
+  if (pack_writer != nullptr && pack_writer->has_workers())
+    return new Blob(this, pack_writer->submit(data, len, GIT_OBJ_BLOB),
+                    blob_name, attributes);
+#endif
+
   git_oid blob_oid;
-  git_check(git_blob_create_frombuffer(&blob_oid, *this, data, len));
+  if (fast_import != nullptr)
+    fast_import->blob(&blob_oid, data, len);
+  else
+    git_check(git_blob_create_frombuffer(&blob_oid, *this, data, len));
 
   Blob * blob = new Blob(this, &blob_oid, blob_name, attributes);
   blob->repository = this;
   return blob;
 }
 
+#ifdef HAVE_BLOB_WORKERS
+void Blob::resolve() const
+{
+  const_cast<git_oid&>(oid) = *repository->pack_writer->wait_for_id(pending);
+  pending.reset();
+}
+#endif
+
+/**
+ * Read back the contents of a blob already in the object database.
+ */
+void Repository::read_blob(const git_oid * oid, std::string& data)
+{
+  if (fast_import != nullptr) {
+    fast_import->cat_blob(oid, data);
+    return;
+  }
+
+  git_blob * blob;
+  git_check(git_blob_lookup(&blob, *this, oid));
+
+  data.assign(static_cast<const char *>(git_blob_rawcontent(blob)),
+              static_cast<std::size_t>(git_blob_rawsize(blob)));
+
+  git_blob_free(blob);
+}
+
+/**
+ * Read back a tree already in the object database, along with all of its
+ * subtrees, as it would stand had it just been written.  A subtree found
+ * in `seen' is shared rather than read again, so that reading many
+ * revisions of the same tree costs little more than reading one.
+ */
+TreePtr Repository::read_tree(const git_oid * oid, trees_by_oid& seen,
+                              const std::string& name)
+{
+  trees_by_oid::iterator i = seen.find(*oid);
+  if (i != seen.end()) {
+    if ((*i).second->name == name)
+      return (*i).second;
+
+    TreePtr tree((*i).second->copy());
+    tree->name = name;
+    return tree;
+  }
+
+  git_tree * tree_obj;
+  git_check(git_tree_lookup(&tree_obj, repo, oid));
+
+  TreePtr      tree(new Tree(this, oid, name));
+  unsigned int len = git_tree_entrycount(tree_obj);
+  for (unsigned int n = 0; n < len; ++n) {
+    const git_tree_entry * entry = git_tree_entry_byindex(tree_obj, n);
+    if (git_tree_entry_type(entry) == GIT_OBJ_TREE)
+      tree->entries.set(read_tree(git_tree_entry_id(entry), seen,
+                                  git_tree_entry_name(entry)));
+    else
+      tree->entries.set(new Blob(this, git_tree_entry_id(entry),
+                                 git_tree_entry_name(entry),
+                                 git_tree_entry_attributes(entry)));
+  }
+  git_tree_free(tree_obj);
+
+  seen.insert(trees_by_oid::value_type(*oid, tree));
+  return tree;
+}
+
+/**
+ * Find the entry at `pathname' beneath a tree already in the object
+ * database, reading only the trees along the way.  Returns false if
+ * there is no such entry.
+ */
+bool Repository::read_entry(const git_oid * tree_oid,
+                            const filesystem::path& pathname,
+                            git_oid * oid, unsigned int * attributes,
+                            bool * is_tree)
+{
+  *oid        = *tree_oid;
+  *attributes = 0040000;
+  *is_tree    = true;
+
+  for (filesystem::path::iterator segment = pathname.begin();
+       segment != pathname.end();
+       ++segment) {
+    if (! *is_tree)
+      return false;
+
+    git_tree * tree_obj;
+    git_check(git_tree_lookup(&tree_obj, repo, oid));
+
+    const git_tree_entry * entry =
+      git_tree_entry_byname(tree_obj, (*segment).string().c_str());
+    if (entry == nullptr) {
+      git_tree_free(tree_obj);
+      return false;
+    }
+
+    *oid        = *git_tree_entry_id(entry);
+    *attributes = git_tree_entry_attributes(entry);
+    *is_tree    = git_tree_entry_type(entry) == GIT_OBJ_TREE;
+    git_tree_free(tree_obj);
+  }
+  return true;
+}
+
+/**
+ * Read back a commit already in the object database, with its tree, so
+ * that a branch may carry on from it.  Its parent is not needed, since
+ * it has already been written.
+ */
+CommitPtr Repository::read_commit(const git_oid * oid, trees_by_oid& seen)
+{
+  git_commit * commit_obj;
+  git_check(git_commit_lookup(&commit_obj, repo, oid));
+
+  CommitPtr commit(new Commit(this, oid));
+  commit->tree = read_tree(git_commit_tree_oid(commit_obj), seen);
+  commit->set_message(git_commit_message(commit_obj));
+  commit->signature =
+    shared_ptr<git_signature>(git_signature_dup
+                              (git_commit_committer(commit_obj)),
+                              git_signature_free);
+
+  git_commit_free(commit_obj);
+  return commit;
+}
+
+/**
+ * Find the commit named by the ref `refname', looking through any tags
+ * on the way.  Returns false if there is no such ref.
+ */
+bool Repository::read_ref(const std::string& refname, git_oid * oid)
+{
+  git_oid ref_oid;
+  if (git_reference_name_to_oid(&ref_oid, repo, refname.c_str()) != 0)
+    return false;
+
+  git_object * obj;
+  git_check(git_object_lookup(&obj, repo, &ref_oid, GIT_OBJ_ANY));
+  while (git_object_type(obj) == GIT_OBJ_TAG) {
+    git_object * target;
+    int result = git_tag_target(&target, reinterpret_cast<git_tag *>(obj));
+    git_object_free(obj);
+    git_check(result);
+    obj = target;
+  }
+
+  bool found = git_object_type(obj) == GIT_OBJ_COMMIT;
+  if (found)
+    *oid = *git_object_id(obj);
+  git_object_free(obj);
+  return found;
+}
+
+/**
+ * Call `visit' with the tree and message of the commit `oid', and of
+ * each of its first parents in turn, newest first.
+ */
+void Repository::read_history(const git_oid * oid,
+                              function<void(const git_oid *,
+                                            const std::string&)> visit)
+{
+  git_commit * commit_obj;
+  git_check(git_commit_lookup(&commit_obj, repo, oid));
+
+  while (commit_obj != nullptr) {
+    visit(git_commit_tree_oid(commit_obj), git_commit_message(commit_obj));
+
+    git_commit * parent_obj = nullptr;
+    int result = 0;
+    if (git_commit_parentcount(commit_obj) > 0)
+      result = git_commit_parent(&parent_obj, commit_obj, 0);
+    git_commit_free(commit_obj);
+    git_check(result);
+
+    commit_obj = parent_obj;
+  }
+}
+
+/**
+ * Write an object already serialized in Git's format, such as a tree,
+ * to the object database (and so to the pack writer, if there is one).
+ */
+void Repository::write_object(git_oid * oid, const void * data,
+                              std::size_t len, git_otype type)
+{
+  Stats::bytes_written(len);
+
+  git_odb * odb;
+  git_check(git_repository_odb(&odb, repo));
+  int result = git_odb_write(oid, odb, data, len, type);
+  git_odb_free(odb);
+  git_check(result);
+}
+
 TreePtr Repository::create_tree(const std::string& name,
                                 unsigned int attributes)
 {
@@ -504,57 +1004,238 @@ CommitPtr Repository::create_commit(CommitPtr parent)
   return new Commit(this, nullptr, parent);
 }
 
+#ifdef USE_THREADS
+
+namespace {
+  // Besides the position of the one commit a tree belongs to, its owner
+  // may be one of these.
+  enum { TREE_SHARED = -1, TREE_LISTED = -2 };
+}
+
+/**
+ * Note every unwritten tree beneath `tree' as belonging to commit
+ * `owner', unless another commit has reached it already, in which case
+ * it and all of its unwritten subtrees are shared.  The ids of pending
+ * blobs are resolved on the way, so that hashing the trees later reads
+ * nothing which could change under it.
+ */
+void Repository::find_unwritten(Tree * tree, int owner,
+                                tree_owners_map& owners,
+                                std::vector<Tree *>& shared)
+{
+  for (TreeEntries::const_iterator i = tree->entries.begin();
+       i != tree->entries.end();
+       ++i) {
+    if (! (*i)->is_tree()) {
+      (*i)->get_oid();
+      continue;
+    }
+    if ((*i)->is_written())
+      continue;
+
+    Tree * subtree = Tree::as_tree(*i);
+    std::pair<tree_owners_map::iterator, bool> result =
+      owners.insert(tree_owners_map::value_type(subtree, owner));
+    if (result.second) {
+      find_unwritten(subtree, owner, owners, shared);
+    }
+    else if ((*result.first).second != owner &&
+             (*result.first).second != TREE_SHARED) {
+      (*result.first).second = TREE_SHARED;
+      shared.push_back(subtree);
+      find_unwritten(subtree, TREE_SHARED, owners, shared);
+    }
+  }
+}
+
+/**
+ * Append to `trees' every unwritten tree beneath and including `tree'
+ * which belongs to commit `owner', each after its own subtrees.
+ */
+void Repository::list_unwritten(Tree * tree, int owner,
+                                tree_owners_map& owners,
+                                std::vector<Tree *>& trees)
+{
+  for (TreeEntries::const_iterator i = tree->entries.begin();
+       i != tree->entries.end();
+       ++i) {
+    if (! (*i)->is_tree() || (*i)->is_written())
+      continue;
+
+    Tree * subtree = Tree::as_tree(*i);
+    tree_owners_map::iterator j = owners.find(subtree);
+    assert(j != owners.end());
+    if ((*j).second == owner) {
+      (*j).second = TREE_LISTED;
+      list_unwritten(subtree, owner, owners, trees);
+    }
+  }
+  trees.push_back(tree);
+}
+
+/**
+ * Write the trees of several commits at once.  Those reachable from
+ * more than one of the commits, as when a single revision copies the
+ * same directory to many tags, are written first, here; the rest belong
+ * to just one commit each, so each commit's can be encoded and hashed
+ * on a thread of its own, independently of the others.  They are then
+ * written to the object database here, in the order of the commits, so
+ * that objects are stored in the same order every run.
+ */
+void Repository::write_trees(const std::vector<CommitPtr>& commits)
+{
+  Stats::Timer timer(Stats::TREE_WRITE);
+
+  tree_owners_map     owners;
+  std::vector<Tree *> shared;
+
+  for (std::size_t i = 0; i < commits.size(); ++i) {
+    Tree * tree = commits[i]->tree.get();
+    if (tree->is_written())
+      continue;
+
+    std::pair<tree_owners_map::iterator, bool> result =
+      owners.insert(tree_owners_map::value_type(tree, static_cast<int>(i)));
+    if (result.second) {
+      find_unwritten(tree, static_cast<int>(i), owners, shared);
+    }
+    else if ((*result.first).second != TREE_SHARED) {
+      (*result.first).second = TREE_SHARED;
+      shared.push_back(tree);
+      find_unwritten(tree, TREE_SHARED, owners, shared);
+    }
+  }
+
+  for (std::vector<Tree *>::iterator i = shared.begin();
+       i != shared.end();
+       ++i)
+    (*i)->write();
+
+  struct Task {
+    std::vector<Tree *>      trees;  // each after its own subtrees
+    std::vector<std::string> data;
+  };
+
+  std::vector<Task> tasks(commits.size());
+  for (std::size_t i = 0; i < commits.size(); ++i) {
+    Tree * tree = commits[i]->tree.get();
+    tree_owners_map::iterator j = owners.find(tree);
+    if (j != owners.end() && (*j).second == static_cast<int>(i)) {
+      (*j).second = TREE_LISTED;
+      list_unwritten(tree, static_cast<int>(i), owners, tasks[i].trees);
+      tasks[i].data.resize(tasks[i].trees.size());
+    }
+  }
+
+  std::atomic<std::size_t> next(0);
+  std::string              failure;
+  mutex                    failure_mutex;
+
+  auto hash_trees = [&]() {
+    for (std::size_t i = next++; i < tasks.size(); i = next++) {
+      Task& task(tasks[i]);
+      for (std::size_t j = 0; j < task.trees.size(); ++j) {
+        task.trees[j]->encode(task.data[j]);
+        if (git_odb_hash(&task.trees[j]->oid, task.data[j].data(),
+                         task.data[j].length(), GIT_OBJ_TREE) != 0) {
+          mutex::scoped_lock lock(failure_mutex);
+          failure = "Failed to hash a tree";
+          return;
+        }
+      }
+    }
+  };
+
+  unsigned workers = static_cast<unsigned>(std::min<std::size_t>
+                                           (tree_workers, tasks.size()));
+  thread_group threads;
+  for (unsigned i = 1; i < workers; ++i)
+    threads.create_thread(hash_trees);
+  hash_trees();
+  threads.join_all();
+
+  if (! failure.empty())
+    throw std::logic_error(failure);
+
+  for (std::vector<Task>::iterator i = tasks.begin(); i != tasks.end(); ++i) {
+    for (std::size_t j = 0; j < (*i).trees.size(); ++j) {
+      Tree * tree = (*i).trees[j];
+      git_oid written_oid;
+      write_object(&written_oid, (*i).data[j].data(), (*i).data[j].length(),
+                   GIT_OBJ_TREE);
+      assert(git_oid_cmp(&written_oid, &tree->oid) == 0);
+
+      tree->written  = true;
+      tree->modified = false;
+    }
+  }
+}
+
+#endif // USE_THREADS
+
 bool Repository::write(int related_revision)
 {
   std::size_t branches_modified = 0;
 
+#ifdef HAVE_BLOB_WORKERS
+  // Whatever blobs the workers are done with may as well go into the
+  // pack now, rather than waiting in memory.
+  if (pack_writer != nullptr && pack_writer->has_workers())
+    pack_writer->store_pending(false);
+#endif
+
+  // The commit of every branch which still exists is written after all
+  // the branches have been settled, so that their trees can be written
+  // together.
+  std::vector<CommitPtr> commits;
+
   for (std::vector<CommitPtr>::iterator i = commit_queue.begin();
        i != commit_queue.end();
        ++i) {
     CommitPtr commit(*i);
-#if 0
-    if (! commit->is_modified() && ! commit->is_new_branch()) {
-      assert(! commit->branch->next_commit);
-      if (log.debug_mode()) {
-        std::ostringstream buf;
-        buf << "Commit had no Git-visible modifications";
-        log.debug(buf.str());
-      }
+
+    assert(commit == commit->branch->next_commit);
+    commit->branch->next_commit.reset();
+
+    if (commit->has_tree()) {
+      set_commit_info(commit);
+
+      // Only now does the commit get associated with its branch
+      commit->branch->commit = commit;
+
+      assert(! commit->is_written());
+      commits.push_back(commit);
     } else {
+      delete_branch(commit->branch, related_revision);
+    }
+  }
+  commit_queue.clear();
+
+#ifdef USE_THREADS
+  if (fast_import == nullptr && tree_workers > 1 && commits.size() > 1)
+    write_trees(commits);
 #endif
-      assert(commit == commit->branch->next_commit);
-      commit->branch->next_commit.reset();
-
-      if (commit->has_tree()) {
-        set_commit_info(commit);
-
-        // Only now does the commit get associated with its branch
-        commit->branch->commit = commit;
-
-        assert(! commit->is_written());
-        commit->write();
-
-        if (log.debug_mode()) {
-          if (commit->branch->prefix.empty())
-            log.debug(std::string("Updated branch ") + commit->branch->name +
-                      (repo_name.empty() ? "" :
-                       std::string(" {") + repo_name + "}"));
-          else
-            log.debug(std::string("Updated branch ") + commit->branch->name +
-                      " (prefix \"" + commit->branch->prefix.string() + "\")" +
-                      (repo_name.empty() ? "" :
-                       std::string(" {") + repo_name + "}"));
-        }
 
-        ++branches_modified;
-      } else {
-        delete_branch(commit->branch, related_revision);
-      }
-#if 0
+  for (std::vector<CommitPtr>::iterator i = commits.begin();
+       i != commits.end();
+       ++i) {
+    CommitPtr commit(*i);
+    commit->write();
+
+    if (log.debug_mode()) {
+      if (commit->branch->prefix.empty())
+        log.debug(std::string("Updated branch ") + commit->branch->name +
+                  (repo_name.empty() ? "" :
+                   std::string(" {") + repo_name + "}"));
+      else
+        log.debug(std::string("Updated branch ") + commit->branch->name +
+                  " (prefix \"" + commit->branch->prefix.string() + "\")" +
+                  (repo_name.empty() ? "" :
+                   std::string(" {") + repo_name + "}"));
     }
-#endif
+
+    ++branches_modified;
   }
-  commit_queue.clear();
 
   return branches_modified > 0;
 }
@@ -590,15 +1271,10 @@ BranchPtr Repository::find_branch_by_name(const std::string& name,
 BranchPtr Repository::find_branch_by_path(const filesystem::path& pathname,
                                           BranchPtr default_obj)
 {
-  if (! branches_by_path.empty()) {
-    for (filesystem::path dirname(pathname);
-         ! dirname.empty();
-         dirname = dirname.parent_path()) {
-      branches_path_map::iterator i = branches_by_path.find(dirname);
-      if (i != branches_by_path.end())
-        return (*i).second;
-    }
-  }
+  Stats::Timer timer(Stats::FIND_BRANCH);
+
+  if (BranchPtr * branch = branches_trie.find_within(pathname))
+    return *branch;
 
   if (default_obj) {
     std::pair<branches_path_map::iterator, bool> result =
@@ -607,6 +1283,7 @@ BranchPtr Repository::find_branch_by_path(const filesystem::path& pathname,
       log.warn(std::string("Branch path repeated: ") + pathname.string());
       return nullptr;
     }
+    branches_trie.insert(pathname, default_obj);
     return default_obj;
   }
 
@@ -633,9 +1310,13 @@ void Repository::delete_branch(BranchPtr branch, int related_revision)
 
     create_tag(branch->commit, tag_name);
     log.debug(std::string("Wrote tag ") + tag_name);
+
+    // The branch's commits were made on its ref, which must now go.
+    if (fast_import != nullptr)
+      fast_import->reset((branch->is_tag ? "refs/tags/" : "refs/heads/") +
+                         branch->name, 0);
   }
 
-  branch->git_ref     = nullptr;
   branch->commit      = nullptr;
   branch->next_commit = nullptr;
 }
@@ -665,10 +1346,127 @@ void Repository::write_branches()
                  std::string(" {") + repo_name + "}"));
     }
   }
+
+  write_refs();
+}
+
+/**
+ * Have `refname' point at `oid' when refs are next written, unless it
+ * already does.
+ */
+void Repository::set_ref(const std::string& refname, const git_oid * oid)
+{
+  std::map<std::string, git_oid>::iterator i = refs_written.find(refname);
+  if (i != refs_written.end() && git_oid_cmp(&(*i).second, oid) == 0)
+    refs_pending.erase(refname);
+  else
+    refs_pending[refname] = *oid;
+}
+
+/**
+ * Write every ref set since the last call, all at once, by rewriting
+ * packed-refs rather than by locking and writing a loose ref for each.
+ * The file is locked as Git locks it, by creating packed-refs.lock,
+ * which fails if Git or anyone else holds the lock already.  Refs
+ * already packed are kept as they were.  A loose ref overrides a packed
+ * one, so any loose refs by the same names are removed.
+ */
+void Repository::write_refs()
+{
+  if (refs_pending.empty())
+    return;
+
+  filesystem::path git_dir(git_repository_path(repo));
+  filesystem::path packed(git_dir / "packed-refs");
+  filesystem::path lock(git_dir / "packed-refs.lock");
+
+  int fd = ::open(lock.string().c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+  if (fd < 0)
+    throw std::logic_error(std::string("Could not lock ") + packed.string() +
+                           ": " + std::strerror(errno));
+
+  // The lines for each ref, including the peeled id which may follow
+  // a tag's.
+  std::map<std::string, std::string> lines;
+  {
+    filesystem::ifstream in(packed);
+    std::string line;
+    std::string refname;
+    while (std::getline(in, line)) {
+      if (line.empty() || line[0] == '#')
+        continue;
+      if (line[0] == '^') {
+        if (! refname.empty())
+          lines[refname] += line + '\n';
+      }
+      else if (line.length() > 41) {
+        refname        = line.substr(41);
+        lines[refname] = line + '\n';
+      }
+    }
+  }
+
+  for (std::map<std::string, git_oid>::const_iterator i = refs_pending.begin();
+       i != refs_pending.end();
+       ++i)
+    lines[(*i).first] = git_sha1(&(*i).second) + ' ' + (*i).first + '\n';
+
+  std::string data;
+  for (std::map<std::string, std::string>::const_iterator i = lines.begin();
+       i != lines.end();
+       ++i)
+    data += (*i).second;
+
+  const char * p    = data.data();
+  std::size_t  left = data.length();
+  while (left > 0) {
+    ssize_t written = ::write(fd, p, left);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    p    += written;
+    left -= static_cast<std::size_t>(written);
+  }
+
+  system::error_code ec;
+  if (::close(fd) != 0 || left > 0) {
+    filesystem::remove(lock, ec);
+    throw std::logic_error(std::string("Could not write ") + lock.string());
+  }
+
+  filesystem::rename(lock, packed, ec);
+  if (ec) {
+    filesystem::remove(lock, ec);
+    throw std::logic_error(std::string("Could not write ") + packed.string());
+  }
+
+  for (std::map<std::string, git_oid>::const_iterator i = refs_pending.begin();
+       i != refs_pending.end();
+       ++i) {
+    filesystem::remove(git_dir / (*i).first, ec);
+    refs_written[(*i).first] = (*i).second;
+  }
+
+  if (log.debug_mode()) {
+    std::ostringstream buf;
+    buf << "Wrote " << refs_pending.size() << " changed refs, of "
+        << lines.size() << ", to packed-refs";
+    log.debug(buf.str());
+  }
+  refs_pending.clear();
 }
 
 void Repository::garbage_collect()
 {
+  // Packs are already written as objects are created, so there is
+  // nothing left to collect; just make sure the current one is complete.
+  if (pack_writer != nullptr || fast_import != nullptr) {
+    flush_objects();
+    return;
+  }
+
   if (repo_name.empty()) {
     std::system("git config gc.autopacklimit 0");
     std::system("git config loose.compression 0");
@@ -689,15 +1487,38 @@ void Repository::garbage_collect()
 
 void Repository::create_tag(CommitPtr commit, const std::string& name)
 {
-  git_commit * commit_obj;
-  git_check(git_commit_lookup(&commit_obj, *this, commit->get_oid()));
+  if (fast_import != nullptr) {
+    fast_import->tag(name, commit->mark, commit->signature.get());
+    return;
+  }
+
+  // The tag is serialized here, as git_tag_create would, and is only
+  // written if its ref does not name it already.
+  std::string data;
+  data.append("object ");
+  data.append(commit->sha1());
+  data.append("\ntype commit\ntag ");
+  data.append(name);
+  data.push_back('\n');
+  append_signature(data, "tagger ", commit->signature.get());
+  data.push_back('\n');
 
   git_oid tag_oid;
-  git_check(git_tag_create(&tag_oid, *this, name.c_str(),
-                           reinterpret_cast<git_object *>(commit_obj),
-                           commit->signature.get(), "", 1));
+  git_check(git_odb_hash(&tag_oid, data.data(), data.length(), GIT_OBJ_TAG));
 
-  git_commit_free(commit_obj);
+  std::string refname(std::string("refs/tags/") + name);
+
+  const git_oid * current = nullptr;
+  std::map<std::string, git_oid>::const_iterator i = refs_pending.find(refname);
+  if (i != refs_pending.end())
+    current = &(*i).second;
+  else if ((i = refs_written.find(refname)) != refs_written.end())
+    current = &(*i).second;
+
+  if (current == nullptr || git_oid_cmp(current, &tag_oid) != 0)
+    write_object(&tag_oid, data.data(), data.length(), GIT_OBJ_TAG);
+
+  set_ref(refname, &tag_oid);
 }
 
 void Repository::create_file(const filesystem::path& pathname,
@@ -38,6 +38,16 @@
 using namespace boost;
 
 #include "config.h"
+#include "objectpool.h"
+#include "oidhash.h"
+#include "packwriter.h"
+#include "fastimport.h"
+#include "pathtrie.h"
+#include "stats.h"
+
+#if defined(HAVE_PACK_WRITER) && defined(USE_THREADS)
+#define HAVE_BLOB_WORKERS 1
+#endif
 
 namespace Git
 {
@@ -64,6 +74,11 @@ namespace Git
 
   typedef intrusive_ptr<Object>  ObjectPtr;
 
+  // The same few entry names recur across every tree of a conversion,
+  // and in every revision of it that is kept, so each distinct name is
+  // stored only once.
+  typedef flyweight<std::string> object_name;
+
   class Object : public noncopyable
   {
     friend class Repository;
@@ -87,7 +102,7 @@ namespace Git
     }
 
   public:
-    std::string  name;
+    object_name  name;
     unsigned int attributes;
     bool         written;
 
@@ -103,6 +118,13 @@ namespace Git
       assert(refc == 0);
     }
 
+    static void * operator new(std::size_t size) {
+      return ObjectPool::allocate(size);
+    }
+    static void operator delete(void * ptr, std::size_t size) {
+      ObjectPool::deallocate(ptr, size);
+    }
+
     virtual operator const git_oid *() const {
       return &oid;
     }
@@ -162,15 +184,44 @@ namespace Git
 
   class Blob : public Object
   {
+#ifdef HAVE_BLOB_WORKERS
+    // Set while the blob is with the pack writer's workers, until its id
+    // is first asked for.
+    mutable PackWriter::PendingPtr pending;
+
+    void resolve() const;
+#endif
+
   public:
     Blob(RepositoryPtr repository, const git_oid * _oid,
          const std::string& name, unsigned int attributes = 0100644)
       : Object(repository, _oid, name, attributes) {}
 
+#ifdef HAVE_BLOB_WORKERS
+    Blob(RepositoryPtr repository, PackWriter::PendingPtr _pending,
+         const std::string& name, unsigned int attributes = 0100644)
+      : Object(repository, nullptr, name, attributes), pending(_pending) {
+      written = true;         // the pack writer will see to that
+    }
+
+    virtual operator const git_oid *() const {
+      return get_oid();
+    }
+    virtual const git_oid * get_oid() const {
+      if (pending)
+        resolve();
+      return &oid;
+    }
+#endif
+
     virtual ObjectPtr copy_to_name(const std::string& to_name,
                                    bool always_copy = false) {
       if (name == to_name && ! always_copy)
         return this;
+#ifdef HAVE_BLOB_WORKERS
+      else if (pending)
+        return new Blob(repository, pending, to_name, attributes);
+#endif
       else
         return new Blob(repository, &oid, to_name, attributes);
     }
@@ -188,43 +239,140 @@ namespace Git
 #endif // HAVE_BOOST_SERIALIZATION
   };
 
+  /**
+   * The entries of a tree, sorted by name, in chunks of a few dozen
+   * which copies of the tree share until one of them changes.  Copying a
+   * tree thus copies one pointer per chunk, and changing an entry copies
+   * just the chunk which holds it, so that every revision of a tree can
+   * be kept for little more than what changed in it.
+   */
+  class TreeEntries
+  {
+    typedef std::vector<ObjectPtr>     chunk_type;
+    typedef shared_ptr<chunk_type>     chunk_ptr;
+    typedef std::vector<chunk_ptr>     chunks_vector;
+
+    // Chunks split in two when they grow past this many entries.
+    static const std::size_t MAX_CHUNK = 64;
+
+    chunks_vector chunks;       // none of them empty
+    std::size_t   count;
+
+    static bool entry_less(const ObjectPtr& entry, const std::string& name) {
+      return entry->name.get() < name;
+    }
+    static bool chunk_greater(const std::string& name, const chunk_ptr& chunk) {
+      return name < chunk->front()->name.get();
+    }
+
+    chunks_vector::iterator chunk_for(const std::string& name);
+    chunks_vector::const_iterator chunk_for(const std::string& name) const;
+
+    chunk_type& unshare(chunks_vector::iterator chunk) {
+      if (! (*chunk).unique())
+        *chunk = chunk_ptr(new chunk_type(**chunk));
+      return **chunk;
+    }
+
+  public:
+    class const_iterator
+    {
+      friend class TreeEntries;
+
+      chunks_vector::const_iterator chunk;
+      chunks_vector::const_iterator last;
+      std::size_t                   pos;
+
+      const_iterator(chunks_vector::const_iterator _chunk,
+                     chunks_vector::const_iterator _last)
+        : chunk(_chunk), last(_last), pos(0) {}
+
+    public:
+      const ObjectPtr& operator*() const {
+        return (**chunk)[pos];
+      }
+      const ObjectPtr * operator->() const {
+        return &(**chunk)[pos];
+      }
+      const_iterator& operator++() {
+        if (++pos == (*chunk)->size()) {
+          ++chunk;
+          pos = 0;
+        }
+        return *this;
+      }
+      bool operator==(const const_iterator& other) const {
+        return chunk == other.chunk && pos == other.pos;
+      }
+      bool operator!=(const const_iterator& other) const {
+        return ! (*this == other);
+      }
+    };
+
+    TreeEntries() : count(0) {}
+
+    const_iterator begin() const {
+      return const_iterator(chunks.begin(), chunks.end());
+    }
+    const_iterator end() const {
+      return const_iterator(chunks.end(), chunks.end());
+    }
+
+    bool empty() const {
+      return count == 0;
+    }
+    std::size_t size() const {
+      return count;
+    }
+    void clear() {
+      chunks.clear();
+      count = 0;
+    }
+
+    ObjectPtr find(const std::string& name) const;
+
+    /**
+     * Add `obj' under its name, replacing whatever had that name.
+     */
+    void set(ObjectPtr obj);
+    bool erase(const std::string& name);
+  };
+
   typedef intrusive_ptr<Tree> TreePtr;
 
   class Tree : public Object
   {
     friend class Repository;
 
-    git_treebuilder * builder;
-
     friend bool check_size(const Repository& repository, const Tree& tree);
 
   protected:
-    typedef std::map<std::string, ObjectPtr>  entries_map;
-    typedef std::pair<std::string, ObjectPtr> entries_pair;
-
-    entries_map entries;
+    TreeEntries entries;
     bool        modified;
 
+    static bool git_less(const Object * left, const Object * right);
+
+    static Tree * as_tree(const ObjectPtr& obj) {
+      assert(obj->is_tree());
+      return static_cast<Tree *>(obj.get());
+    }
+
     ObjectPtr do_lookup(filesystem::path::iterator segment,
                         filesystem::path::iterator end)
     {
-      std::string name = (*segment).string();
-
-      entries_map::iterator i = entries.find(name);
-      if (i == entries.end())
+      ObjectPtr obj(entries.find((*segment).string()));
+      if (! obj)
         return nullptr;
 
-      ObjectPtr result;
-      if (++segment == end) {
-        result = (*i).second;
-        assert(result->name == name);
-      } else {
-        result = dynamic_cast<Tree *>((*i).second.get())->do_lookup(segment, end);
-      }
-      return result;
+      if (++segment == end)
+        return obj;
+      else if (obj->is_tree())
+        return as_tree(obj)->do_lookup(segment, end);
+      else
+        return nullptr;
     }
 
-    bool do_update(filesystem::path::iterator segment,
+    void do_update(filesystem::path::iterator segment,
                    filesystem::path::iterator end, ObjectPtr obj);
 
     void do_remove(filesystem::path::iterator segment,
@@ -233,17 +381,15 @@ namespace Git
   public:
     Tree(RepositoryPtr repository, const git_oid * _oid,
          const std::string& name, unsigned int attributes = 0040000)
-      : Object(repository, _oid, name, attributes), builder(nullptr),
-        modified(false) {}
+      : Object(repository, _oid, name, attributes), modified(false) {}
 
+    // A copy has the same contents, and so the same id, until it is
+    // changed; its name is not part of it.
     Tree(const Tree& other)
-      : Object(other.repository, nullptr, other.name, other.attributes),
-        builder(nullptr), entries(other.entries), modified(false) {}
-
-    virtual ~Tree() {
-      if (builder != nullptr)
-        git_treebuilder_free(builder);
-    }
+      : Object(other.repository,
+               other.is_written() ? other.get_oid() : nullptr,
+               other.name, other.attributes),
+        entries(other.entries), modified(false) {}
 
     virtual bool is_blob() const {
       return false;
@@ -271,23 +417,32 @@ namespace Git
     bool empty() const {
       return entries.empty();
     }
+    TreeEntries::const_iterator begin() const {
+      return entries.begin();
+    }
+    TreeEntries::const_iterator end() const {
+      return entries.end();
+    }
 
     ObjectPtr lookup(const filesystem::path& pathname) {
+      Stats::Timer timer(Stats::TREE_LOOKUP);
       return do_lookup(pathname.begin(), pathname.end());
     }
 
     void update(const filesystem::path& pathname, ObjectPtr obj) {
+      Stats::Timer timer(Stats::TREE_UPDATE);
       if (pathname.empty()) {
         assert(obj->is_tree());
-        TreePtr subtree = dynamic_cast<Tree *>(obj.get());
-        for (auto entry : subtree->entries)
-          update(entry.first, entry.second);
+        TreePtr subtree = as_tree(obj);
+        for (const ObjectPtr& entry : subtree->entries)
+          update(entry->name.get(), entry);
       } else {
         do_update(pathname.begin(), pathname.end(), obj);
       }
     }
 
     void remove(const filesystem::path& pathname) {
+      Stats::Timer timer(Stats::TREE_UPDATE);
       if (pathname.empty()) {
         entries.clear();
         modified = true;
@@ -297,8 +452,12 @@ namespace Git
       }
     }
 
+    void encode(std::string& data) const;
     virtual void write();
 
+    void import_entries(FastImport& fast_import, const std::string& prefix,
+                        bool replace = false) const;
+
     void dump_tree(std::ostream& out, int depth = 0);
 
 #if defined(HAVE_BOOST_SERIALIZATION)
@@ -310,7 +469,6 @@ namespace Git
     template<class Archive>
     void serialize(Archive& ar, const unsigned int /* version */) {
       ar & boost::serialization::base_object<Object>(*this);
-      ar & builder;
       ar & entries;
       ar & modified;
     }
@@ -324,19 +482,26 @@ namespace Git
   {
     friend class Repository;
 
+    typedef std::pair<filesystem::path, ObjectPtr> change_value;
+
+    std::vector<change_value> changes; // only kept for fast-import
+
+    void write_fast_import(FastImport& fast_import);
+
   public:
     CommitPtr   parent;
     TreePtr     tree;
     BranchPtr   branch;
     bool        new_branch;
     std::string message_str;
+    int         mark;           // fast-import mark, once written
 
     shared_ptr<git_signature> signature;
 
     Commit(RepositoryPtr repo, const git_oid * _oid, CommitPtr _parent = nullptr,
            const std::string& name = "", unsigned int attributes = 0040000)
       : Object(repo, _oid, name, attributes), parent(_parent),
-        new_branch(false) {}
+        new_branch(false), mark(0) {}
 
     virtual bool is_blob() const {
       return false;
@@ -412,6 +577,7 @@ namespace Git
       ar & branch;
       ar & new_branch;
       ar & message_str;
+      ar & mark;
       ar & signature;
     }
 #endif // HAVE_BOOST_SERIALIZATION
@@ -421,8 +587,6 @@ namespace Git
   {
     friend class Repository;
 
-    git_reference * git_ref;
-
   public:
     RepositoryPtr    repository;
     std::string      name;
@@ -433,13 +597,10 @@ namespace Git
 
     Branch(RepositoryPtr repo, const std::string& _name = "master",
            bool _is_tag = false)
-      : git_ref(nullptr), repository(repo), name(_name), is_tag(_is_tag),
-        refc(0) {}
+      : repository(repo), name(_name), is_tag(_is_tag), refc(0) {}
 
     ~Branch() {
       assert(refc == 0);
-      if (git_ref != nullptr)
-        git_reference_free(git_ref);
     }
 
     mutable int refc;
@@ -512,9 +673,34 @@ namespace Git
 
   inline void no_commit_info(CommitPtr) {}
 
+#ifndef HAVE_PACK_WRITER
+  class PackWriter;
+#endif
+
   class Repository
   {
+    friend class Blob;
+
     git_repository * repo;
+    PackWriter *     pack_writer; // if objects are streamed into packs
+    FastImport *     fast_import; // if a fast-import stream is written
+    unsigned         tree_workers; // threads hashing trees, in write()
+
+    // The target of every ref this repository has written, as of the
+    // last write_refs(), and those set since then.
+    std::map<std::string, git_oid> refs_written;
+    std::map<std::string, git_oid> refs_pending;
+
+#ifdef USE_THREADS
+    // The commit each unwritten tree belongs to, in write_trees().
+    typedef std::unordered_map<Tree *, int> tree_owners_map;
+
+    void find_unwritten(Tree * tree, int owner, tree_owners_map& owners,
+                        std::vector<Tree *>& shared);
+    void list_unwritten(Tree * tree, int owner, tree_owners_map& owners,
+                        std::vector<Tree *>& trees);
+    void write_trees(const std::vector<CommitPtr>& commits);
+#endif
 
   public:
     typedef std::map<std::string, BranchPtr>      branches_name_map;
@@ -523,16 +709,21 @@ namespace Git
     typedef std::map<filesystem::path, BranchPtr> branches_path_map;
     typedef branches_path_map::value_type         branches_path_value;
 
+    typedef std::unordered_map<git_oid, TreePtr, oid_hash, oid_equal>
+      trees_by_oid;
+
     Logger&                   log;
     std::string               repo_name;
     branches_name_map         branches_by_name;
     branches_path_map         branches_by_path;
+    PathTrie<BranchPtr>       branches_trie; // indexes branches_by_path
     std::vector<CommitPtr>    commit_queue;
     function<void(CommitPtr)> set_commit_info;
 
     Repository(const filesystem::path& pathname, Logger& _log,
                function<void(CommitPtr)> _set_commit_info = no_commit_info)
-      : repo(nullptr), log(_log), set_commit_info(_set_commit_info)
+      : repo(nullptr), pack_writer(nullptr), fast_import(nullptr),
+        tree_workers(1), log(_log), set_commit_info(_set_commit_info)
     {
       if (git_repository_open(&repo, pathname.string().c_str()) != 0)
         if (git_repository_open(&repo,
@@ -541,10 +732,7 @@ namespace Git
                                  pathname.string() + " or " +
                                  (pathname / ".git").string());
     }
-    ~Repository() {
-      if (repo != nullptr)
-        git_repository_free(repo);
-    }
+    ~Repository();
 
     operator git_repository *() const {
       return repo;
@@ -557,17 +745,51 @@ namespace Git
     TreePtr   create_tree(const std::string& name = "",
                           unsigned int attributes = 040000);
 
+    void      read_blob(const git_oid * oid, std::string& data);
+    TreePtr   read_tree(const git_oid * oid, trees_by_oid& seen,
+                        const std::string& name = "");
+    CommitPtr read_commit(const git_oid * oid, trees_by_oid& seen);
+    bool      read_entry(const git_oid * tree_oid,
+                         const filesystem::path& pathname,
+                         git_oid * oid, unsigned int * attributes,
+                         bool * is_tree);
+    bool      read_ref(const std::string& refname, git_oid * oid);
+    void      read_history(const git_oid * oid,
+                           function<void(const git_oid *,
+                                         const std::string&)> visit);
+    void      write_object(git_oid * oid, const void * data, std::size_t len,
+                           git_otype type);
+
     CommitPtr create_commit(CommitPtr parent = nullptr);
 
     BranchPtr find_branch_by_name(const std::string& name,
                                   BranchPtr default_obj = nullptr);
     BranchPtr find_branch_by_path(const filesystem::path& name,
                                   BranchPtr default_obj = nullptr);
+    BranchPtr find_branch_within(const filesystem::path& pathname) {
+      BranchPtr * branch = branches_trie.find_within(pathname);
+      return branch ? *branch : nullptr;
+    }
     void      delete_branch(BranchPtr branch, int related_revision);
     bool      write(int related_revision);
     void      write_branches();
+    void      set_ref(const std::string& refname, const git_oid * oid);
+    void      write_refs();
     void      garbage_collect();
 
+    bool      use_pack_writer(std::uint64_t max_pack_size);
+    bool      use_blob_workers(unsigned count);
+    void      use_tree_workers(unsigned count) {
+      tree_workers = count;
+    }
+    void      use_fast_import(const filesystem::path& output = "");
+    void      flush_objects();
+    void      close();
+
+    FastImport * get_fast_import() const {
+      return fast_import;
+    }
+
     void      create_tag(CommitPtr commit, const std::string& name);
     void      create_file(const filesystem::path& pathname,
                           const std::string& content = "");
@@ -585,6 +807,11 @@ namespace Git
       ar & repo_name;
       ar & branches_by_name;
       ar & branches_by_path;
+      if (Archive::is_loading::value) {
+        branches_trie.clear();
+        for (const branches_path_value& value : branches_by_path)
+          branches_trie.insert(value.first, value.second);
+      }
       ar & commit_queue;
       ar & set_commit_info;
     }
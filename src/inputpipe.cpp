@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "inputpipe.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+#ifdef HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif
+
+#ifndef ASSERTS
+#undef assert
+#define assert(x)
+#endif
+
+namespace SvnDump {
+
+namespace {
+  // How much is read from the pipe at a time, and how large we ask the
+  // kernel to make the pipe itself, so that the decompressor can run
+  // well ahead of the parser.
+  const std::size_t BUFFER_SIZE = 1024 * 1024;
+
+  struct magic_number {
+    const char * program;
+    const char * bytes;
+    std::size_t  len;
+  };
+
+  const magic_number magic_numbers[] = {
+    { "xz",    "\xfd" "7zXZ\0", 6 },
+    { "gzip",  "\x1f\x8b",      2 },
+    { "bzip2", "BZh",           3 },
+    { "zstd",  "\x28\xb5\x2f\xfd", 4 }
+  };
+}
+
+InputPipe::InputPipe()
+  : fd(-1), child(-1), status(0), reaped(true), program(nullptr),
+    position(0), buffer(new char[BUFFER_SIZE])
+{
+  setg(buffer, buffer, buffer);
+}
+
+InputPipe::~InputPipe()
+{
+  close();
+  delete[] buffer;
+}
+
+const char * InputPipe::decompressor_for(const filesystem::path& file)
+{
+  char header[8];
+  std::size_t len = 0;
+
+  int in = ::open(file.string().c_str(), O_RDONLY);
+  if (in < 0)
+    return nullptr;
+
+  ssize_t count = ::read(in, header, sizeof(header));
+  if (count > 0)
+    len = static_cast<std::size_t>(count);
+  ::close(in);
+
+  for (std::size_t i = 0;
+       i < sizeof(magic_numbers) / sizeof(magic_numbers[0]);
+       ++i) {
+    const magic_number& magic(magic_numbers[i]);
+    if (len >= magic.len && std::memcmp(header, magic.bytes, magic.len) == 0)
+      return magic.program;
+  }
+  return nullptr;
+}
+
+void InputPipe::open(const filesystem::path& _file, const char * _program)
+{
+  close();
+
+  file    = _file;
+  program = _program;
+
+#ifdef HAVE_SYS_WAIT_H
+  int in = ::open(file.string().c_str(), O_RDONLY);
+  if (in < 0)
+    throw std::runtime_error("Cannot open " + file.string());
+
+  int fds[2];
+  if (::pipe(fds) != 0) {
+    ::close(in);
+    throw std::runtime_error("Cannot create a pipe for " + file.string());
+  }
+
+#ifdef F_SETPIPE_SZ
+  ::fcntl(fds[0], F_SETPIPE_SZ, static_cast<int>(BUFFER_SIZE));
+#endif
+
+  pid_t pid = ::fork();
+  if (pid < 0) {
+    ::close(in);
+    ::close(fds[0]);
+    ::close(fds[1]);
+    throw std::runtime_error(std::string("Cannot run ") + program);
+  }
+
+  if (pid == 0) {
+    ::dup2(in, STDIN_FILENO);
+    ::dup2(fds[1], STDOUT_FILENO);
+    ::close(in);
+    ::close(fds[0]);
+    ::close(fds[1]);
+    ::execlp(program, program, "-dc", static_cast<char *>(nullptr));
+    ::_exit(127);
+  }
+
+  ::close(in);
+  ::close(fds[1]);
+
+  fd     = fds[0];
+  child  = pid;
+  reaped = false;
+  status = 0;
+#else
+  throw std::runtime_error("Reading compressed dumps is not supported "
+                           "on this platform");
+#endif
+
+  position = 0;
+  setg(buffer, buffer, buffer);
+}
+
+void InputPipe::open_stdin()
+{
+  close();
+
+  file     = "-";
+  program  = nullptr;
+  fd       = STDIN_FILENO;
+  position = 0;
+  setg(buffer, buffer, buffer);
+}
+
+void InputPipe::close()
+{
+  if (fd >= 0 && fd != STDIN_FILENO)
+    ::close(fd);
+  fd = -1;
+
+#ifdef HAVE_SYS_WAIT_H
+  if (! reaped) {
+    // If we stopped reading early the decompressor may still be
+    // running; closing the pipe will not stop it if it is blocked on
+    // input, so make sure.
+    ::kill(child, SIGTERM);
+    while (::waitpid(child, &status, 0) < 0 && errno == EINTR)
+      ;
+    reaped = true;
+  }
+#endif
+  child = -1;
+}
+
+void InputPipe::restart()
+{
+  if (is_stdin())
+    throw std::runtime_error("A dump read from standard input cannot be "
+                             "read twice; use --single-pass or --skip");
+  open(filesystem::path(file), program);
+}
+
+void InputPipe::check_status()
+{
+#ifdef HAVE_SYS_WAIT_H
+  if (reaped)
+    return;
+
+  while (::waitpid(child, &status, 0) < 0 && errno == EINTR)
+    ;
+  reaped = true;
+
+  if (! WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    std::ostringstream buf;
+    buf << program << " failed while decompressing " << file.string();
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127)
+      buf << " (could not run " << program << ")";
+    throw std::runtime_error(buf.str());
+  }
+#endif
+}
+
+InputPipe::int_type InputPipe::underflow()
+{
+  if (gptr() < egptr())
+    return traits_type::to_int_type(*gptr());
+
+  if (fd < 0)
+    return traits_type::eof();
+
+  position += static_cast<std::uint64_t>(egptr() - eback());
+
+  ssize_t count;
+  do {
+    count = ::read(fd, buffer, BUFFER_SIZE);
+  } while (count < 0 && errno == EINTR);
+
+  if (count <= 0) {
+    setg(buffer, buffer, buffer);
+    return traits_type::eof();
+  }
+
+  setg(buffer, buffer, buffer + count);
+  return traits_type::to_int_type(*gptr());
+}
+
+InputPipe::pos_type InputPipe::seekoff(off_type off,
+                                       std::ios_base::seekdir dir,
+                                       std::ios_base::openmode)
+{
+  // Only asking for the current position is supported.
+  if (off != 0 || dir != std::ios_base::cur)
+    return pos_type(off_type(-1));
+  return pos_type(static_cast<off_type>
+                  (position + static_cast<std::uint64_t>(gptr() - eback())));
+}
+
+} // namespace SvnDump
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _INPUTPIPE_H
+#define _INPUTPIPE_H
+
+#include "system.hpp"
+
+using namespace boost;
+
+namespace SvnDump
+{
+  /**
+   * A stream buffer which reads a dump from a pipe: either standard
+   * input, or the output of a decompressor (xz, gzip, bzip2 or zstd)
+   * running as a child process.  Decompression thus proceeds alongside
+   * the parser, on another core, rather than as a separate step that
+   * first writes the whole dump back out to disk.
+   *
+   * A pipe can only be read forward; its position is tracked so that
+   * tellg() still works, but seeking is not supported.
+   */
+  class InputPipe : public std::streambuf, public noncopyable
+  {
+    int              fd;
+    int              child;         // process id, or -1
+    int              status;
+    bool             reaped;
+    filesystem::path file;
+    const char *     program;
+    std::uint64_t    position;      // offset of the start of `buffer'
+    char *           buffer;
+
+  public:
+    InputPipe();
+    ~InputPipe();
+
+    /**
+     * Return the name of the program which decompresses `file', judging
+     * by its first few bytes, or nullptr if it is not compressed.
+     */
+    static const char * decompressor_for(const filesystem::path& file);
+
+    void open(const filesystem::path& _file, const char * _program);
+    void open_stdin();
+    void close();
+
+    /**
+     * Start reading over from the beginning.  This restarts the
+     * decompressor; standard input cannot be rewound.
+     */
+    void restart();
+
+    bool is_stdin() const {
+      return program == nullptr;
+    }
+
+    /**
+     * Once the end of input has been reached, check that the
+     * decompressor exited cleanly, so that a truncated or corrupt file
+     * is not mistaken for a short dump.  Throws if it did not.
+     */
+    void check_status();
+
+  protected:
+    virtual int_type underflow();
+    virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                             std::ios_base::openmode which);
+  };
+}
+
+#endif // _INPUTPIPE_H
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "logsink.h"
+
+LogSink::LogSink(std::ostream& _target)
+  : target(_target)
+#ifdef USE_THREADS
+  , closing(false), writer(bind(&LogSink::write_pending, this))
+#endif
+{
+  setp(buffer, buffer + sizeof(buffer));
+}
+
+LogSink::~LogSink()
+{
+  hand_over();
+
+#ifdef USE_THREADS
+  { mutex::scoped_lock lock(the_mutex);
+    closing = true;
+  }
+  not_empty.notify_one();
+  writer.join();
+#endif
+}
+
+/**
+ * Pass whatever has been written to the stream buffer on to the writer.
+ */
+void LogSink::hand_over()
+{
+  std::size_t len = static_cast<std::size_t>(pptr() - pbase());
+  if (len == 0)
+    return;
+
+#ifdef USE_THREADS
+  { mutex::scoped_lock lock(the_mutex);
+    while (pending.length() >= MAX_PENDING)
+      not_full.wait(lock);
+    pending.append(pbase(), len);
+  }
+  not_empty.notify_one();
+#else
+  target.write(pbase(), static_cast<std::streamsize>(len));
+  target.flush();
+#endif
+
+  setp(buffer, buffer + sizeof(buffer));
+}
+
+LogSink::int_type LogSink::overflow(int_type ch)
+{
+  hand_over();
+  if (! traits_type::eq_int_type(ch, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+  }
+  return traits_type::not_eof(ch);
+}
+
+int LogSink::sync()
+{
+  hand_over();
+  return 0;
+}
+
+#ifdef USE_THREADS
+
+void LogSink::write_pending()
+{
+  std::string text;
+  for (;;) {
+    { mutex::scoped_lock lock(the_mutex);
+      while (pending.empty() && ! closing)
+        not_empty.wait(lock);
+      if (pending.empty())
+        return;
+      text.swap(pending);
+    }
+    not_full.notify_all();
+
+    target.write(text.data(), static_cast<std::streamsize>(text.length()));
+    target.flush();
+    text.clear();
+  }
+}
+
+#endif // USE_THREADS
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LOGSINK_H
+#define _LOGSINK_H
+
+#include "system.hpp"
+
+using namespace boost;
+
+/**
+ * A stream buffer whose text is written to another stream by a thread
+ * of its own, so that the converter never waits on the terminal to
+ * show its progress or log.  Text is handed over whenever the stream is
+ * flushed, as std::endl does, or its buffer fills.  Should the writer
+ * fall far behind, writers wait for it rather than letting the backlog
+ * grow without bound.  Whatever is left is written out when the sink
+ * is destroyed.
+ *
+ * Without USE_THREADS, text is simply passed on with each flush.
+ */
+class LogSink : public std::streambuf, public noncopyable
+{
+  // The most text that may be waiting to be written.
+  static const std::size_t MAX_PENDING = 1024 * 1024;
+
+  std::ostream& target;
+  char          buffer[4096];
+
+#ifdef USE_THREADS
+  std::string        pending;
+  bool               closing;
+  mutex              the_mutex;
+  condition_variable not_empty;
+  condition_variable not_full;
+  thread             writer;
+
+  void write_pending();
+#endif
+
+  void hand_over();
+
+protected:
+  virtual int_type overflow(int_type ch);
+  virtual int      sync();
+
+public:
+  explicit LogSink(std::ostream& _target);
+  ~LogSink();
+};
+
+#endif // _LOGSINK_H
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LRUCACHE_H
+#define _LRUCACHE_H
+
+#include "system.hpp"
+
+using namespace boost;
+
+/**
+ * A bounded map which forgets its least recently used entries first.
+ * Each entry is given a cost when inserted -- its size in bytes, say, or
+ * just 1 to bound the number of entries -- and once the total exceeds
+ * `max_cost', the oldest entries are dropped until it fits again.  An
+ * entry already present is never replaced.  Hits and misses are
+ * counted, for the log.
+ */
+template <typename Key, typename Value,
+          typename Hash = std::hash<Key>, typename Equal = std::equal_to<Key> >
+class LruCache : public noncopyable
+{
+  struct entry_type {
+    Key         key;
+    Value       value;
+    std::size_t cost;
+
+    entry_type(const Key& _key, const Value& _value, std::size_t _cost)
+      : key(_key), value(_value), cost(_cost) {}
+  };
+
+  typedef std::list<entry_type> entries_list;
+
+  typedef std::unordered_map<Key, typename entries_list::iterator,
+                             Hash, Equal> entries_map;
+
+  entries_list entries;         // most recently used first
+  entries_map  by_key;
+  std::size_t  max_cost;
+  std::size_t  cost;
+
+public:
+  std::size_t hits;
+  std::size_t misses;
+
+  explicit LruCache(std::size_t _max_cost)
+    : max_cost(_max_cost), cost(0), hits(0), misses(0) {}
+
+  std::size_t get_max_cost() const {
+    return max_cost;
+  }
+
+  Value * find(const Key& key) {
+    typename entries_map::iterator i = by_key.find(key);
+    if (i == by_key.end()) {
+      ++misses;
+      return nullptr;
+    }
+    ++hits;
+    entries.splice(entries.begin(), entries, (*i).second);
+    return &(*(*i).second).value;
+  }
+
+  void insert(const Key& key, const Value& value, std::size_t entry_cost) {
+    if (by_key.find(key) != by_key.end())
+      return;
+
+    entries.push_front(entry_type(key, value, entry_cost));
+    by_key.insert(typename entries_map::value_type(key, entries.begin()));
+    cost += entry_cost;
+
+    while (cost > max_cost && ! entries.empty()) {
+      entry_type& oldest(entries.back());
+      cost -= oldest.cost;
+      by_key.erase(oldest.key);
+      entries.pop_back();
+    }
+  }
+
+  std::size_t size() const {
+    return entries.size();
+  }
+
+  void clear() {
+    entries.clear();
+    by_key.clear();
+    cost = 0;
+  }
+};
+
+#endif // _LRUCACHE_H
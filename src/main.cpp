@@ -32,8 +32,45 @@
 
 #include "converter.h"
 #include "branches.h"
+#include "modules.h"
+#include "nodequeue.h"
+#include "logsink.h"
+#include "stats.h"
 
 namespace {
+#ifdef USE_THREADS
+  /**
+   * libgit2 keeps its error state per thread, so it must be set up for
+   * threads before module threads and the pack writer's workers use it
+   * at once.
+   */
+  struct GitThreads {
+    GitThreads() {
+      git_threads_init();
+    }
+    ~GitThreads() {
+      git_threads_shutdown();
+    }
+  };
+#endif
+
+  void report_mismatch(const StatusDisplay&               status,
+                       const SvnDump::Verifier::Failure& failure)
+  {
+    std::ostringstream buf;
+    buf << failure.digest << " checksum mismatch for " << failure.pathname
+        << " in r" << failure.rev;
+    status.warn(buf.str());
+  }
+
+  void interrupt_conversion(int sig)
+  {
+    // A second signal, perhaps during a very long revision, stops the
+    // conversion at once.
+    std::signal(sig, SIG_DFL);
+    ConvertRepository::interrupted = 1;
+  }
+
   template <typename T>
   void invoke_scanner(SvnDump::File& dump) {
     StatusDisplay status(std::cerr);
@@ -46,83 +83,203 @@ namespace {
     finder.finish();
   }
 
-  struct comparator {
-    bool operator()(const ConvertRepository::copy_from_value& left,
-                    const ConvertRepository::copy_from_value& right) {
-      return left.second < right.second;
+  /**
+   * Feed the nodes of `dump' to both scanners at once, stopping short of
+   * `end_rev' if it is given.
+   */
+  void analyze_nodes(SvnDump::File& dump, Authors& authors,
+                     Branches& branches, int end_rev = -1) {
+    while (dump.read_next(/* ignore_text= */ true)) {
+      const SvnDump::File::Node& node(dump.get_curr_node());
+      if (end_rev != -1 && node.get_rev_nr() >= end_rev)
+        break;
+      branches.status.set_final_rev(dump.get_last_rev_nr());
+      authors(dump, node);
+      branches(dump, node);
     }
-  };
+  }
 
 #ifdef USE_THREADS
 
-  template<typename Data>
-  class concurrent_queue
+  /**
+   * Reads the dump on a thread of its own, handing its nodes over in
+   * batches, one per revision, through a bounded NodeQueue.  If the
+   * consumer leaves early (say, on an error), the destructor releases
+   * the reader and waits for it.
+   */
+  class NodeReader : public noncopyable
   {
-  private:
-    std::queue<Data> * the_queue;
-    mutable mutex      the_mutex;
-    condition_variable waiting_on_contents;
-    condition_variable waiting_on_empty;
-
-  public:
-    concurrent_queue() : the_queue(new std::queue<Data>) {}
-    ~concurrent_queue() {
-      if (the_queue)
-        delete the_queue;
-    }
+    SvnDump::File&     dump;
+    SvnDump::NodeQueue queue;
+    bool               ignore_text;
+    bool               verify;
+    int                start;
+    int                cutoff;
+    std::exception_ptr error;
+    thread             reader;
+
+    void read_all_nodes() {
+      try {
+        SvnDump::NodeQueue::batch_type batch;
+        std::size_t batch_bytes = 0;
+        int         batch_rev   = -1;
+
+        while (dump.read_next(ignore_text, verify)) {
+          SvnDump::File::Node& node(dump.get_curr_node());
+          int rev = node.get_rev_nr();
+          if (cutoff != -1 && rev >= cutoff)
+            break;
+          if (start != -1 && rev < start)
+            continue;
+
+          // Very large revisions are split, so that a single batch
+          // cannot take up the whole budget.
+          if (! batch.empty() &&
+              (rev != batch_rev ||
+               batch_bytes >= queue.get_max_bytes() / 8)) {
+            if (! queue.push(batch, batch_bytes))
+              return;
+            batch_bytes = 0;
+          }
+          batch_rev    = rev;
+          batch_bytes += node.get_memory_size();
+          batch.push_back(move(node));
+        }
 
-    void push(Data&& data) {
-      { mutex::scoped_lock lock(the_mutex);
-        the_queue->push(move(data));
+        if (! batch.empty())
+          queue.push(batch, batch_bytes);
+      }
+      catch (...) {
+        error = std::current_exception();
       }
-      waiting_on_contents.notify_one();
+      queue.close();
     }
 
-    void clear() {
-      mutex::scoped_lock lock(the_mutex);
-
-      while (! the_queue->empty())
-        waiting_on_empty.wait(lock);
-
-      delete the_queue;
-      the_queue = nullptr;
+  public:
+    NodeReader(SvnDump::File& _dump, bool _ignore_text, bool _verify,
+               int _start, int _cutoff)
+      : dump(_dump), ignore_text(_ignore_text), verify(_verify),
+        start(_start), cutoff(_cutoff),
+        reader(bind(&NodeReader::read_all_nodes, this)) {}
+
+    ~NodeReader() {
+      queue.cancel();
+      if (reader.joinable())
+        reader.join();
+    }
 
-      waiting_on_contents.notify_one();
+    bool pop(SvnDump::NodeQueue::batch_type& batch) {
+      return queue.pop(batch);
     }
 
-    bool pop(Data& popped_value) {
-      mutex::scoped_lock lock(the_mutex);
+    /**
+     * Wait for the reader to finish, passing on anything it threw.
+     */
+    void finish(const StatusDisplay& status) {
+      reader.join();
+      if (error)
+        std::rethrow_exception(error);
+
+      SvnDump::NodeQueue::Stats stats(queue.get_stats());
+      std::ostringstream buf;
+      buf << "Node queue: " << stats.nodes << " nodes in "
+          << stats.batches << " batches; peak depth "
+          << stats.peak_batches << " batches, "
+          << stats.peak_bytes / 1024 << " KB; reader waited "
+          << stats.producer_waits << " times, converter waited "
+          << stats.consumer_waits << " times";
+      status.info(buf.str());
+    }
+  };
 
-      while (the_queue && the_queue->empty())
-        waiting_on_contents.wait(lock);
 
-      if (! the_queue) {
-        waiting_on_empty.notify_one();
-        return false;
-      } else {
-        popped_value=move(the_queue->front());
-        the_queue->pop();
+  /**
+   * Scans one range of revisions on a thread of its own, using a private
+   * handle on the dump file.  Branch actions are only recorded, since
+   * their effect depends on every revision before the range.
+   */
+  class RangeScanner : public noncopyable
+  {
+    Options            quiet;
+    StatusDisplay      status;
+    filesystem::path   dump_file;
+    bool               map_file;
+    int                begin_rev;
+    int                end_rev;
+    std::exception_ptr error;
+
+    static const Options& quiet_options(Options& opts) {
+      opts.quiet = true;
+      return opts;
+    }
 
-        waiting_on_empty.notify_one();
-        return true;
+  public:
+    Authors  authors;
+    Branches branches;
+
+    RangeScanner(const filesystem::path& _dump_file, bool _map_file,
+                 int _begin_rev, int _end_rev)
+      : status(std::cerr, quiet_options(quiet)), dump_file(_dump_file),
+        map_file(_map_file), begin_rev(_begin_rev), end_rev(_end_rev),
+        authors(status), branches(status, /* deferred= */ true) {}
+
+    void operator()() {
+      try {
+        SvnDump::File dump(dump_file, map_file);
+        if (! dump.seek(begin_rev))
+          throw std::runtime_error("Cannot seek to revision " +
+                                   lexical_cast<std::string>(begin_rev) +
+                                   " in " + dump_file.string());
+        analyze_nodes(dump, authors, branches, end_rev);
+      }
+      catch (...) {
+        error = std::current_exception();
       }
     }
+
+    void rethrow() const {
+      if (error)
+        std::rethrow_exception(error);
+    }
   };
 
-  void read_all_nodes(SvnDump::File * dump,
-                      concurrent_queue<SvnDump::File::Node> * queue,
-                      bool ignore_text, bool verify,
-                      int start, int cutoff)
-  {
-    while (dump->read_next(ignore_text, verify)) {
-      SvnDump::File::Node& node(dump->get_curr_node());
-      int rev = node.get_rev_nr();
-      if (cutoff != -1 && rev >= cutoff)
-        break;
-      if (start == -1 || rev >= start)
-        queue->push(move(node));
+  /**
+   * Split the indexed revisions of `dump' into `jobs' ranges of roughly
+   * equal size in bytes, scan each range on its own thread, and merge
+   * the partial results into `authors' and `branches' in revision order,
+   * which gives the same result as a single sequential pass.
+   */
+  void analyze_ranges(SvnDump::File& dump, const filesystem::path& dump_file,
+                      bool map_file, unsigned jobs, Authors& authors,
+                      Branches& branches) {
+    const SvnDump::Index::entries_vector& entries(dump.get_index().get_entries());
+    std::uint64_t total = entries.back().offset;
+
+    std::vector<int> bounds;
+    bounds.push_back(entries.front().rev);
+    for (std::size_t i = 1; i < entries.size(); ++i)
+      if (entries[i].offset >= total / jobs * bounds.size() &&
+          bounds.size() < jobs)
+        bounds.push_back(entries[i].rev);
+    bounds.push_back(-1);
+
+    std::vector<shared_ptr<RangeScanner> > scanners;
+    thread_group workers;
+    for (std::size_t i = 0; i + 1 < bounds.size(); ++i) {
+      scanners.push_back(make_shared<RangeScanner>
+                         (dump_file, map_file, bounds[i], bounds[i + 1]));
+      workers.create_thread(ref(*scanners.back()));
+    }
+    workers.join_all();
+
+    branches.status.set_final_rev(dump.get_last_rev_nr());
+    for (std::size_t i = 0; i < scanners.size(); ++i) {
+      scanners[i]->rethrow();
+      authors.merge(scanners[i]->authors);
+      branches.replay(scanners[i]->branches.actions);
+      branches.status.update(bounds[i + 1] == -1 ?
+                             dump.get_last_rev_nr() : bounds[i + 1] - 1);
     }
-    queue->clear();
   }
 
 #endif // USE_THREADS
@@ -132,13 +289,22 @@ int main(int argc, char *argv[])
 {
   std::ios::sync_with_stdio(false);
 
+#ifdef USE_THREADS
+  GitThreads git_threads;
+#endif
+
   // Examine any option settings made by the user.  -f is the only
   // required one.
 
   Options opts;
 
   bool skip_preflight = false;
+  bool single_pass    = false;
   bool verify         = false;
+  bool map_file       = true;
+  bool use_index      = true;
+  bool resume         = false;
+  bool incremental    = false;
   int  start          = -1;
   int  cutoff         = -1;
 
@@ -149,7 +315,8 @@ int main(int argc, char *argv[])
   std::vector<std::string> args;
 
   for (int i = 1; i < argc; ++i) {
-    if (argv[i][0] == '-') {
+    // A lone "-" names standard input as the dump file.
+    if (argv[i][0] == '-' && argv[i][1] != '\0') {
       if (argv[i][1] == '-') {
         if (std::strcmp(&argv[i][2], "verify") == 0)
           verify = true;
@@ -161,16 +328,48 @@ int main(int argc, char *argv[])
           opts.debug = 1;
         else if (std::strcmp(&argv[i][2], "skip") == 0)
           skip_preflight = 1;
+        else if (std::strcmp(&argv[i][2], "single-pass") == 0)
+          single_pass = true;
+        else if (std::strcmp(&argv[i][2], "no-mmap") == 0)
+          map_file = false;
+        else if (std::strcmp(&argv[i][2], "no-index") == 0)
+          use_index = false;
         else if (std::strcmp(&argv[i][2], "start") == 0)
           start = std::atoi(argv[++i]);
         else if (std::strcmp(&argv[i][2], "cutoff") == 0)
           cutoff = std::atoi(argv[++i]);
+        else if (std::strcmp(&argv[i][2], "checkpoint") == 0)
+          opts.checkpoint = std::atoi(argv[++i]);
+        else if (std::strcmp(&argv[i][2], "stats") == 0)
+          opts.stats = true;
+        else if (std::strcmp(&argv[i][2], "stats-json") == 0)
+          opts.stats_json = true;
+        else if (std::strcmp(&argv[i][2], "stats-every") == 0)
+          opts.stats_every = std::atoi(argv[++i]);
+        else if (std::strcmp(&argv[i][2], "spill-after") == 0)
+          opts.spill_after = std::atoi(argv[++i]);
+        else if (std::strcmp(&argv[i][2], "resume") == 0)
+          resume = true;
+        else if (std::strcmp(&argv[i][2], "incremental") == 0)
+          incremental = true;
         else if (std::strcmp(&argv[i][2], "authors") == 0)
           authors_file = argv[++i];
         else if (std::strcmp(&argv[i][2], "branches") == 0)
           branches_file = argv[++i];
         else if (std::strcmp(&argv[i][2], "modules") == 0)
           modules_file = argv[++i];
+        else if (std::strcmp(&argv[i][2], "jobs") == 0)
+          opts.jobs = std::atoi(argv[++i]);
+        else if (std::strcmp(&argv[i][2], "loose-objects") == 0)
+          opts.loose = true;
+        else if (std::strcmp(&argv[i][2], "pack-size") == 0)
+          opts.pack_size = lexical_cast<int>(argv[++i]);
+        else if (std::strcmp(&argv[i][2], "fast-import") == 0)
+          opts.fast_import = true;
+        else if (std::strcmp(&argv[i][2], "fast-import-output") == 0) {
+          opts.fast_import = true;
+          opts.fast_import_output = argv[++i];
+        }
         else if (std::strcmp(&argv[i][2], "gc") == 0)
           opts.collect = lexical_cast<int>(argv[++i]);
       }
@@ -186,6 +385,8 @@ int main(int argc, char *argv[])
         branches_file = argv[++i];
       else if (std::strcmp(&argv[i][1], "M") == 0)
         modules_file = argv[++i];
+      else if (std::strcmp(&argv[i][1], "j") == 0)
+        opts.jobs = std::atoi(argv[++i]);
     } else {
       args.push_back(argv[i]);
     }
@@ -200,6 +401,9 @@ int main(int argc, char *argv[])
     return 1;
   }
 
+  if (opts.stats || opts.stats_json || opts.stats_every > 0)
+    Stats::enable();
+
   std::string cmd(args[0]);
 
   if (cmd == "git-test") {
@@ -244,7 +448,7 @@ int main(int argc, char *argv[])
   }
 
   try {
-    SvnDump::File dump(args[1]);
+    SvnDump::File dump(args[1], map_file, use_index);
 
     if (cmd == "print") {
       SvnDump::FilePrinter printer(dump);
@@ -257,11 +461,56 @@ int main(int argc, char *argv[])
     else if (cmd == "branches") {
       invoke_scanner<Branches>(dump);
     }
+    else if (cmd == "analyze") {
+      // Gather authors and branches in one pass, writing them to the
+      // given files, or else one after the other.
+      StatusDisplay status(std::cerr, opts, "Analyzing");
+      Options       quiet(opts);
+      quiet.quiet = true;
+      StatusDisplay authors_status(std::cerr, quiet);
+
+      Authors  authors(authors_status);
+      Branches branches(status);
+
+#ifdef USE_THREADS
+      unsigned workers = opts.jobs > 0 ? opts.jobs
+                                       : thread::hardware_concurrency();
+      if (workers > 1 && dump.has_index() &&
+          dump.get_index().get_entries().size() > workers)
+        analyze_ranges(dump, args[1], map_file, workers, authors, branches);
+      else
+#endif
+        analyze_nodes(dump, authors, branches);
+      status.finish();
+
+      if (args.size() > 2) {
+        filesystem::ofstream out(args[2]);
+        authors.write(out);
+      } else {
+        status.out << "# Authors\n";
+        authors.write(status.out);
+      }
+      if (args.size() > 3) {
+        filesystem::ofstream out(args[3]);
+        branches.write(out);
+      } else {
+        status.out << "# Branches\n";
+        branches.write(status.out);
+      }
+    }
     else if (cmd == "convert") {
-      StatusDisplay status(std::cerr, opts);
+      // The log is written out on a thread of its own, so that the
+      // conversion doesn't wait on the terminal.
+      LogSink       log_sink(std::cerr);
+      std::ostream  log(&log_sink);
+      StatusDisplay status(log, opts);
+      status.track_bytes(dump.get_offset_read(), dump.get_size());
+      dump.set_verify_report(bind(report_mismatch, cref(status), _1));
+
       ConvertRepository converter
         (args.size() == 2 ? filesystem::current_path() : args[2],
          status, opts);
+      Modules modules(converter);
 
       // Load any information provided by the user to assist with the
       // migration.
@@ -275,47 +524,143 @@ int main(int argc, char *argv[])
           filesystem::is_regular_file(branches_file))
         errors += Branches::load_branches(branches_file, converter, status);
 
+      if (! modules_file.empty())
+        errors += modules.load_modules(modules_file, status);
+
+      // Spilled trees are read back from the object database, which
+      // git fast-import does not let us see until it is finished.
+      if (opts.fast_import && opts.spill_after)
+        status.error("--spill-after cannot be used with --fast-import");
+
+      // Carry on from where an earlier conversion into this repository
+      // left off, or from the last checkpoint, if asked to.  The copies
+      // still to come are found again by any scan below, just as they
+      // would be with --start.
+      if (opts.fast_import || ! modules.empty()) {
+        if (resume || incremental || opts.checkpoint)
+          status.error("--checkpoint, --resume and --incremental cannot be "
+                       "used with --fast-import or --modules");
+      } else {
+        if (start != -1 && ! resume && ! incremental)
+          converter.rev_tree_ids_complete = false;
+
+        if (incremental) {
+          start = converter.load_refs();
+          if (start == -1)
+            status.error("There is no converted history to continue from");
+        }
+
+        if (resume) {
+          int resume_rev = converter.resume();
+          if (resume_rev == -1) {
+            status.warn("There is no checkpoint to resume from");
+          } else {
+            start = resume_rev;
+            if (single_pass || ! skip_preflight) {
+              converter.copy_from.clear();
+              converter.copy_sources.clear();
+              converter.copies_known = false;
+            }
+          }
+        }
+
+        if (incremental)
+          converter.load_rev_tree_ids();
+      }
+
       // Validate this information as much as possible before possibly
       // wasting the user's time with useless work.
 
-      if (! skip_preflight) {
+      // If the dump has been indexed, jump straight to the first
+      // revision of interest rather than reading up to it.
+      if (start != -1)
+        dump.seek(start);
+
+      if (single_pass) {
+        // Rather than a full preflight scan, learn which revisions copy
+        // from which from the revision index, or failing that from a
+        // pass over the node headers alone.  Everything else is checked
+        // as each node is converted.
+        if (errors > 0) {
+          status.warn("Please correct the errors listed above and run again.");
+          return 1;
+        }
+
+        // Standard input can only be read once, so there is no way to
+        // know ahead of time which trees are copied from later; they
+        // must all be kept, just as with --skip.
+        if (dump.can_rewind() && ! dump.has_index()) {
+          status.verb = "Indexing";
+          while (dump.read_next(/* ignore_text= */ true)) {
+            int rev = dump.get_rev_nr();
+            if (cutoff != -1 && rev >= cutoff)
+              break;
+
+            SvnDump::File::Node& node(dump.get_curr_node());
+            if (node.has_copy_from() && (start == -1 || rev >= start))
+              converter.add_copy_from(rev, node.get_copy_from_rev());
+          }
+          dump.rewind();
+          if (start != -1)
+            dump.seek(start);
+        }
+        else {
+          const SvnDump::Index::copy_from_vector& copies
+            (dump.get_index().get_copy_from());
+          for (SvnDump::Index::copy_from_vector::const_iterator
+                 i = copies.begin();
+               i != copies.end();
+               ++i) {
+            if ((start == -1 || (*i).first >= start) &&
+                (cutoff == -1 || (*i).first < cutoff))
+              converter.add_copy_from((*i).first, (*i).second);
+          }
+        }
+
+        if (dump.can_rewind())
+          converter.plan_copies();
+        converter.opts.validate = true;
+      }
+      else if (! skip_preflight) {
         status.verb = "Scanning";
 
 #ifdef USE_THREADS
-        concurrent_queue<SvnDump::File::Node> prescan_queue;
-        thread svndump_scanner(read_all_nodes, &dump, &prescan_queue,
-                               /* ignore_text= */ false,
-                               /* verify=      */ true,
-                               start, cutoff);
-
-        SvnDump::File::Node node;
-        while (prescan_queue.pop(node)) {
+        NodeReader scanner(dump, /* ignore_text= */ false,
+                           /* verify=      */ true, start, cutoff);
+
+        SvnDump::NodeQueue::batch_type batch;
+        while (scanner.pop(batch)) {
+          int final_rev = dump.get_last_rev_nr();
+          if (cutoff != -1 && cutoff < final_rev)
+            final_rev = cutoff;
+
+          status.set_final_rev(final_rev);
+
+          for (SvnDump::File::Node& node : batch)
+            errors += converter.prescan(node);
+        }
+        status.newline();
+        scanner.finish(status);
 #else
         while (dump.read_next(/* ignore_text= */ false,
                               /* verify=      */ true)) {
-#endif
           int final_rev = dump.get_last_rev_nr();
           if (cutoff != -1 && cutoff < final_rev)
             final_rev = cutoff;
 
           status.set_final_rev(final_rev);
 
-#ifndef USE_THREADS
           int rev = dump.get_rev_nr();
           if (cutoff != -1 && rev >= cutoff)
             break;
           if (start == -1 || rev >= start)
             errors += converter.prescan(dump.get_curr_node());
-#else
-          errors += converter.prescan(node);
-#endif
         }
         status.newline();
-#ifdef USE_THREADS
-        svndump_scanner.join();
 #endif
+        errors += static_cast<int>(dump.finish_verify());
 
-        converter.copy_from.sort(comparator());
+        converter.plan_copies();
 
         if (status.debug_mode()) {
           for (ConvertRepository::copy_from_list::iterator
@@ -335,48 +680,82 @@ int main(int argc, char *argv[])
         status.warn("Note: --skip can be used to skip this pre-scan.");
 
         dump.rewind();
+        if (start != -1)
+          dump.seek(start);
       }
 
       // If everything passed the preflight, perform the conversion.
       status.verb = "Converting";
 
+      if (! modules.empty()) {
+        modules.start();
+      }
+      else if (opts.checkpoint && ! opts.fast_import) {
+        // A checkpoint can be taken at the end of any revision, so on
+        // being asked to stop, finish the current one and save one.
+        // Ctrl-C is treated like SIGTERM, being how a conversion run
+        // from a terminal is usually stopped.
+        std::signal(SIGTERM, interrupt_conversion);
+        std::signal(SIGINT, interrupt_conversion);
+      }
+
 #ifdef USE_THREADS
-      concurrent_queue<SvnDump::File::Node> queue;
-      thread svndump_reader(read_all_nodes, &dump, &queue,
-                            /* ignore_text= */ false,
-                            /* verify=      */ false,
-                            start, cutoff);
-
-      SvnDump::File::Node node;
-      while (queue.pop(node)) {
+      NodeReader reader(dump, /* ignore_text= */ false,
+                        /* verify=      */ false, start, cutoff);
+
+      SvnDump::NodeQueue::batch_type batch;
+      while (reader.pop(batch)) {
+        int final_rev = dump.get_last_rev_nr();
+        if (cutoff != -1 && cutoff < final_rev)
+          final_rev = cutoff;
+
+        status.set_final_rev(final_rev);
+
+        if (modules.empty()) {
+          for (SvnDump::File::Node& node : batch)
+            converter(node);
+          continue;
+        }
+
+        // The modules read the batch from threads of their own, so
+        // rather than being recycled it lives until they are done.
+        Modules::batch_ptr shared(new SvnDump::NodeQueue::batch_type);
+        shared->swap(batch);
+        for (std::size_t i = 0; i < shared->size(); ++i) {
+          converter((*shared)[i]);
+          modules.route((*shared)[i], i);
+        }
+        modules.submit(shared);
+      }
+      reader.finish(status);
 #else
       while (dump.read_next(/* ignore_text= */ false)) {
-#endif
         int final_rev = dump.get_last_rev_nr();
         if (cutoff != -1 && cutoff < final_rev)
           final_rev = cutoff;
 
         status.set_final_rev(final_rev);
 
-#ifndef USE_THREADS
         int rev = dump.get_rev_nr();
         if (cutoff != -1 && rev >= cutoff)
           break;
-        if (start == -1 || rev >= start)
+        if (start == -1 || rev >= start) {
           converter(dump.get_curr_node());
-        else
+          if (! modules.empty())
+            modules.route(dump.get_curr_node());
+        } else {
           status.update(rev);
-#else
-        converter(node);
-#endif
+        }
       }
-      converter.finish();
-#ifdef USE_THREADS
-      svndump_reader.join();
 #endif
+      if (! modules.empty())
+        modules.finish();
+      converter.finish();
     }
     else if (cmd == "scan") {
       StatusDisplay status(std::cerr, opts);
+      status.track_bytes(dump.get_offset_read(), dump.get_size());
+      dump.set_verify_report(bind(report_mismatch, cref(status), _1));
       while (dump.read_next(/* ignore_text= */ !verify,
                             /* verify=      */ verify)) {
         status.set_final_rev(dump.get_last_rev_nr());
@@ -385,6 +764,12 @@ int main(int argc, char *argv[])
       }
       if (opts.verbose)
         status.finish();
+
+      if (verify) {
+        if (std::size_t failures = dump.finish_verify())
+          status.error(lexical_cast<std::string>(failures) +
+                       " node texts failed checksum verification");
+      }
     }
   }
   catch (const std::exception& err) {
@@ -0,0 +1,542 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "modules.h"
+
+#ifndef ASSERTS
+#undef assert
+#define assert(x)
+#endif
+
+namespace {
+  /**
+   * If the segments of `prefix' begin `pathname', set `rest' to those of
+   * `pathname' which follow them.
+   */
+  bool strip_prefix(const filesystem::path& prefix,
+                    const filesystem::path& pathname,
+                    filesystem::path&       rest)
+  {
+    filesystem::path::iterator p = prefix.begin();
+    filesystem::path::iterator i = pathname.begin();
+    for (; p != prefix.end(); ++p, ++i)
+      if (i == pathname.end() || *p != *i)
+        return false;
+
+    rest.clear();
+    for (; i != pathname.end(); ++i)
+      rest /= *i;
+    return true;
+  }
+
+  /**
+   * Hands each line written by a module's converter to standard error
+   * whole, so that the lines of modules on different threads cannot run
+   * into one another.
+   */
+  class LineBuffer : public std::stringbuf
+  {
+#ifdef USE_THREADS
+    static mutex output_mutex;
+#endif
+
+  protected:
+    virtual int sync() {
+#ifdef USE_THREADS
+      mutex::scoped_lock lock(output_mutex);
+#endif
+      std::string lines(str());
+      std::fwrite(lines.data(), 1, lines.length(), stderr);
+      std::fflush(stderr);
+      str(std::string());
+      return 0;
+    }
+  };
+
+#ifdef USE_THREADS
+  mutex LineBuffer::output_mutex;
+#endif
+}
+
+bool Module::Mapping::covers(const filesystem::path& subpath,
+                             filesystem::path&       rest) const
+{
+  return strip_prefix(source, subpath, rest) && (directory || rest.empty());
+}
+
+bool Module::Mapping::is_within(const filesystem::path& subpath) const
+{
+  filesystem::path rest;
+  return strip_prefix(subpath, source, rest) && ! rest.empty();
+}
+
+const Module::Mapping *
+Module::find_mapping(const filesystem::path& subpath,
+                     filesystem::path&       rest) const
+{
+  const Mapping *  found = nullptr;
+  filesystem::path found_rest;
+
+  for (const Mapping& mapping : mappings) {
+    filesystem::path mapping_rest;
+    if (mapping.covers(subpath, mapping_rest) &&
+        (! found ||
+         mapping.source.string().length() > found->source.string().length())) {
+      found      = &mapping;
+      found_rest = mapping_rest;
+    }
+  }
+
+  if (found)
+    rest = found_rest;
+  return found;
+}
+
+Modules::~Modules()
+{
+#ifdef USE_THREADS
+  { mutex::scoped_lock lock(queues_mutex);
+    stopping = true;
+    for (std::deque<Work>& queue : queues)
+      queue.clear();
+  }
+  work_available.notify_all();
+  workers.join_all();
+#endif
+}
+
+/**
+ * Read the manifest at `pathname'.  Each problem found is reported as a
+ * warning, and the number of them returned.
+ */
+int Modules::load_modules(const filesystem::path& pathname,
+                          StatusDisplay&          status)
+{
+  int errors = 0;
+
+  static const int MAX_LINE = 8192;
+  char linebuf[MAX_LINE + 1];
+
+  filesystem::ifstream in(pathname);
+
+  int module = NO_MODULE;
+  int lineno = 0;
+
+  while (in.good() && ! in.eof()) {
+    in.getline(linebuf, MAX_LINE);
+    ++lineno;
+
+    std::string line(linebuf);
+    trim(line);
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    std::ostringstream where;
+    where << pathname.string() << ":" << lineno << ": ";
+
+    if (line[0] == '[' && line[line.length() - 1] == ']') {
+      std::string name(line, 1, line.length() - 2);
+      trim(name);
+      if (name == "<ignore>") {
+        module = IGNORED;
+      } else {
+        module = static_cast<int>(modules.size());
+        modules.push_back(Module());
+        modules.back().name = name;
+      }
+      continue;
+    }
+
+    std::string::size_type colon = line.find(':');
+    if (colon == std::string::npos || module == NO_MODULE) {
+      status.warn(where.str() + "Expected a module, or a mapping for one");
+      ++errors;
+      continue;
+    }
+
+    std::string source(line, 0, colon);
+    std::string target(line, colon + 1);
+    trim(source);
+    trim(target);
+
+    bool directory = ends_with(source, "/");
+    while (ends_with(source, "/"))
+      source.erase(source.length() - 1);
+    while (ends_with(target, "/"))
+      target.erase(target.length() - 1);
+    if (target == ".")
+      target.clear();
+
+    if (source.empty()) {
+      status.warn(where.str() + "A mapping needs a source path");
+      ++errors;
+      continue;
+    }
+
+    int owner = (module == IGNORED || target == "<ignore>") ? IGNORED : module;
+    if (! add_mapping(source, owner, directory)) {
+      status.warn(where.str() + "Path mapped more than once: " + source);
+      ++errors;
+      continue;
+    }
+
+    if (owner != IGNORED) {
+      Module::Mapping mapping;
+      mapping.source    = source;
+      mapping.target    = target;
+      mapping.directory = directory;
+      modules[static_cast<std::size_t>(owner)].mappings.push_back(mapping);
+    }
+  }
+
+  return errors;
+}
+
+bool Modules::add_mapping(const filesystem::path& source, int module,
+                          bool directory)
+{
+  TrieNode * node = &root;
+  for (filesystem::path::iterator segment = source.begin();
+       segment != source.end();
+       ++segment) {
+    if (module >= 0 &&
+        (node->below.empty() ||
+         node->below.back() != static_cast<std::size_t>(module)))
+      node->below.push_back(static_cast<std::size_t>(module));
+
+    shared_ptr<TrieNode>& child(node->children[(*segment).string()]);
+    if (! child)
+      child.reset(new TrieNode);
+    node = child.get();
+  }
+
+  if (node->module != NO_MODULE)
+    return false;
+
+  node->module    = module;
+  node->directory = directory;
+  if (module >= 0 &&
+      (node->below.empty() ||
+       node->below.back() != static_cast<std::size_t>(module)))
+    node->below.push_back(static_cast<std::size_t>(module));
+  return true;
+}
+
+/**
+ * Find the modules which need a change at `pathname': the one whose
+ * mapping most closely covers it, and any mapping paths within it.  The
+ * modules are found in ascending order.
+ */
+void Modules::find_modules(const filesystem::path&   pathname,
+                           std::vector<std::size_t>& found) const
+{
+  found.clear();
+
+  // Mappings are relative to the root of each branch.  Look for the
+  // branch directly, since a path outside of every branch is not an
+  // error here; the flat conversion will have reported it already.
+  Git::BranchPtr branch(flat.repository->find_branch_within(pathname));
+  if (! branch)
+    return;
+
+  filesystem::path subpath;
+  strip_prefix(branch->prefix, pathname, subpath);
+
+  const TrieNode * node    = &root;
+  int              matched = NO_MODULE;
+
+  for (filesystem::path::iterator segment = subpath.begin();
+       segment != subpath.end();
+       ++segment) {
+    if (node->directory)
+      matched = node->module;
+
+    TrieNode::children_map::const_iterator i =
+      node->children.find((*segment).string());
+    if (i == node->children.end()) {
+      node = nullptr;
+      break;
+    }
+    node = (*i).second.get();
+  }
+
+  if (node) {
+    if (node->module != NO_MODULE)
+      matched = node->module;
+    found = node->below;
+  }
+
+  if (matched >= 0) {
+    std::size_t module = static_cast<std::size_t>(matched);
+    std::vector<std::size_t>::iterator i =
+      std::lower_bound(found.begin(), found.end(), module);
+    if (i == found.end() || *i != module)
+      found.insert(i, module);
+  }
+}
+
+void Modules::start()
+{
+  if (flat.opts.fast_import)
+    flat.status.error("Modules cannot be converted with --fast-import");
+
+  filesystem::path modules_dir
+    (filesystem::path(git_repository_path(*flat.repository)) / "modules");
+
+  Options opts(flat.opts);
+  opts.quiet    = true;
+  opts.validate = false;
+  opts.jobs     = 1;            // the modules are the unit of parallelism
+
+  for (Module& module : modules) {
+    filesystem::path pathname(modules_dir / module.name);
+    if (! filesystem::is_directory(pathname / "objects")) {
+      filesystem::create_directories(pathname);
+
+      git_repository * repo;
+      Git::git_check(git_repository_init(&repo, pathname.string().c_str(),
+                                         /* is_bare= */ 1));
+      git_repository_free(repo);
+    }
+
+    module.log_buffer.reset(new LineBuffer);
+    module.log.reset(new std::ostream(module.log_buffer.get()));
+    module.status.reset(new StatusDisplay(*module.log, opts));
+    module.converter.reset(new ConvertRepository(pathname, *module.status,
+                                                 opts));
+
+    ConvertRepository& converter(*module.converter);
+    converter.module                = &module;
+    converter.repository->repo_name = module.name;
+    converter.authors.authors       = flat.authors.authors;
+    converter.copy_from             = flat.copy_from;
+    if (flat.copies_known)
+      converter.plan_copies();
+
+    for (const Git::Repository::branches_path_value& value :
+           flat.repository->branches_by_path) {
+      const Git::BranchPtr& from(value.second);
+      Git::BranchPtr branch(new Git::Branch(converter.repository, from->name,
+                                            from->is_tag));
+      branch->prefix = from->prefix;
+
+      converter.repository->find_branch_by_path
+        (value.first,
+         converter.repository->find_branch_by_name(branch->name, branch));
+    }
+  }
+
+#ifdef USE_THREADS
+  std::size_t threads = flat.opts.jobs > 0 ?
+    static_cast<std::size_t>(flat.opts.jobs) : thread::hardware_concurrency();
+  if (threads > modules.size())
+    threads = modules.size();
+  if (threads < 1)
+    threads = 1;
+
+  routed.resize(threads);
+  queues.resize(threads);
+  for (std::size_t worker = 0; worker < threads; ++worker)
+    workers.create_thread(bind(&Modules::work, this, worker));
+
+  std::ostringstream buf;
+  buf << "Converting " << modules.size() << " modules on " << threads
+      << " threads";
+  flat.status.info(buf.str());
+#endif
+}
+
+void Modules::route(SvnDump::File::Node& node, std::size_t index)
+{
+  const filesystem::path& pathname(node.get_path());
+  if (pathname.empty())
+    return;
+
+  find_modules(pathname, targets);
+  if (targets.empty())
+    return;
+
+  SvnDump::File::Node::Kind   kind   = node.get_kind();
+  SvnDump::File::Node::Action action = node.get_action();
+
+  bool copies = (node.has_copy_from() &&
+                 ((kind == SvnDump::File::Node::KIND_FILE &&
+                   (action == SvnDump::File::Node::ACTION_ADD ||
+                    action == SvnDump::File::Node::ACTION_CHANGE)) ||
+                  (kind == SvnDump::File::Node::KIND_DIR &&
+                   action == SvnDump::File::Node::ACTION_ADD)));
+  if (copies)
+    find_modules(node.get_copy_from_path(), sources);
+
+  files_ptr files;
+  for (std::size_t module : targets) {
+    Task task(module, index, nullptr);
+
+    if (copies &&
+        ! std::binary_search(sources.begin(), sources.end(), module)) {
+      if (! files) {
+        shared_ptr<ConvertRepository::imported_files>
+          collected(new ConvertRepository::imported_files);
+        flat.collect_files(flat.current_object(pathname), filesystem::path(),
+                           *collected);
+        files = collected;
+      }
+      if (files->empty())
+        continue;
+      task.files = files;
+    }
+
+#ifdef USE_THREADS
+    routed[module % routed.size()].push_back(task);
+#else
+    run(task, node);
+#endif
+  }
+}
+
+void Modules::run(const Task& task, SvnDump::File::Node& node)
+{
+  ConvertRepository& converter(*modules[task.module].converter);
+  if (task.files)
+    converter.import_files(node, *task.files);
+  else
+    converter(node);
+}
+
+#ifdef USE_THREADS
+
+/**
+ * Queue up the nodes routed since the last call, all of which are in
+ * `batch'.  If a module has failed, its error is thrown here.
+ */
+void Modules::submit(const batch_ptr& batch)
+{
+  for (std::size_t worker = 0; worker < routed.size(); ++worker) {
+    if (routed[worker].empty())
+      continue;
+
+    Work work;
+    work.batch = batch;
+    work.tasks.swap(routed[worker]);
+    push(worker, work);
+  }
+}
+
+void Modules::push(std::size_t worker, Work& work)
+{
+  { mutex::scoped_lock lock(queues_mutex);
+
+    while (queues[worker].size() >= MAX_QUEUED && ! error)
+      work_taken.wait(lock);
+    if (error)
+      std::rethrow_exception(error);
+
+    queues[worker].push_back(Work());
+    queues[worker].back().batch.swap(work.batch);
+    queues[worker].back().tasks.swap(work.tasks);
+  }
+  work_available.notify_all();
+}
+
+void Modules::work(std::size_t worker)
+{
+  for (;;) {
+    Work work;
+    bool failed;
+
+    { mutex::scoped_lock lock(queues_mutex);
+
+      while (queues[worker].empty() && ! stopping)
+        work_available.wait(lock);
+
+      if (queues[worker].empty())
+        return;
+
+      work.batch.swap(queues[worker].front().batch);
+      work.tasks.swap(queues[worker].front().tasks);
+      queues[worker].pop_front();
+
+      failed = static_cast<bool>(error);
+    }
+    work_taken.notify_all();
+
+    // Once any module has failed, the rest of the work is only drained.
+    if (failed)
+      continue;
+
+    try {
+      if (work.batch) {
+        for (const Task& task : work.tasks)
+          run(task, (*work.batch)[task.node]);
+      } else {
+        for (std::size_t module = worker;
+             module < modules.size();
+             module += queues.size())
+          modules[module].converter->finish();
+      }
+    }
+    catch (...) {
+      { mutex::scoped_lock lock(queues_mutex);
+        if (! error)
+          error = std::current_exception();
+      }
+      work_taken.notify_all();
+    }
+  }
+}
+
+#endif // USE_THREADS
+
+void Modules::finish()
+{
+#ifdef USE_THREADS
+  for (std::size_t worker = 0; worker < queues.size(); ++worker) {
+    Work work;
+    push(worker, work);
+  }
+
+  { mutex::scoped_lock lock(queues_mutex);
+    stopping = true;
+  }
+  work_available.notify_all();
+  workers.join_all();
+
+  if (error)
+    std::rethrow_exception(error);
+#else
+  for (Module& module : modules)
+    module.converter->finish();
+#endif
+
+  for (const Module& module : modules)
+    flat.status.info(std::string("Wrote module ") + module.name);
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MODULES_H
+#define _MODULES_H
+
+#include "converter.h"
+#include "nodequeue.h"
+
+/**
+ * One of the repositories named by a modules manifest (see
+ * doc/modules.txt), along with the parts of every branch which go into
+ * it, and the converter which builds it.
+ */
+struct Module
+{
+  struct Mapping
+  {
+    filesystem::path source;    // relative to the root of a branch
+    filesystem::path target;    // relative to the module's root
+    bool             directory; // or else a single file
+
+    /**
+     * Is `subpath' the source of this mapping, or within it?  If so,
+     * `rest' is set to the part of it below the source.
+     */
+    bool covers(const filesystem::path& subpath,
+                filesystem::path& rest) const;
+
+    /**
+     * Is the source of this mapping below `subpath', which is thus a
+     * directory holding the whole of it?
+     */
+    bool is_within(const filesystem::path& subpath) const;
+  };
+
+  typedef std::vector<Mapping> mappings_vector;
+
+  std::string                   name;
+  mappings_vector               mappings;
+  shared_ptr<std::streambuf>    log_buffer;
+  shared_ptr<std::ostream>      log;
+  shared_ptr<StatusDisplay>     status;
+  shared_ptr<ConvertRepository> converter;
+
+  /**
+   * Find the mapping which most closely covers `subpath', if any.
+   */
+  const Mapping * find_mapping(const filesystem::path& subpath,
+                               filesystem::path& rest) const;
+};
+
+/**
+ * Converts every module of a manifest into a repository of its own,
+ * alongside the flat conversion and from the same reading of the dump.
+ * Each node, once the flat converter has seen it, is routed by a trie of
+ * the manifest's paths (relative to the node's branch) to the modules
+ * which need it.  With USE_THREADS, the modules are shared out among a
+ * fixed pool of threads, each module always converted by the same one,
+ * so that it sees its nodes in order; the batches those nodes live in
+ * are kept alive until the last module has finished with them.
+ *
+ * A copy into a module from a path which was routed elsewhere has
+ * nothing to copy from in the module's own history, so the files the
+ * flat conversion found at the copy's destination are passed along
+ * with it instead.
+ */
+class Modules : public noncopyable
+{
+public:
+  typedef std::vector<Module> modules_vector;
+
+#ifdef USE_THREADS
+  typedef shared_ptr<SvnDump::NodeQueue::batch_type> batch_ptr;
+#endif
+
+private:
+  enum {
+    NO_MODULE = -1,
+    IGNORED   = -2
+  };
+
+  struct TrieNode
+  {
+    typedef std::map<std::string, shared_ptr<TrieNode>> children_map;
+
+    children_map             children;
+    int                      module;    // whose mapping ends here, if any
+    bool                     directory;
+    std::vector<std::size_t> below;     // modules mapping here or beneath
+
+    TrieNode() : module(NO_MODULE), directory(false) {}
+  };
+
+  typedef shared_ptr<const ConvertRepository::imported_files> files_ptr;
+
+  struct Task
+  {
+    std::size_t module;
+    std::size_t node;           // within its batch
+    files_ptr   files;          // for a copy from outside the module
+
+    Task(std::size_t _module, std::size_t _node, files_ptr _files)
+      : module(_module), node(_node), files(_files) {}
+  };
+
+  typedef std::vector<Task> tasks_vector;
+
+  ConvertRepository&       flat;
+  modules_vector           modules;
+  TrieNode                 root;
+  std::vector<std::size_t> targets;
+  std::vector<std::size_t> sources;
+
+#ifdef USE_THREADS
+  static const std::size_t MAX_QUEUED = 8; // batches waiting per thread
+
+  // A batch of null asks the thread to finish its modules.
+  struct Work
+  {
+    batch_ptr    batch;
+    tasks_vector tasks;
+  };
+
+  std::vector<tasks_vector>     routed; // by thread, for the next batch
+  std::vector<std::deque<Work>> queues;
+  std::exception_ptr            error;
+  bool                          stopping;
+  mutex                         queues_mutex;
+  condition_variable            work_available;
+  condition_variable            work_taken;
+  thread_group                  workers;
+
+  void work(std::size_t worker);
+  void push(std::size_t worker, Work& work);
+#endif
+
+  bool add_mapping(const filesystem::path& source, int module,
+                   bool directory);
+  void find_modules(const filesystem::path&   pathname,
+                    std::vector<std::size_t>& found) const;
+  void run(const Task& task, SvnDump::File::Node& node);
+
+public:
+  Modules(ConvertRepository& _flat) : flat(_flat)
+#ifdef USE_THREADS
+    , stopping(false)
+#endif
+  {}
+  ~Modules();
+
+  bool empty() const {
+    return modules.empty();
+  }
+
+  int load_modules(const filesystem::path& pathname, StatusDisplay& status);
+
+  /**
+   * Create (or open) the modules' repositories, beneath the flat one,
+   * and their converters.  The flat converter's authors, branches and
+   * copy-from reservations must be complete by now, as each module
+   * takes a copy of them.
+   */
+  void start();
+
+  /**
+   * Hand `node', which the flat converter has just converted, to the
+   * modules which need it.  With USE_THREADS `index' is its place in
+   * the batch later given to submit(); otherwise it is converted at
+   * once.
+   */
+  void route(SvnDump::File::Node& node, std::size_t index = 0);
+
+#ifdef USE_THREADS
+  void submit(const batch_ptr& batch);
+#endif
+
+  void finish();
+};
+
+#endif // _MODULES_H
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "nodequeue.h"
+
+#ifndef ASSERTS
+#undef assert
+#define assert(x)
+#endif
+
+#ifdef USE_THREADS
+
+namespace SvnDump {
+
+bool NodeQueue::push(batch_type& batch, std::size_t batch_bytes)
+{
+  { mutex::scoped_lock lock(the_mutex);
+
+    if (count == slots.size() ||
+        (count > 0 && bytes + batch_bytes > max_bytes)) {
+      ++stats.producer_waits;
+      do {
+        if (cancelled)
+          return false;
+        not_full.wait(lock);
+      } while (count == slots.size() ||
+               (count > 0 && bytes + batch_bytes > max_bytes));
+    }
+    if (cancelled)
+      return false;
+
+    std::size_t tail = (head + count) % slots.size();
+    slots[tail].swap(batch);
+    slot_bytes[tail] = batch_bytes;
+
+    ++count;
+    bytes += batch_bytes;
+
+    ++stats.batches;
+    stats.nodes += slots[tail].size();
+    if (count > stats.peak_batches)
+      stats.peak_batches = count;
+    if (bytes > stats.peak_bytes)
+      stats.peak_bytes = bytes;
+  }
+  not_empty.notify_one();
+
+  // Whatever was swapped out of the slot was emptied by pop, so only
+  // its storage is left.
+  assert(batch.empty());
+  return true;
+}
+
+bool NodeQueue::pop(batch_type& batch)
+{
+  // Run the destructors of the previous batch's nodes outside the lock.
+  batch.clear();
+
+  { mutex::scoped_lock lock(the_mutex);
+
+    if (count == 0 && ! closed) {
+      ++stats.consumer_waits;
+      do {
+        not_empty.wait(lock);
+      } while (count == 0 && ! closed);
+    }
+    if (count == 0)
+      return false;
+
+    slots[head].swap(batch);
+    bytes -= slot_bytes[head];
+
+    head = (head + 1) % slots.size();
+    --count;
+  }
+  not_full.notify_one();
+  return true;
+}
+
+void NodeQueue::close()
+{
+  { mutex::scoped_lock lock(the_mutex);
+    closed = true;
+  }
+  not_empty.notify_one();
+}
+
+void NodeQueue::cancel()
+{
+  { mutex::scoped_lock lock(the_mutex);
+    cancelled = true;
+  }
+  not_full.notify_one();
+}
+
+} // namespace SvnDump
+
+#endif // USE_THREADS
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _NODEQUEUE_H
+#define _NODEQUEUE_H
+
+#include "svndump.h"
+
+#ifdef USE_THREADS
+
+namespace SvnDump
+{
+  /**
+   * Hands nodes from the thread reading the dump to the thread
+   * converting it.  Nodes travel in batches, normally all the nodes of
+   * one revision, so the lock is taken once per batch rather than once
+   * per node.  Batches are swapped in and out of a fixed ring of slots,
+   * which lets their storage be reused rather than reallocated.
+   *
+   * The queue is bounded both by a number of batches and by an estimate
+   * of the memory they hold; when either is reached the reader blocks
+   * until the converter catches up.  A single batch larger than the
+   * whole budget is still let through, alone.
+   *
+   * This is only safe with one producer and one consumer.
+   */
+  class NodeQueue : public noncopyable
+  {
+  public:
+    typedef std::vector<File::Node> batch_type;
+
+    struct Stats {
+      std::size_t batches;
+      std::size_t nodes;
+      std::size_t peak_batches;
+      std::size_t peak_bytes;
+      std::size_t producer_waits;   // times the reader found it full
+      std::size_t consumer_waits;   // times the converter found it empty
+
+      Stats() : batches(0), nodes(0), peak_batches(0), peak_bytes(0),
+                producer_waits(0), consumer_waits(0) {}
+    };
+
+  private:
+    std::vector<batch_type>  slots;
+    std::vector<std::size_t> slot_bytes;
+    std::size_t              head;      // next slot to pop
+    std::size_t              count;     // slots in use
+    std::size_t              bytes;     // held by the slots in use
+    std::size_t              max_bytes;
+    bool                     closed;
+    bool                     cancelled;
+    Stats                    stats;
+
+    mutable mutex      the_mutex;
+    condition_variable not_empty;
+    condition_variable not_full;
+
+  public:
+    NodeQueue(std::size_t capacity   = 64,
+              std::size_t _max_bytes = 256 * 1024 * 1024)
+      : slots(capacity), slot_bytes(capacity), head(0), count(0), bytes(0),
+        max_bytes(_max_bytes), closed(false), cancelled(false) {}
+
+    std::size_t get_max_bytes() const {
+      return max_bytes;
+    }
+
+    /**
+     * Hand over `batch', which is left empty (but with storage ready
+     * for reuse).  Blocks while the queue is full.  Returns false if
+     * the consumer has gone away, in which case the producer should
+     * stop.
+     */
+    bool push(batch_type& batch, std::size_t batch_bytes);
+
+    /**
+     * Take the next batch into `batch', whose previous contents are
+     * discarded.  Blocks while the queue is empty; returns false once
+     * it is empty and closed.
+     */
+    bool pop(batch_type& batch);
+
+    /**
+     * Called by the producer when there is nothing more to push.
+     */
+    void close();
+
+    /**
+     * Called by the consumer if it stops early, to release a blocked
+     * producer.
+     */
+    void cancel();
+
+    Stats get_stats() const {
+      mutex::scoped_lock lock(the_mutex);
+      return stats;
+    }
+  };
+}
+
+#endif // USE_THREADS
+
+#endif // _NODEQUEUE_H
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "objectpool.h"
+
+#ifndef ASSERTS
+#undef assert
+#define assert(x)
+#endif
+
+namespace Git {
+
+#ifdef USE_THREADS
+thread_local ObjectPool::Pool * ObjectPool::local;
+mutex                           ObjectPool::pools_mutex;
+#else
+ObjectPool::Pool *              ObjectPool::local;
+#endif
+std::vector<ObjectPool::Pool *> ObjectPool::pools;
+
+void ObjectPool::add_pool()
+{
+  local = new Pool();
+
+#ifdef USE_THREADS
+  mutex::scoped_lock lock(pools_mutex);
+#endif
+  pools.push_back(local);
+}
+
+void ObjectPool::refill(SizeClass& size_class, std::size_t slot_size)
+{
+  size_class.next = static_cast<char *>(::operator new(BLOCK_SIZE));
+  size_class.end  = size_class.next + BLOCK_SIZE / slot_size * slot_size;
+  add(size_class.blocks, 1);
+}
+
+void * ObjectPool::allocate(std::size_t size)
+{
+  std::size_t index = (size + GRANULE - 1) / GRANULE;
+
+  Pool& pool(local_pool());
+
+  if (index == 0 || index > CLASSES) {
+    add(pool.large_allocations, 1);
+    return ::operator new(size);
+  }
+
+  SizeClass& size_class(pool.classes[index - 1]);
+
+  void * ptr;
+  if (size_class.free_list != nullptr) {
+    ptr = size_class.free_list;
+    size_class.free_list = size_class.free_list->next;
+  } else {
+    std::size_t slot_size = index * GRANULE;
+    if (size_class.next == size_class.end)
+      refill(size_class, slot_size);
+    ptr = size_class.next;
+    size_class.next += slot_size;
+  }
+
+  add(size_class.allocations, 1);
+  add(size_class.live, 1);
+  if (size_class.live > size_class.peak)
+    size_class.peak.store(size_class.live, std::memory_order_relaxed);
+  add(pool.live, 1);
+  if (pool.live > pool.peak)
+    pool.peak.store(pool.live, std::memory_order_relaxed);
+
+  return ptr;
+}
+
+void ObjectPool::deallocate(void * ptr, std::size_t size)
+{
+  if (ptr == nullptr)
+    return;
+
+  std::size_t index = (size + GRANULE - 1) / GRANULE;
+  if (index == 0 || index > CLASSES) {
+    ::operator delete(ptr);
+    return;
+  }
+
+  Pool& pool(local_pool());
+
+  SizeClass& size_class(pool.classes[index - 1]);
+  add(size_class.live, -1);
+  add(pool.live, -1);
+
+  Slot * slot = static_cast<Slot *>(ptr);
+  slot->next = size_class.free_list;
+  size_class.free_list = slot;
+}
+
+std::size_t ObjectPool::peak_objects()
+{
+#ifdef USE_THREADS
+  mutex::scoped_lock lock(pools_mutex);
+#endif
+
+  std::int64_t peak = 0;
+  for (const Pool * pool : pools)
+    peak += pool->peak;
+  return static_cast<std::size_t>(peak);
+}
+
+std::string ObjectPool::statistics()
+{
+  std::int64_t allocations = 0;
+  std::int64_t live        = 0;
+  std::int64_t blocks      = 0;
+
+  std::int64_t class_live[CLASSES] = {};
+  std::int64_t class_peak[CLASSES] = {};
+  std::int64_t class_allocations[CLASSES] = {};
+
+#ifdef USE_THREADS
+  mutex::scoped_lock lock(pools_mutex);
+#endif
+  for (const Pool * pool : pools) {
+    allocations += pool->large_allocations;
+    for (std::size_t i = 0; i < CLASSES; ++i) {
+      const SizeClass& size_class(pool->classes[i]);
+      class_allocations[i] += size_class.allocations;
+      class_live[i]        += size_class.live;
+      class_peak[i]        += size_class.peak;
+      blocks               += size_class.blocks;
+    }
+  }
+
+  std::ostringstream sizes;
+  for (std::size_t i = 0; i < CLASSES; ++i) {
+    if (class_allocations[i] == 0)
+      continue;
+
+    allocations += class_allocations[i];
+    live        += class_live[i];
+
+    sizes << (sizes.tellp() > 0 ? ", " : "") << (i + 1) * GRANULE << "B: "
+          << class_live[i] << " live of " << class_peak[i] << " peak";
+  }
+
+  std::ostringstream buf;
+  buf << "Object pool: " << allocations << " allocations, " << live
+      << " live, " << blocks * BLOCK_SIZE / 1024 << " KB reserved";
+  if (sizes.tellp() > 0)
+    buf << " (" << sizes.str() << ")";
+  return buf.str();
+}
+
+} // namespace Git
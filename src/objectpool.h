@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _OBJECTPOOL_H
+#define _OBJECTPOOL_H
+
+#include "system.hpp"
+
+using namespace boost;
+
+namespace Git
+{
+  /**
+   * Size-classed free lists from which every Git::Object is allocated,
+   * through Object's own operator new and delete.  A conversion creates
+   * and drops objects of the same few sizes by the million -- a blob per
+   * file version, a tree per directory along every changed path, a
+   * commit per branch per revision -- so carving them out of large
+   * blocks, and reusing freed slots for the next object of the same
+   * size, is both faster than the general heap and keeps snapshots
+   * freed by free_past_trees from leaving the heap fragmented.
+   *
+   * Blocks are never returned to the system; freed slots are kept for
+   * later objects of their size.  Objects larger than the largest class
+   * come from the general heap.  With USE_THREADS each thread has free
+   * lists of its own, since each module of a modules conversion builds
+   * its objects on a thread of its own, and an allocation never takes a
+   * lock.  A slot freed on another thread than it came from simply joins
+   * that thread's free list.
+   */
+  class ObjectPool
+  {
+    static const std::size_t GRANULE    = 16;
+    static const std::size_t CLASSES    = 16; // up to 256 bytes
+    static const std::size_t BLOCK_SIZE = 64 * 1024;
+
+    struct Slot {
+      Slot * next;
+    };
+
+    // Only the owning thread changes a counter, but statistics() may
+    // read it from another, so each is atomic without being locked.
+    typedef std::atomic<std::int64_t> counter;
+
+    struct SizeClass {
+      Slot *  free_list;
+      char *  next;               // unused space in the newest block
+      char *  end;
+      counter blocks;
+      counter allocations;
+      counter live;               // may go below zero on one thread
+      counter peak;
+    };
+
+    struct Pool {
+      SizeClass classes[CLASSES];
+      counter   large_allocations;
+      counter   live;             // across every class
+      counter   peak;
+    };
+
+#ifdef USE_THREADS
+    static thread_local Pool * local;
+    static mutex               pools_mutex;
+#else
+    static Pool *              local;
+#endif
+    static std::vector<Pool *> pools; // every thread's, never freed
+
+    static Pool& local_pool() {
+      if (local == nullptr)
+        add_pool();
+      return *local;
+    }
+
+    static void add_pool();
+    static void refill(SizeClass& size_class, std::size_t slot_size);
+
+    static void add(counter& value, std::int64_t amount) {
+      value.store(value.load(std::memory_order_relaxed) + amount,
+                  std::memory_order_relaxed);
+    }
+
+  public:
+    static void * allocate(std::size_t size);
+    static void   deallocate(void * ptr, std::size_t size);
+
+    /**
+     * The most pooled objects there have been at once, summed over the
+     * threads' own peaks.
+     */
+    static std::size_t peak_objects();
+
+    /**
+     * A summary of what has been allocated so far, for the log.
+     */
+    static std::string statistics();
+  };
+}
+
+#endif // _OBJECTPOOL_H
@@ -0,0 +1,806 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "packwriter.h"
+
+#ifdef HAVE_PACK_WRITER
+
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef ASSERTS
+#undef assert
+#define assert(x)
+#endif
+
+namespace Git {
+
+namespace {
+  const std::size_t BUFFER_SIZE = 1024 * 1024;
+
+#ifdef USE_THREADS
+  // How much blob contents may wait for the workers, or for being stored
+  // once they are compressed, before submit() stops to store some.
+  const std::size_t MAX_PENDING = 64 * 1024 * 1024;
+#endif
+
+  // Ahead of libgit2's own loose (2) and packed (1) backends, so that
+  // every write comes here first.
+  const int BACKEND_PRIORITY = 10;
+
+  void put32(std::string& out, std::uint32_t value) {
+    out.push_back(static_cast<char>(value >> 24));
+    out.push_back(static_cast<char>(value >> 16));
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+  }
+
+  void write_all(int fd, const unsigned char * data, std::size_t len,
+                 const filesystem::path& pathname) {
+    while (len > 0) {
+      ssize_t n = ::write(fd, data, len);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        throw std::runtime_error(std::string("Could not write ") +
+                                 pathname.string() + ": " +
+                                 std::strerror(errno));
+      }
+      data += n;
+      len  -= static_cast<std::size_t>(n);
+    }
+  }
+}
+
+PackWriter::PackWriter(git_repository * repo, std::uint64_t _max_pack_size,
+                       int _compression)
+  : pack_dir(filesystem::path(git_repository_path(repo)) /
+             "objects" / "pack"),
+    max_pack_size(_max_pack_size), compression(_compression),
+    flushed(0), in_progress(false),
+#ifdef USE_THREADS
+    pending_bytes(0), stopping(false),
+#endif
+    objects(0), duplicates(0),
+    packs_written(0), bytes_in(0), bytes_out(0)
+{
+  std::memset(&backend, 0, sizeof(backend));
+  backend.parent.read        = backend_read;
+  backend.parent.read_header = backend_read_header;
+  backend.parent.write       = backend_write;
+  backend.parent.exists      = backend_exists;
+  backend.parent.free        = backend_free;
+  backend.writer             = this;
+
+  git_odb * odb;
+  if (git_repository_odb(&odb, repo) != 0)
+    throw std::logic_error(giterr_last()->message);
+  int result = git_odb_add_backend(odb, &backend.parent, BACKEND_PRIORITY);
+  git_odb_free(odb);
+  if (result != 0)
+    throw std::logic_error(giterr_last()->message);
+}
+
+PackWriter::~PackWriter()
+{
+  try {
+    finish();
+  }
+  catch (...) {}
+
+#ifdef USE_THREADS
+  { mutex::scoped_lock lock(pending_mutex);
+    stopping = true;
+  }
+  work_available.notify_all();
+  workers.join_all();
+#endif
+
+  for (packs_vector::iterator i = packs.begin(); i != packs.end(); ++i)
+    ::close((*i).fd);
+}
+
+void PackWriter::start_pack()
+{
+  filesystem::create_directories(pack_dir);
+
+  std::string pathname((pack_dir / "tmp_pack_XXXXXX").string());
+  int fd = ::mkstemp(&pathname[0]);
+  if (fd == -1)
+    throw std::runtime_error(std::string("Could not create a pack in ") +
+                             pack_dir.string() + ": " + std::strerror(errno));
+
+  tmp_path = pathname;
+
+  Pack pack;
+  pack.fd = fd;
+  packs.push_back(pack);
+
+  in_progress = true;
+  flushed     = 0;
+
+  // The object count is filled in once the pack is finished
+  static const unsigned char header[12] = {
+    'P', 'A', 'C', 'K', 0, 0, 0, 2, 0, 0, 0, 0
+  };
+  buffer.assign(header, header + sizeof(header));
+}
+
+void PackWriter::append(const unsigned char * data, std::size_t len)
+{
+  if (buffer.size() + len > BUFFER_SIZE)
+    flush_buffer();
+
+  if (len >= BUFFER_SIZE) {
+    write_all(packs.back().fd, data, len, tmp_path);
+    flushed += len;
+  } else {
+    buffer.insert(buffer.end(), data, data + len);
+  }
+}
+
+void PackWriter::flush_buffer()
+{
+  if (! buffer.empty()) {
+    write_all(packs.back().fd, buffer.data(), buffer.size(), tmp_path);
+    flushed += buffer.size();
+    buffer.clear();
+  }
+}
+
+/**
+ * Compress an object the way it is stored in a pack: an entry header
+ * holding its type and inflated size -- four bits at first and then
+ * seven bits per byte, least significant first -- followed by the
+ * deflated contents.  `out' receives both; its used length is returned.
+ */
+std::size_t PackWriter::deflate_object(std::vector<unsigned char>& out,
+                                       const void * data, std::size_t len,
+                                       git_otype type, int compression)
+{
+  unsigned char header[16];
+  std::size_t   header_len = 0;
+  std::size_t   size       = len;
+  unsigned char c = static_cast<unsigned char>((type << 4) | (size & 0x0f));
+  for (size >>= 4; size != 0; size >>= 7) {
+    header[header_len++] = c | 0x80;
+    c = static_cast<unsigned char>(size & 0x7f);
+  }
+  header[header_len++] = c;
+
+  uLongf compressed_len = compressBound(static_cast<uLong>(len));
+  out.resize(header_len + compressed_len);
+  std::memcpy(out.data(), header, header_len);
+  if (compress2(out.data() + header_len, &compressed_len,
+                static_cast<const Bytef *>(data), static_cast<uLong>(len),
+                compression) != Z_OK)
+    throw std::runtime_error("Could not compress an object");
+
+  return header_len + compressed_len;
+}
+
+/**
+ * Append an object already run through deflate_object to the current
+ * pack, unless an object with the same id was written before.
+ */
+void PackWriter::store(const git_oid * oid, const unsigned char * entry_data,
+                       std::size_t entry_len, std::size_t len)
+{
+  if (exists(oid)) {
+    ++duplicates;
+    return;
+  }
+
+  if (! in_progress)
+    start_pack();
+
+  Entry entry;
+  entry.oid    = *oid;
+  entry.offset = flushed + buffer.size();
+  entry.crc    = static_cast<std::uint32_t>
+    (crc32(0, entry_data, static_cast<uInt>(entry_len)));
+
+  append(entry_data, entry_len);
+
+  current[*oid] = packs.back().entries.size();
+  packs.back().entries.push_back(entry);
+
+  ++objects;
+  bytes_in  += len;
+  bytes_out += entry_len;
+
+  if (flushed + buffer.size() >= max_pack_size)
+    finish_pack();
+}
+
+/**
+ * Add an object to the current pack, unless it was already written.  On
+ * return `oid' holds its id either way.
+ */
+void PackWriter::write(git_oid * oid, const void * data, std::size_t len,
+                       git_otype type)
+{
+  if (git_odb_hash(oid, data, len, type) != 0)
+    throw std::logic_error(giterr_last()->message);
+
+  if (exists(oid)) {
+    ++duplicates;
+    return;
+  }
+
+  std::size_t entry_len = deflate_object(scratch, data, len, type,
+                                         compression);
+  store(oid, scratch.data(), entry_len, len);
+}
+
+void PackWriter::finish()
+{
+#ifdef USE_THREADS
+  store_pending(true);
+#endif
+  finish_pack();
+}
+
+void PackWriter::finish_pack()
+{
+  if (! in_progress)
+    return;
+
+  flush_buffer();
+  in_progress = false;
+  current.clear();
+
+  Pack& pack(packs.back());
+
+  if (pack.entries.empty()) {
+    ::close(pack.fd);
+    filesystem::remove(tmp_path);
+    packs.pop_back();
+    tmp_path.clear();
+    return;
+  }
+
+  std::uint32_t count = static_cast<std::uint32_t>(pack.entries.size());
+  unsigned char count_bytes[4] = {
+    static_cast<unsigned char>(count >> 24),
+    static_cast<unsigned char>(count >> 16),
+    static_cast<unsigned char>(count >> 8),
+    static_cast<unsigned char>(count)
+  };
+  if (::pwrite(pack.fd, count_bytes, sizeof(count_bytes), 8) !=
+      static_cast<ssize_t>(sizeof(count_bytes)))
+    throw std::runtime_error(std::string("Could not write ") +
+                             tmp_path.string() + ": " + std::strerror(errno));
+
+  // The trailer is a checksum of everything before it, which can only be
+  // computed now that the header is final.
+  std::unique_ptr<EVP_MD_CTX, void (*)(EVP_MD_CTX *)>
+    ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+  if (! ctx || EVP_DigestInit_ex(ctx.get(), EVP_sha1(), nullptr) != 1)
+    throw std::runtime_error(std::string("Could not checksum ") +
+                             tmp_path.string());
+  scratch.resize(BUFFER_SIZE);
+  for (std::uint64_t offset = 0; offset < flushed; ) {
+    std::size_t n = read_bytes(pack, offset, scratch.data(), BUFFER_SIZE);
+    if (n == 0)
+      throw std::runtime_error(std::string("Could not read back ") +
+                               tmp_path.string());
+    EVP_DigestUpdate(ctx.get(), scratch.data(), n);
+    offset += n;
+  }
+  unsigned char pack_sha1[20];
+  EVP_DigestFinal_ex(ctx.get(), pack_sha1, nullptr);
+  write_all(pack.fd, pack_sha1, sizeof(pack_sha1), tmp_path);
+  ::fchmod(pack.fd, 0444);
+
+  std::sort(pack.entries.begin(), pack.entries.end(),
+            [](const Entry& left, const Entry& right) {
+              return std::memcmp(left.oid.id, right.oid.id,
+                                 sizeof(left.oid.id)) < 0;
+            });
+
+  git_oid pack_id;
+  char    pack_name[41];
+  std::memcpy(pack_id.id, pack_sha1, sizeof(pack_id.id));
+  git_oid_fmt(pack_name, &pack_id);
+  pack_name[40] = '\0';
+  filesystem::path base(pack_dir / (std::string("pack-") + pack_name));
+
+  filesystem::path tmp_index(tmp_path.string() + ".idx");
+  write_index(pack.entries, pack_sha1, tmp_index);
+
+  // Git only looks for packs through their index, so the index goes
+  // into place last.
+  filesystem::rename(tmp_path, base.string() + ".pack");
+  filesystem::rename(tmp_index, base.string() + ".idx");
+  tmp_path.clear();
+
+  ++packs_written;
+}
+
+/**
+ * Write a version 2 pack index: a fan-out table on the first byte of
+ * each id, then the sorted ids, their CRCs and their offsets, with any
+ * offset past 2 GB given in a table of 64-bit offsets at the end.
+ */
+void PackWriter::write_index(const entries_vector&   entries,
+                             const unsigned char     pack_sha1[20],
+                             const filesystem::path& pathname)
+{
+  std::string out;
+  out.reserve(8 + 256 * 4 + entries.size() * 28 + 40);
+
+  out.append("\377tOc", 4);
+  put32(out, 2);
+
+  entries_vector::const_iterator i = entries.begin();
+  for (int first = 0; first < 256; ++first) {
+    while (i != entries.end() && (*i).oid.id[0] <= first)
+      ++i;
+    put32(out, static_cast<std::uint32_t>(i - entries.begin()));
+  }
+
+  for (i = entries.begin(); i != entries.end(); ++i)
+    out.append(reinterpret_cast<const char *>((*i).oid.id),
+               sizeof((*i).oid.id));
+  for (i = entries.begin(); i != entries.end(); ++i)
+    put32(out, (*i).crc);
+
+  std::vector<std::uint64_t> large_offsets;
+  for (i = entries.begin(); i != entries.end(); ++i) {
+    if ((*i).offset < 0x80000000ULL) {
+      put32(out, static_cast<std::uint32_t>((*i).offset));
+    } else {
+      put32(out, 0x80000000U | static_cast<std::uint32_t>
+            (large_offsets.size()));
+      large_offsets.push_back((*i).offset);
+    }
+  }
+  for (std::vector<std::uint64_t>::const_iterator j = large_offsets.begin();
+       j != large_offsets.end();
+       ++j) {
+    put32(out, static_cast<std::uint32_t>(*j >> 32));
+    put32(out, static_cast<std::uint32_t>(*j));
+  }
+
+  out.append(reinterpret_cast<const char *>(pack_sha1), 20);
+
+  unsigned char index_sha1[20];
+  EVP_Digest(out.data(), out.size(), index_sha1, nullptr, EVP_sha1(),
+             nullptr);
+  out.append(reinterpret_cast<const char *>(index_sha1), 20);
+
+  filesystem::ofstream file(pathname, std::ios::out | std::ios::binary);
+  file.write(out.data(), static_cast<std::streamsize>(out.size()));
+  file.close();
+  if (! file)
+    throw std::runtime_error(std::string("Could not write ") +
+                             pathname.string());
+}
+
+const PackWriter::Entry * PackWriter::find(const git_oid * oid,
+                                           const Pack ** pack) const
+{
+  entries_map::const_iterator i = current.find(*oid);
+  if (i != current.end()) {
+    *pack = &packs.back();
+    return &packs.back().entries[(*i).second];
+  }
+
+  std::size_t finished = packs.size() - (in_progress ? 1 : 0);
+  for (std::size_t j = 0; j < finished; ++j) {
+    const entries_vector& entries(packs[j].entries);
+    entries_vector::const_iterator k =
+      std::lower_bound(entries.begin(), entries.end(), *oid,
+                       [](const Entry& entry, const git_oid& key) {
+                         return std::memcmp(entry.oid.id, key.id,
+                                            sizeof(key.id)) < 0;
+                       });
+    if (k != entries.end() &&
+        std::memcmp((*k).oid.id, oid->id, sizeof(oid->id)) == 0) {
+      *pack = &packs[j];
+      return &*k;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Read up to `len' bytes of a pack from `offset', whether they are on
+ * disk yet or still in the write buffer.  Returns the number read, which
+ * is short only at the end of the pack.
+ */
+std::size_t PackWriter::read_bytes(const Pack& pack, std::uint64_t offset,
+                                   unsigned char * data,
+                                   std::size_t len) const
+{
+  bool current_pack = in_progress && &pack == &packs.back();
+  std::size_t total = 0;
+
+  while (len > 0 && (! current_pack || offset < flushed)) {
+    std::size_t want = len;
+    if (current_pack && offset + want > flushed)
+      want = static_cast<std::size_t>(flushed - offset);
+
+    ssize_t n = ::pread(pack.fd, data, want, static_cast<off_t>(offset));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error(std::string("Could not read pack: ") +
+                               std::strerror(errno));
+    }
+    if (n == 0)
+      return total;
+
+    data   += n;
+    offset += static_cast<std::uint64_t>(n);
+    len    -= static_cast<std::size_t>(n);
+    total  += static_cast<std::size_t>(n);
+  }
+
+  if (len > 0 && current_pack) {
+    std::uint64_t end = flushed + buffer.size();
+    if (offset < end) {
+      std::size_t n = std::min(len, static_cast<std::size_t>(end - offset));
+      std::memcpy(data, buffer.data() + (offset - flushed), n);
+      total += n;
+    }
+  }
+  return total;
+}
+
+void PackWriter::read_header(const Pack& pack, std::uint64_t offset,
+                             git_otype& type, std::size_t& len,
+                             std::uint64_t& data_offset) const
+{
+  unsigned char header[16];
+  std::size_t   header_len = read_bytes(pack, offset, header, sizeof(header));
+
+  std::size_t i = 0;
+  unsigned char c = header[i++];
+  type = static_cast<git_otype>((c >> 4) & 7);
+  len  = c & 0x0f;
+  for (int shift = 4; c & 0x80; shift += 7) {
+    if (i == header_len)
+      throw std::runtime_error("Bad object header in pack");
+    c    = header[i++];
+    len |= static_cast<std::size_t>(c & 0x7f) << shift;
+  }
+  data_offset = offset + i;
+}
+
+void PackWriter::read_object(const Pack& pack, std::uint64_t offset,
+                             void ** data, std::size_t& len,
+                             git_otype& type) const
+{
+  std::uint64_t data_offset;
+  read_header(pack, offset, type, len, data_offset);
+
+  // libgit2 releases object data with free()
+  unsigned char * object = static_cast<unsigned char *>
+    (std::malloc(len > 0 ? len : 1));
+  if (! object)
+    throw std::bad_alloc();
+
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(stream));
+  inflateInit(&stream);
+  stream.next_out  = object;
+  stream.avail_out = static_cast<uInt>(len);
+
+  unsigned char chunk[65536];
+  int result = Z_OK;
+  while (result == Z_OK) {
+    std::size_t n = read_bytes(pack, data_offset, chunk, sizeof(chunk));
+    if (n == 0)
+      break;
+    data_offset += n;
+
+    stream.next_in  = chunk;
+    stream.avail_in = static_cast<uInt>(n);
+    result = inflate(&stream, Z_NO_FLUSH);
+  }
+  inflateEnd(&stream);
+
+  if (result != Z_STREAM_END || stream.total_out != len) {
+    std::free(object);
+    throw std::runtime_error("Corrupt object in pack");
+  }
+  *data = object;
+}
+
+/**
+ * Like find(), but an object which is still with the workers is stored
+ * first, along with everything else pending, so that it can be read.
+ */
+const PackWriter::Entry * PackWriter::find_stored(const git_oid * oid,
+                                                  const Pack ** pack)
+{
+  const Entry * entry = find(oid, pack);
+#ifdef USE_THREADS
+  if (! entry && ! unstored.empty()) {
+    store_pending(true);
+    entry = find(oid, pack);
+  }
+#endif
+  return entry;
+}
+
+/**
+ * Whether an object is in a pack or with the workers, having been hashed
+ * already.  Unlike find_stored(), this never waits for the workers nor
+ * stores anything.
+ */
+bool PackWriter::is_known(const git_oid * oid)
+{
+  if (exists(oid))
+    return true;
+
+#ifdef USE_THREADS
+  mutex::scoped_lock lock(pending_mutex);
+  for (const PendingPtr& pending : unstored)
+    if (pending->hashed && pending->error.empty() &&
+        git_oid_cmp(&pending->oid, oid) == 0)
+      return true;
+#endif
+  return false;
+}
+
+bool PackWriter::read(const git_oid * oid, void ** data, std::size_t& len,
+                      git_otype& type)
+{
+  const Pack *  pack;
+  const Entry * entry = find_stored(oid, &pack);
+  if (! entry)
+    return false;
+
+  read_object(*pack, entry->offset, data, len, type);
+  return true;
+}
+
+#ifdef USE_THREADS
+
+/**
+ * Have `count' threads hash and compress blobs from now on, instead of
+ * the thread which creates them.
+ */
+void PackWriter::start_workers(unsigned count)
+{
+  while (static_cast<unsigned>(workers.size()) < count)
+    workers.create_thread(bind(&PackWriter::work, this));
+}
+
+/**
+ * Hand an object to the workers.  The contents are copied, so the caller
+ * may reuse `data' at once; the object's id is available from
+ * wait_for_id() as soon as a worker has hashed it, and the object is
+ * added to the pack by a later call to store_pending().  If too much is
+ * waiting to be stored already, the oldest objects are stored first.
+ */
+PackWriter::PendingPtr PackWriter::submit(const void * data, std::size_t len,
+                                          git_otype type)
+{
+  PendingPtr pending(new Pending);
+  pending->data.assign(static_cast<const char *>(data), len);
+  pending->type   = type;
+  pending->hashed = false;
+  pending->done   = false;
+
+  if (pending_bytes >= MAX_PENDING)
+    store_pending(true, MAX_PENDING / 2);
+
+  { mutex::scoped_lock lock(pending_mutex);
+    queued.push_back(pending);
+  }
+  work_available.notify_one();
+
+  unstored.push_back(pending);
+  pending_bytes += len;
+
+  return pending;
+}
+
+const git_oid * PackWriter::wait_for_id(const PendingPtr& pending)
+{
+  mutex::scoped_lock lock(pending_mutex);
+  while (! pending->hashed)
+    work_finished.wait(lock);
+
+  if (! pending->error.empty())
+    throw std::runtime_error(pending->error);
+  return &pending->oid;
+}
+
+/**
+ * Add finished objects to the pack, in the order they were submitted,
+ * until one is found which is not finished yet.  With `wait', wait for
+ * that object instead, until no more than `keep_bytes' of contents are
+ * left waiting.
+ */
+void PackWriter::store_pending(bool wait, std::size_t keep_bytes)
+{
+  while (! unstored.empty() && (! wait || pending_bytes > keep_bytes)) {
+    PendingPtr pending(unstored.front());
+
+    { mutex::scoped_lock lock(pending_mutex);
+      if (! pending->done && ! wait)
+        break;
+      while (! pending->done)
+        work_finished.wait(lock);
+    }
+
+    unstored.pop_front();
+    pending_bytes -= pending->len;
+
+    if (! pending->error.empty())
+      throw std::runtime_error(pending->error);
+
+    store(&pending->oid, pending->entry.data(), pending->entry.size(),
+          pending->len);
+    std::vector<unsigned char>().swap(pending->entry);
+  }
+}
+
+void PackWriter::work()
+{
+  for (;;) {
+    PendingPtr pending;
+
+    { mutex::scoped_lock lock(pending_mutex);
+
+      while (queued.empty() && ! stopping)
+        work_available.wait(lock);
+
+      if (queued.empty())
+        return;
+
+      pending = queued.front();
+      queued.pop_front();
+    }
+
+    std::string error;
+    git_oid     oid;
+    if (git_odb_hash(&oid, pending->data.data(), pending->data.length(),
+                     pending->type) != 0)
+      error = giterr_last()->message;
+
+    { mutex::scoped_lock lock(pending_mutex);
+      pending->oid    = oid;
+      pending->error  = error;
+      pending->hashed = true;
+    }
+    work_finished.notify_all();
+
+    if (error.empty()) {
+      try {
+        std::size_t entry_len =
+          deflate_object(pending->entry, pending->data.data(),
+                         pending->data.length(), pending->type, compression);
+        pending->entry.resize(entry_len);
+      }
+      catch (const std::exception& err) {
+        error = err.what();
+      }
+    }
+    pending->len = pending->data.length();
+    std::string().swap(pending->data);
+
+    { mutex::scoped_lock lock(pending_mutex);
+      pending->error = error;
+      pending->done  = true;
+    }
+    work_finished.notify_all();
+  }
+}
+
+#endif // USE_THREADS
+
+// The libgit2 entry points.  Exceptions must not cross back into C, so
+// errors are noted and reported as a failure to libgit2.
+
+int PackWriter::backend_read(void ** data, std::size_t * len,
+                             git_otype * type, git_odb_backend * backend,
+                             const git_oid * oid)
+{
+  PackWriter * writer = reinterpret_cast<Backend *>(backend)->writer;
+  try {
+    return writer->read(oid, data, *len, *type) ? GIT_SUCCESS : GIT_ENOTFOUND;
+  }
+  catch (const std::exception& err) {
+    if (writer->failure.empty())
+      writer->failure = err.what();
+    return GIT_ERROR;
+  }
+}
+
+int PackWriter::backend_read_header(std::size_t * len, git_otype * type,
+                                    git_odb_backend * backend,
+                                    const git_oid * oid)
+{
+  PackWriter * writer = reinterpret_cast<Backend *>(backend)->writer;
+  try {
+    const Pack *  pack;
+    const Entry * entry = writer->find_stored(oid, &pack);
+    if (! entry)
+      return GIT_ENOTFOUND;
+
+    std::uint64_t data_offset;
+    writer->read_header(*pack, entry->offset, *type, *len, data_offset);
+    return GIT_SUCCESS;
+  }
+  catch (const std::exception& err) {
+    if (writer->failure.empty())
+      writer->failure = err.what();
+    return GIT_ERROR;
+  }
+}
+
+int PackWriter::backend_write(git_oid * oid, git_odb_backend * backend,
+                              const void * data, std::size_t len,
+                              git_otype type)
+{
+  PackWriter * writer = reinterpret_cast<Backend *>(backend)->writer;
+  try {
+    writer->write(oid, data, len, type);
+    return GIT_SUCCESS;
+  }
+  catch (const std::exception& err) {
+    if (writer->failure.empty())
+      writer->failure = err.what();
+    return GIT_ERROR;
+  }
+}
+
+int PackWriter::backend_exists(git_odb_backend * backend, const git_oid * oid)
+{
+  PackWriter * writer = reinterpret_cast<Backend *>(backend)->writer;
+  try {
+    return writer->is_known(oid) ? 1 : 0;
+  }
+  catch (const std::exception& err) {
+    if (writer->failure.empty())
+      writer->failure = err.what();
+    return 0;
+  }
+}
+
+void PackWriter::backend_free(git_odb_backend *)
+{
+  // The PackWriter belongs to its Repository, which deletes it only
+  // after freeing the git_repository, and this backend with it.
+}
+
+} // namespace Git
+
+#endif // HAVE_PACK_WRITER
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PACKWRITER_H
+#define _PACKWRITER_H
+
+#include "system.hpp"
+#include "oidhash.h"
+
+using namespace boost;
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ) && \
+    defined(HAVE_OPENSSL_EVP_H) && defined(HAVE_LIBCRYPTO)
+#define HAVE_PACK_WRITER 1
+#endif
+
+#ifdef HAVE_PACK_WRITER
+
+namespace Git
+{
+  /**
+   * An object database backend which streams every object written
+   * through libgit2 straight into a packfile, the way git fast-import
+   * does, instead of creating one loose object file apiece.  Objects are
+   * stored whole (no deltas), each compressed on its own with zlib.
+   *
+   * When the current pack grows past `max_pack_size', or when finish()
+   * is called, its header and trailer are completed, an index (version
+   * 2) is written alongside it, and both are renamed into place under
+   * objects/pack; later objects go into a fresh pack.  Until then, the
+   * pack is a temporary file that Git itself knows nothing about, so
+   * objects are read back from it by this backend, as are those from
+   * any pack it finished earlier in the same run.
+   *
+   * Objects are only written once: anything already written by this
+   * backend is recognized by its id and skipped.
+   *
+   * With USE_THREADS, blobs may instead be submitted to a pool of workers
+   * which hash and compress them in parallel.  Those are appended to the
+   * pack in the order they were submitted, whenever store_pending() is
+   * called, and in any case before they are read back or the pack is
+   * finished.
+   */
+  class PackWriter : public noncopyable
+  {
+    struct Backend {
+      git_odb_backend parent;   // must come first
+      PackWriter *    writer;
+    };
+
+    struct Entry {
+      git_oid       oid;
+      std::uint32_t crc;
+      std::uint64_t offset;
+    };
+
+    typedef std::vector<Entry> entries_vector;
+
+    typedef std::unordered_map<git_oid, std::size_t, oid_hash, oid_equal>
+      entries_map;
+
+    struct Pack {
+      int            fd;
+      entries_vector entries;   // sorted by id, once finished
+    };
+
+    typedef std::vector<Pack> packs_vector;
+
+    Backend                    backend;
+    filesystem::path           pack_dir;
+    filesystem::path           tmp_path;
+    std::uint64_t              max_pack_size;
+    int                        compression;
+
+    packs_vector               packs;     // the last one is being written
+    entries_map                current;   // index into packs.back()
+    std::uint64_t              flushed;   // bytes of it already on disk
+    std::vector<unsigned char> buffer;    // bytes of it not yet written
+    std::vector<unsigned char> scratch;
+    std::string                failure;
+
+    bool in_progress;             // is packs.back() still being written?
+
+#ifdef USE_THREADS
+  public:
+    /**
+     * A blob handed to the workers, to be hashed and compressed on their
+     * threads.  It is added to the pack later, by store_pending().
+     */
+    struct Pending {
+      std::string                data;    // released once compressed
+      git_otype                  type;
+      std::size_t                len;
+      git_oid                    oid;
+      std::vector<unsigned char> entry;   // as deflate_object made it
+      std::string                error;
+      bool                       hashed;
+      bool                       done;
+    };
+
+    typedef shared_ptr<Pending> PendingPtr;
+
+  private:
+    typedef std::deque<PendingPtr> pending_deque;
+
+    pending_deque      queued;        // waiting for a worker
+    pending_deque      unstored;      // not yet in the pack, oldest first
+    std::size_t        pending_bytes; // contents held by `unstored'
+    bool               stopping;
+    mutex              pending_mutex;
+    condition_variable work_available;
+    condition_variable work_finished;
+    thread_group       workers;
+
+    void work();
+#endif
+
+    static std::size_t deflate_object(std::vector<unsigned char>& out,
+                                      const void * data, std::size_t len,
+                                      git_otype type, int compression);
+
+    void start_pack();
+    void append(const unsigned char * data, std::size_t len);
+    void flush_buffer();
+    void store(const git_oid * oid, const unsigned char * entry_data,
+               std::size_t entry_len, std::size_t len);
+    void finish_pack();
+    void write_index(const entries_vector& entries,
+                     const unsigned char pack_sha1[20],
+                     const filesystem::path& pathname);
+
+    const Entry * find(const git_oid * oid, const Pack ** pack) const;
+    const Entry * find_stored(const git_oid * oid, const Pack ** pack);
+    bool          is_known(const git_oid * oid);
+
+    void read_header(const Pack& pack, std::uint64_t offset,
+                     git_otype& type, std::size_t& len,
+                     std::uint64_t& data_offset) const;
+    std::size_t read_bytes(const Pack& pack, std::uint64_t offset,
+                           unsigned char * data, std::size_t len) const;
+    void read_object(const Pack& pack, std::uint64_t offset,
+                     void ** data, std::size_t& len, git_otype& type) const;
+
+    static int  backend_read(void ** data, std::size_t * len,
+                             git_otype * type, git_odb_backend * backend,
+                             const git_oid * oid);
+    static int  backend_read_header(std::size_t * len, git_otype * type,
+                                    git_odb_backend * backend,
+                                    const git_oid * oid);
+    static int  backend_write(git_oid * oid, git_odb_backend * backend,
+                              const void * data, std::size_t len,
+                              git_otype type);
+    static int  backend_exists(git_odb_backend * backend, const git_oid * oid);
+    static void backend_free(git_odb_backend * backend);
+
+  public:
+    std::size_t   objects;          // statistics for the whole run
+    std::size_t   duplicates;
+    std::size_t   packs_written;
+    std::uint64_t bytes_in;
+    std::uint64_t bytes_out;
+
+    PackWriter(git_repository *  repo,
+               std::uint64_t     _max_pack_size = 1024ULL * 1024 * 1024,
+               int               _compression   = -1);
+    ~PackWriter();
+
+    void write(git_oid * oid, const void * data, std::size_t len,
+               git_otype type);
+    bool read(const git_oid * oid, void ** data, std::size_t& len,
+              git_otype& type);
+    bool exists(const git_oid * oid) const {
+      const Pack * pack;
+      return find(oid, &pack) != nullptr;
+    }
+
+#ifdef USE_THREADS
+    void start_workers(unsigned count);
+    bool has_workers() const {
+      return workers.size() > 0;
+    }
+
+    PendingPtr      submit(const void * data, std::size_t len,
+                           git_otype type);
+    const git_oid * wait_for_id(const PendingPtr& pending);
+    void            store_pending(bool wait, std::size_t keep_bytes = 0);
+#endif
+
+    /**
+     * Store whatever is still pending, then complete the current pack,
+     * if anything has been written to it, so that the repository is
+     * whole.  Further writes start a new pack.
+     */
+    void finish();
+
+    /**
+     * The first error hit while writing, if any.  libgit2 falls back to
+     * its loose object backend when a write fails, so such an error costs
+     * speed but not data.
+     */
+    const std::string& get_failure() const {
+      return failure;
+    }
+  };
+}
+
+#endif // HAVE_PACK_WRITER
+
+#endif // _PACKWRITER_H
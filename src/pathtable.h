@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PATHTABLE_H
+#define _PATHTABLE_H
+
+#include "system.hpp"
+
+using namespace boost;
+
+namespace SvnDump
+{
+  /**
+   * Interns the pathnames named by a dump, so that every node naming the
+   * same path shares a single filesystem::path, rather than building and
+   * carrying its own.  Entries are never removed, and their addresses
+   * never change, so a pointer to one stays valid for as long as the
+   * table does.  Only the thread reading the dump adds to it.
+   */
+  class PathTable : public noncopyable
+  {
+    typedef std::unordered_map<std::string, filesystem::path> paths_map;
+
+    paths_map paths;
+
+  public:
+    const filesystem::path * intern(const char * beg, const char * end) {
+      std::string name(beg, end);
+      paths_map::iterator i = paths.find(name);
+      if (i == paths.end())
+        i = paths.insert(paths_map::value_type(name, filesystem::path(name)))
+          .first;
+      return &(*i).second;
+    }
+
+    std::size_t size() const {
+      return paths.size();
+    }
+
+    static const filesystem::path& empty_path() {
+      static const filesystem::path empty;
+      return empty;
+    }
+  };
+}
+
+#endif // _PATHTABLE_H
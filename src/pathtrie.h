@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PATHTRIE_H
+#define _PATHTRIE_H
+
+#include "system.hpp"
+
+using namespace boost;
+
+namespace Git
+{
+  /**
+   * Maps pathnames to values by their components, so that the value at
+   * a path, or at the nearest of its parents, is found in one walk down
+   * from the root.  Lookups split the pathname's string in place and
+   * binary search each node's sorted children, so they allocate nothing.
+   * Children are ordered as filesystem::path orders its elements, which
+   * makes for_each() visit entries in the order of a std::map keyed by
+   * path.
+   */
+  template <typename T>
+  class PathTrie : public noncopyable
+  {
+    struct Node;
+
+    typedef shared_ptr<Node>     node_ptr;
+    typedef std::vector<node_ptr> children_vector;
+
+    struct Node
+    {
+      std::string     name;
+      optional<T>     value;
+      children_vector children; // sorted by name
+    };
+
+    Node        root;
+    std::size_t count;
+
+    /**
+     * Set `beg' and `end' around the next component of a pathname at or
+     * after `p', and return true if there was one.
+     */
+    static bool next_component(const char *& p, const char * last,
+                               const char *& beg, const char *& end) {
+      while (p != last && *p == '/')
+        ++p;
+      if (p == last)
+        return false;
+      beg = p;
+      while (p != last && *p != '/')
+        ++p;
+      end = p;
+      return true;
+    }
+
+    static typename children_vector::iterator
+    lower_bound(children_vector& children, const char * beg,
+                const char * end) {
+      std::size_t len = static_cast<std::size_t>(end - beg);
+      return std::lower_bound(children.begin(), children.end(), beg,
+                              [len](const node_ptr& child, const char * name) {
+                                return child->name.compare(0, std::string::npos,
+                                                           name, len) < 0;
+                              });
+    }
+
+    static Node * find_child(Node * node, const char * beg, const char * end) {
+      typename children_vector::iterator i =
+        lower_bound(node->children, beg, end);
+      if (i == node->children.end() ||
+          (*i)->name.compare(0, std::string::npos, beg,
+                             static_cast<std::size_t>(end - beg)) != 0)
+        return nullptr;
+      return (*i).get();
+    }
+
+    Node * find_node(const filesystem::path& pathname) {
+      const std::string& name(pathname.string());
+      const char * p    = name.data();
+      const char * last = p + name.length();
+      const char * beg;
+      const char * end;
+
+      Node * node = &root;
+      while (node && next_component(p, last, beg, end))
+        node = find_child(node, beg, end);
+      return node;
+    }
+
+    static std::size_t count_values(const Node * node) {
+      std::size_t values = 0;
+      for (const node_ptr& child : node->children)
+        values += (child->value ? 1 : 0) + count_values(child.get());
+      return values;
+    }
+
+    template <typename F>
+    static void visit(const Node * node, const filesystem::path& pathname,
+                      F& f) {
+      for (const node_ptr& child : node->children) {
+        filesystem::path child_path(pathname / child->name);
+        if (child->value)
+          f(child_path, *child->value);
+        visit(child.get(), child_path, f);
+      }
+    }
+
+  public:
+    PathTrie() : count(0) {}
+
+    bool empty() const {
+      return count == 0;
+    }
+    std::size_t size() const {
+      return count;
+    }
+
+    /**
+     * Add `value' at `pathname', unless there is a value there already,
+     * in which case return false.
+     */
+    bool insert(const filesystem::path& pathname, const T& value) {
+      const std::string& name(pathname.string());
+      const char * p    = name.data();
+      const char * last = p + name.length();
+      const char * beg;
+      const char * end;
+
+      Node * node = &root;
+      while (next_component(p, last, beg, end)) {
+        typename children_vector::iterator i =
+          lower_bound(node->children, beg, end);
+        if (i == node->children.end() ||
+            (*i)->name.compare(0, std::string::npos, beg,
+                               static_cast<std::size_t>(end - beg)) != 0) {
+          i = node->children.insert(i, node_ptr(new Node));
+          (*i)->name.assign(beg, end);
+        }
+        node = (*i).get();
+      }
+
+      if (node->value)
+        return false;
+      node->value = value;
+      ++count;
+      return true;
+    }
+
+    /**
+     * Return the value at exactly `pathname', or null.
+     */
+    T * find(const filesystem::path& pathname) {
+      Node * node = find_node(pathname);
+      return node && node->value ? &*node->value : nullptr;
+    }
+
+    /**
+     * Return the value at `pathname' or at the nearest of its parents,
+     * or null if neither it nor any parent has one.  As when walking
+     * parent_path() up to the empty path, the empty path is not counted
+     * as a parent.
+     */
+    T * find_within(const filesystem::path& pathname) {
+      const std::string& name(pathname.string());
+      const char * p    = name.data();
+      const char * last = p + name.length();
+      const char * beg;
+      const char * end;
+
+      Node * node  = &root;
+      T *    found = nullptr;
+      while (next_component(p, last, beg, end)) {
+        node = find_child(node, beg, end);
+        if (! node)
+          break;
+        if (node->value)
+          found = &*node->value;
+      }
+      return found;
+    }
+
+    /**
+     * Remove every value strictly beneath `pathname', returning how many
+     * there were.  Nothing is beneath the empty path.
+     */
+    std::size_t erase_below(const filesystem::path& pathname) {
+      Node * node = find_node(pathname);
+      if (! node || node == &root)
+        return 0;
+      std::size_t removed = count_values(node);
+      node->children.clear();
+      count -= removed;
+      return removed;
+    }
+
+    void clear() {
+      root.value = none;
+      root.children.clear();
+      count = 0;
+    }
+
+    /**
+     * Call `f' with the pathname and value of every entry, in order.
+     */
+    template <typename F>
+    void for_each(F f) const {
+      if (root.value)
+        f(filesystem::path(), *root.value);
+      visit(&root, filesystem::path(), f);
+    }
+  };
+}
+
+#endif // _PATHTRIE_H
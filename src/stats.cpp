@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stats.h"
+#include "objectpool.h"
+
+bool                                  Stats::enabled;
+Stats::PhaseStats                     Stats::phases[Stats::PHASES];
+thread_local int                      Stats::depth[Stats::PHASES];
+std::atomic<std::uint64_t>            Stats::read_bytes;
+std::atomic<std::uint64_t>            Stats::written_bytes;
+std::atomic<std::size_t>              Stats::peak_rev_trees;
+std::chrono::steady_clock::time_point Stats::started;
+
+void Stats::enable()
+{
+  enabled = true;
+  started = std::chrono::steady_clock::now();
+}
+
+void Stats::rev_trees(std::size_t count)
+{
+  if (! enabled)
+    return;
+
+  std::size_t peak = peak_rev_trees;
+  while (count > peak && ! peak_rev_trees.compare_exchange_weak(peak, count))
+    ;
+}
+
+const char * Stats::phase_name(Phase phase)
+{
+  switch (phase) {
+  case DUMP_PARSE:      return "dump_parse";
+  case BODY_READ:       return "body_read";
+  case CHECKSUM:        return "checksum";
+  case CREATE_BLOB:     return "create_blob";
+  case TREE_UPDATE:     return "tree_update";
+  case TREE_LOOKUP:     return "tree_lookup";
+  case TREE_WRITE:      return "tree_write";
+  case COMMIT_WRITE:    return "commit_write";
+  case BRANCH_UPDATE:   return "branch_update";
+  case FIND_BRANCH:     return "find_branch";
+  case FREE_PAST_TREES: return "free_past_trees";
+  case PHASES:          break;
+  }
+  return "";
+}
+
+namespace {
+  double seconds(std::uint64_t nanoseconds) {
+    return static_cast<double>(nanoseconds) / 1e9;
+  }
+
+  double elapsed_since(std::chrono::steady_clock::time_point started) {
+    return std::chrono::duration<double>
+      (std::chrono::steady_clock::now() - started).count();
+  }
+}
+
+std::string Stats::report()
+{
+  std::ostringstream buf;
+  buf << std::fixed << std::setprecision(3);
+
+  buf << std::left << std::setw(18) << "Phase" << std::right
+      << std::setw(14) << "Calls" << std::setw(14) << "Seconds" << '\n';
+  for (int i = 0; i < PHASES; ++i)
+    buf << std::left << std::setw(18) << phase_name(static_cast<Phase>(i))
+        << std::right << std::setw(14) << phases[i].calls
+        << std::setw(14) << seconds(phases[i].nanoseconds) << '\n';
+
+  buf << '\n'
+      << std::left << std::setw(18) << "elapsed" << std::right
+      << std::setw(28) << elapsed_since(started) << '\n'
+      << std::left << std::setw(18) << "bytes_read" << std::right
+      << std::setw(28) << read_bytes << '\n'
+      << std::left << std::setw(18) << "bytes_written" << std::right
+      << std::setw(28) << written_bytes << '\n'
+      << std::left << std::setw(18) << "peak_objects" << std::right
+      << std::setw(28) << Git::ObjectPool::peak_objects() << '\n'
+      << std::left << std::setw(18) << "peak_rev_trees" << std::right
+      << std::setw(28) << peak_rev_trees << '\n';
+
+  return buf.str();
+}
+
+std::string Stats::json(int rev)
+{
+  std::ostringstream buf;
+  buf << std::fixed << std::setprecision(3);
+
+  buf << "{\"rev\":" << rev
+      << ",\"elapsed\":" << elapsed_since(started);
+  for (int i = 0; i < PHASES; ++i)
+    buf << ",\"" << phase_name(static_cast<Phase>(i)) << "\":{\"calls\":"
+        << phases[i].calls << ",\"seconds\":"
+        << seconds(phases[i].nanoseconds) << '}';
+  buf << ",\"bytes_read\":" << read_bytes
+      << ",\"bytes_written\":" << written_bytes
+      << ",\"peak_objects\":" << Git::ObjectPool::peak_objects()
+      << ",\"peak_rev_trees\":" << peak_rev_trees << '}';
+
+  return buf.str();
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include "system.hpp"
+
+using namespace boost;
+
+/**
+ * Where the time of a conversion goes: the time spent in each of its
+ * phases, and how often each was entered, along with how much was read
+ * and written and the peaks of what was held in memory.  --stats
+ * reports these at the end, --stats-json as a JSON line at the end, and
+ * --stats-every as a JSON line every so many revisions, so that a slow conversion can be looked into without
+ * rebuilding it under a profiler.
+ *
+ * Nothing is timed unless measuring is enabled, so that a conversion
+ * which doesn't ask for statistics doesn't read the clock millions of
+ * times.  A phase entered again while already in it on the same thread,
+ * as Tree::write is for each subtree, counts each call but times only
+ * the outermost, so that no time is counted twice; the phases that
+ * contain others, such as the dump parse containing the body read,
+ * include their time.  Counters are atomic, since blobs and checksums
+ * are worked on by threads of their own.
+ */
+class Stats
+{
+public:
+  enum Phase {
+    DUMP_PARSE,
+    BODY_READ,
+    CHECKSUM,
+    CREATE_BLOB,
+    TREE_UPDATE,
+    TREE_LOOKUP,
+    TREE_WRITE,
+    COMMIT_WRITE,
+    BRANCH_UPDATE,
+    FIND_BRANCH,
+    FREE_PAST_TREES,
+    PHASES
+  };
+
+  class Timer : public noncopyable
+  {
+    Phase                                 phase;
+    bool                                  outermost;
+    std::chrono::steady_clock::time_point start;
+
+  public:
+    explicit Timer(Phase _phase) : phase(_phase), outermost(false) {
+      if (! enabled)
+        return;
+      ++phases[phase].calls;
+      if (depth[phase]++ == 0) {
+        outermost = true;
+        start     = std::chrono::steady_clock::now();
+      }
+    }
+    ~Timer() {
+      if (! enabled)
+        return;
+      --depth[phase];
+      if (outermost)
+        phases[phase].nanoseconds +=
+          static_cast<std::uint64_t>
+          (std::chrono::duration_cast<std::chrono::nanoseconds>
+           (std::chrono::steady_clock::now() - start).count());
+    }
+  };
+
+  static bool enabled;
+
+  /**
+   * Start measuring, from now.
+   */
+  static void enable();
+
+  static void bytes_read(std::uint64_t len) {
+    if (enabled)
+      read_bytes += len;
+  }
+  static void bytes_written(std::uint64_t len) {
+    if (enabled)
+      written_bytes += len;
+  }
+  static void rev_trees(std::size_t count);
+
+  /**
+   * A table of every phase and peak, for the end of a conversion.
+   */
+  static std::string report();
+
+  /**
+   * The same figures as one line of JSON, as of revision `rev'.
+   */
+  static std::string json(int rev);
+
+private:
+  struct PhaseStats {
+    std::atomic<std::uint64_t> calls;
+    std::atomic<std::uint64_t> nanoseconds;
+  };
+
+  static PhaseStats                 phases[PHASES];
+  static thread_local int           depth[PHASES];
+  static std::atomic<std::uint64_t> read_bytes;
+  static std::atomic<std::uint64_t> written_bytes;
+  static std::atomic<std::size_t>   peak_rev_trees;
+  static std::chrono::steady_clock::time_point started;
+
+  static const char * phase_name(Phase phase);
+};
+
+#endif // _STATS_H
@@ -37,19 +37,116 @@
 
 struct Options
 {
-  bool verbose = false;
-  bool quiet   = false;
-  int  debug   = 0;
-  int  collect = 0;
+  bool verbose   = false;
+  bool quiet     = false;
+  int  debug     = 0;
+  int  collect   = 0;
+  bool loose     = false;       // write loose objects instead of packs
+  int  pack_size = 1024;        // maximum size of each pack, in megabytes
+  bool fast_import = false;     // write a fast-import stream instead
+  std::string fast_import_output; // where to, if not to git fast-import
+  bool validate  = false;       // check each node as it is converted
+  int  jobs      = 0;           // worker threads; 0 means one per core
+  int  checkpoint = 0;          // revisions between checkpoints, if any
+  int  spill_after = 0;         // age at which past trees go to disk, if any
+  bool stats     = false;       // report where the time went, at the end
+  bool stats_json = false;      // as JSON, at the end
+  int  stats_every = 0;         // and as JSON every so many revisions
 };
 
+/**
+ * Shows the progress of a scan or conversion on a single line, redrawn
+ * in place, along with whatever is logged.  The progress line is redrawn
+ * at most a few times a second, however often it is updated, and shows
+ * the revisions and bytes of the dump gone through each second, and how
+ * long the rest should take.  The rates are measured from the first
+ * update under the current verb.
+ */
 class StatusDisplay : public Git::Logger, public noncopyable
 {
+  typedef std::chrono::steady_clock clock_type;
+
+  // How often the progress line may be redrawn, in milliseconds.
+  enum { REFRESH_INTERVAL = 250 };
+
   mutable int  rev;
   int          final_rev;
   mutable bool need_newline;
   Options      opts;
 
+  const std::atomic<std::uint64_t> * bytes_read; // through the input, if known
+  std::uint64_t                      bytes_total;
+
+  mutable std::string            rate_verb;  // the verb the rates are for
+  mutable clock_type::time_point rate_start;
+  mutable int                    rate_rev;
+  mutable std::uint64_t          rate_bytes;
+  mutable clock_type::time_point last_shown;
+  mutable int                    shown_rev;
+  mutable std::size_t            shown_length;
+
+  static void show_duration(std::ostream& buf, double seconds) {
+    long total = static_cast<long>(seconds + 0.5);
+    buf << total / 3600 << ':' << std::setfill('0') << std::setw(2)
+        << total / 60 % 60 << ':' << std::setw(2) << total % 60
+        << std::setfill(' ');
+  }
+
+  void show(const int next_rev) const {
+    std::ostringstream buf;
+    buf << verb << ": ";
+    if (next_rev != -1) {
+      if (final_rev) {
+        buf << int((next_rev * 100) / final_rev) << '%'
+            << " (" << next_rev << '/' << final_rev << ')';
+      } else {
+        buf << next_rev;
+      }
+
+      double elapsed = std::chrono::duration<double>
+        (clock_type::now() - rate_start).count();
+      if (elapsed >= 1.0) {
+        double revs_per_sec = (next_rev - rate_rev) / elapsed;
+        buf << std::fixed << std::setprecision(0) << ", " << revs_per_sec
+            << " revs/s";
+
+        double bytes_per_sec = 0.0;
+        if (bytes_read) {
+          std::uint64_t bytes = *bytes_read;
+          if (bytes > rate_bytes)
+            bytes_per_sec = (bytes - rate_bytes) / elapsed;
+          buf << std::setprecision(1) << ", "
+              << bytes_per_sec / (1024 * 1024) << " MB/s";
+
+          if (bytes_total > bytes && bytes_per_sec > 0.0) {
+            buf << ", ETA ";
+            show_duration(buf, (bytes_total - bytes) / bytes_per_sec);
+          }
+        }
+        else if (final_rev > next_rev && revs_per_sec > 0.0) {
+          buf << ", ETA ";
+          show_duration(buf, (final_rev - next_rev) / revs_per_sec);
+        }
+      }
+    } else {
+      buf << ", done.";
+    }
+
+    // A shorter line must blank out what is left of the last one.
+    std::string line(buf.str());
+    std::size_t length = line.length();
+    if (need_newline && length < shown_length)
+      line.append(shown_length - length, ' ');
+
+    out << line << '\r';
+    out.flush();
+
+    need_newline = true;
+    shown_rev    = next_rev;
+    shown_length = length;
+    last_shown   = clock_type::now();
+  }
+
 public:
   std::ostream& out;
   std::string   verb;
@@ -57,8 +154,20 @@ public:
   StatusDisplay(std::ostream&      _out,
                 const Options&     _opts = Options(),
                 const std::string& _verb = "Scanning")
-    : rev(-1), need_newline(false), opts(_opts), out(_out),
-      verb(_verb) {}
+    : rev(-1), final_rev(0), need_newline(false), opts(_opts),
+      bytes_read(nullptr), bytes_total(0), rate_rev(-1), rate_bytes(0),
+      shown_rev(-1), shown_length(0), out(_out), verb(_verb) {}
+
+  /**
+   * Measure progress through the input by `_bytes_read' too, out of
+   * `_bytes_total' bytes; if the total is not known, the time left is
+   * reckoned from revisions instead.
+   */
+  void track_bytes(const std::atomic<std::uint64_t>& _bytes_read,
+                   std::uint64_t                     _bytes_total) {
+    bytes_read  = &_bytes_read;
+    bytes_total = _bytes_total;
+  }
 
   virtual ~StatusDisplay() throw() {}
 
@@ -107,27 +216,31 @@ public:
   }
 
   void update(const int next_rev = -1) const {
-    if (opts.quiet) return;
-
-    out << verb << ": ";
-    if (next_rev != -1) {
-      if (final_rev) {
-        out << int((next_rev * 100) / final_rev) << '%'
-            << " (" << next_rev << '/' << final_rev << ')';
-      } else {
-        out << next_rev;
-      }
-    } else {
-      out << ", done.";
+    rev = next_rev;
+    if (opts.quiet)
+      return;
+
+    clock_type::time_point now = clock_type::now();
+    if (verb != rate_verb) {
+      rate_verb  = verb;
+      rate_start = now;
+      rate_rev   = next_rev;
+      rate_bytes = bytes_read ? std::uint64_t(*bytes_read) : 0;
+    }
+    else if (next_rev != -1 &&
+             now - last_shown <
+             std::chrono::milliseconds(REFRESH_INTERVAL)) {
+      return;
     }
 
-    out << '\r';
-    need_newline = true;
-    rev = next_rev;
+    show(next_rev);
   }
 
   void finish() const {
     if (need_newline && ! opts.quiet) {
+      // Bring the line up to date, if its last update wasn't shown.
+      if (rev != shown_rev && rev != -1)
+        show(rev);
       out << ", done." << std::endl;
       need_newline = false;
     }
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "svndiff.h"
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#include <zlib.h>
+#endif
+#if defined(HAVE_LZ4_H) && defined(HAVE_LIBLZ4)
+#include <lz4.h>
+#endif
+
+#ifndef ASSERTS
+#undef assert
+#define assert(x)
+#endif
+
+namespace SvnDump {
+
+namespace {
+  void malformed(const char * what)
+  {
+    throw std::runtime_error(std::string("Malformed svndiff delta: ") + what);
+  }
+
+  // Integers are stored big-endian, seven bits to a byte, with the high
+  // bit set on every byte but the last.
+  std::size_t read_varint(const char *& p, const char * end)
+  {
+    std::size_t value = 0;
+    while (p < end) {
+      unsigned char c = static_cast<unsigned char>(*p++);
+      value = (value << 7) | (c & 0x7f);
+      if (! (c & 0x80))
+        return value;
+    }
+    malformed("truncated integer");
+    return 0;
+  }
+
+  /**
+   * In svndiff1 and svndiff2, each section of a window is prefixed with
+   * its original length, and is only compressed if that made it
+   * smaller.  Returns a pointer to the section's plain contents, which
+   * may be `section' itself or may live in `buffer'.
+   */
+  const char * decode_section(int version, const char * section,
+                              std::size_t len, std::vector<char>& buffer,
+                              std::size_t& plain_len)
+  {
+    if (version == 0) {
+      plain_len = len;
+      return section;
+    }
+
+    const char * end = section + len;
+    plain_len = read_varint(section, end);
+
+    std::size_t stored_len = static_cast<std::size_t>(end - section);
+    if (stored_len == plain_len)
+      return section;
+
+    buffer.resize(plain_len);
+
+    if (version == 1) {
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+      uLongf out_len = static_cast<uLongf>(plain_len);
+      if (uncompress(reinterpret_cast<Bytef *>(buffer.data()), &out_len,
+                     reinterpret_cast<const Bytef *>(section),
+                     static_cast<uLong>(stored_len)) != Z_OK ||
+          out_len != plain_len)
+        malformed("bad zlib data");
+#else
+      throw std::runtime_error("svndiff1 deltas require zlib support");
+#endif
+    } else {
+#if defined(HAVE_LZ4_H) && defined(HAVE_LIBLZ4)
+      if (LZ4_decompress_safe(section, buffer.data(),
+                              static_cast<int>(stored_len),
+                              static_cast<int>(plain_len)) !=
+          static_cast<int>(plain_len))
+        malformed("bad LZ4 data");
+#else
+      throw std::runtime_error("svndiff2 deltas require LZ4 support");
+#endif
+    }
+    return buffer.data();
+  }
+
+  enum {
+    OP_SOURCE = 0,              // copy from the source view
+    OP_TARGET = 1,              // copy from the target view so far
+    OP_NEW    = 2               // copy from the window's new data
+  };
+}
+
+void apply_svndiff(const char * delta, std::size_t delta_len,
+                   const char * source, std::size_t source_len,
+                   std::string& target)
+{
+  const char * p   = delta;
+  const char * end = delta + delta_len;
+
+  if (delta_len < 4 || std::memcmp(p, "SVN", 3) != 0)
+    malformed("missing header");
+
+  int version = p[3];
+  if (version < 0 || version > 2)
+    throw std::runtime_error("Unsupported svndiff version " +
+                             lexical_cast<std::string>(version));
+  p += 4;
+
+  std::vector<char> instructions_buffer;
+  std::vector<char> new_data_buffer;
+
+  while (p < end) {
+    std::size_t sview_offset = read_varint(p, end);
+    std::size_t sview_len    = read_varint(p, end);
+    std::size_t tview_len    = read_varint(p, end);
+    std::size_t ins_len      = read_varint(p, end);
+    std::size_t new_len      = read_varint(p, end);
+
+    if (sview_offset > source_len || sview_len > source_len - sview_offset)
+      malformed("source view out of range");
+    if (ins_len > static_cast<std::size_t>(end - p) ||
+        new_len > static_cast<std::size_t>(end - p) - ins_len)
+      malformed("truncated window");
+
+    std::size_t  ins_plain_len;
+    const char * ins = decode_section(version, p, ins_len,
+                                      instructions_buffer, ins_plain_len);
+    p += ins_len;
+
+    std::size_t  new_plain_len;
+    const char * new_data = decode_section(version, p, new_len,
+                                           new_data_buffer, new_plain_len);
+    p += new_len;
+
+    const char * sview    = source + sview_offset;
+    std::size_t  tview    = target.length();
+    std::size_t  new_pos  = 0;
+    const char * ins_end  = ins + ins_plain_len;
+
+    target.reserve(tview + tview_len);
+
+    while (ins < ins_end) {
+      unsigned char c   = static_cast<unsigned char>(*ins++);
+      int           op  = c >> 6;
+      std::size_t   len = c & 0x3f;
+      if (len == 0)
+        len = read_varint(ins, ins_end);
+
+      std::size_t offset = 0;
+      if (op != OP_NEW)
+        offset = read_varint(ins, ins_end);
+
+      if (target.length() - tview + len > tview_len)
+        malformed("target view overflow");
+
+      switch (op) {
+      case OP_SOURCE:
+        if (offset > sview_len || len > sview_len - offset)
+          malformed("source copy out of range");
+        target.append(sview + offset, len);
+        break;
+
+      case OP_TARGET: {
+        // The copy may overlap the bytes it is producing, which is how
+        // svndiff expresses runs, so it must proceed a byte at a time.
+        std::size_t from = tview + offset;
+        if (from >= target.length())
+          malformed("target copy out of range");
+        for (std::size_t i = 0; i < len; ++i)
+          target.push_back(target[from + i]);
+        break;
+      }
+
+      case OP_NEW:
+        if (len > new_plain_len - new_pos)
+          malformed("new data out of range");
+        target.append(new_data + new_pos, len);
+        new_pos += len;
+        break;
+
+      default:
+        malformed("bad instruction");
+      }
+    }
+
+    if (target.length() - tview != tview_len)
+      malformed("target view length mismatch");
+  }
+}
+
+} // namespace SvnDump
@@ -34,6 +34,10 @@
 #define _SVNDUMP_H
 
 #include "system.hpp"
+#include "dumpindex.h"
+#include "verifier.h"
+#include "inputpipe.h"
+#include "pathtable.h"
 
 using namespace boost;
 
@@ -48,9 +52,54 @@ namespace SvnDump
 
     optional<std::string> rev_log;
 
-    filesystem::ifstream * handle;
+    std::istream * handle;
+
+    // Compressed dumps, and dumps read from standard input ("-"), are
+    // read through a pipe.  These can only be read forward, so they are
+    // never mapped or indexed.
+    InputPipe * input_pipe;
+
+    // When the dump file is memory-mapped, `handle' is unused and the
+    // reader walks directly over the mapped region.  Node texts then
+    // point into the mapping, rather than being copied out of it.
+    const char * map_beg;
+    const char * map_cur;
+    const char * map_end;
+    const char * map_advised;
+
+    // The revision index is built during the first complete scan of the
+    // dump, and saved alongside it for later runs.
+    filesystem::path pathname;
+    Index            index;
+    bool             use_index;
+    bool             indexing;
+
+    // Texts read with `verify' set are checked in the background; any
+    // mismatches are reported through the verifier by finish_verify().
+    Verifier verifier;
+
+    // How far into the dump the reader has got, for showing progress
+    // from whichever thread is converting.
+    std::atomic<std::uint64_t> offset_read;
+    std::size_t                nodes_read;
 
   public:
+    /**
+     * The properties of a revision, shared by all of its nodes rather
+     * than copied into each one.
+     */
+    struct Revision
+    {
+      int                   rev;
+      std::string           author;
+      std::time_t           date;
+      optional<std::string> log;
+
+      Revision() : rev(-1), date(0) {}
+    };
+
+    typedef shared_ptr<const Revision> RevisionPtr;
+
     class Node
     {
     public:
@@ -69,115 +118,105 @@ namespace SvnDump
       };
 
     private:
-#define STATIC_BUFLEN 4096
-
-      int              curr_txn;
-      filesystem::path pathname;
-      Kind             kind;
-      Action           action;
-      char *           text;
-      bool             text_allocated;
-      char             static_buffer[STATIC_BUFLEN];
-      std::size_t      text_len;
-
-      optional<std::string>      md5_checksum;
-      optional<std::string>      sha1_checksum;
-      optional<int>              copy_from_rev;
-      optional<filesystem::path> copy_from_path;
+      // Pathnames are interned by the File's PathTable, so a node only
+      // carries pointers to them.  The text is a span, either into the
+      // mapped dump file or into a buffer the node owns.
+      int                      curr_txn;
+      Kind                     kind;
+      Action                   action;
+      bool                     text_allocated;
+      bool                     text_delta; // an svndiff, not a full text
+      const filesystem::path * pathname;
+      const filesystem::path * copy_from_path;
+      optional<int>            copy_from_rev;
+      const char *             text;
+      std::size_t              text_len;
+      RevisionPtr              revision;
+
+      optional<std::string> md5_checksum;
+      optional<std::string> sha1_checksum;
 
       friend class File;
 
-      std::string           rev_author;
-      std::time_t           rev_date;
-      optional<std::string> rev_log;
-      int                   curr_rev;
-
-    public:
-      int get_rev_nr() const {
-        return curr_rev;
-      }
-      std::string get_rev_author() const {
-        return rev_author;
-      }
-      std::time_t get_rev_date() const {
-        return rev_date;
-      }
-      optional<std::string> get_rev_log() const {
-        return rev_log;
+      void free_text() {
+        if (text_allocated) {
+          assert(text);
+          delete[] text;
+          text_allocated = false;
+        }
       }
 
-      Node() : curr_txn(-1), text(nullptr), text_allocated(false),
-               text_len(0), curr_rev(-1) {}
+    public:
+      Node() : curr_txn(-1), kind(KIND_NONE), action(ACTION_NONE),
+               text_allocated(false), text_delta(false), pathname(nullptr),
+               copy_from_path(nullptr), text(nullptr), text_len(0) {}
 
-      Node(const Node& other) {
+      Node(const Node& other) : text_allocated(false) {
         *this = other;
       }
-      Node(Node&& other) {
+      Node(Node&& other) : text_allocated(false) {
         *this = boost::move(other);
       }
 
       ~Node() {
-        if (text_allocated) {
-          assert(text);
-          delete[] text;
-        }
+        free_text();
       }
 
       Node& operator=(const Node& other) {
+        if (this == &other)
+          return *this;
+
+        free_text();
+
         curr_txn       = other.curr_txn;
-        pathname       = other.pathname;
         kind           = other.kind;
         action         = other.action;
-        text_allocated = other.text_allocated;
+        text_delta     = other.text_delta;
+        pathname       = other.pathname;
+        copy_from_path = other.copy_from_path;
+        copy_from_rev  = other.copy_from_rev;
         text_len       = other.text_len;
+        revision       = other.revision;
         md5_checksum   = other.md5_checksum;
         sha1_checksum  = other.sha1_checksum;
-        copy_from_rev  = other.copy_from_rev;
-        copy_from_path = other.copy_from_path;
-        rev_author     = other.rev_author;
-        rev_date       = other.rev_date;
-        rev_log        = other.rev_log;
-        curr_rev       = other.curr_rev;
-
-        if (! text_allocated) {
-          assert(text_len <= STATIC_BUFLEN);
-          std::memcpy(static_buffer, other.static_buffer, text_len);
+
+        if (other.text_allocated) {
+          // Mapped text lives as long as the File does, so sharing the
+          // pointer is enough; owned text must be copied.
+          char * buf = new char[text_len];
+          std::memcpy(buf, other.text, text_len);
+          text           = buf;
+          text_allocated = true;
         } else {
-          assert(text_len > 0);
-          text = new char[text_len];
-          std::memcpy(text, other.text, text_len);
+          text = other.text;
         }
 
         return *this;
       }
 
       Node& operator=(Node&& other) {
+        if (this == &other)
+          return *this;
+
+        free_text();
+
         curr_txn       = other.curr_txn;
-        pathname       = other.pathname;
         kind           = other.kind;
         action         = other.action;
-        text_allocated = other.text_allocated;
-        text_len       = other.text_len;
-        md5_checksum   = other.md5_checksum;
-        sha1_checksum  = other.sha1_checksum;
-        copy_from_rev  = other.copy_from_rev;
+        text_delta     = other.text_delta;
+        pathname       = other.pathname;
         copy_from_path = other.copy_from_path;
-        rev_author     = other.rev_author;
-        rev_date       = other.rev_date;
-        rev_log        = other.rev_log;
-        curr_rev       = other.curr_rev;
-
-        if (! text_allocated) {
-          assert(text_len <= STATIC_BUFLEN);
-          std::memcpy(static_buffer, other.static_buffer, text_len);
-        } else {
-          assert(text_len > 0);
-          text = other.text;
+        copy_from_rev  = other.copy_from_rev;
+        text           = other.text;
+        text_len       = other.text_len;
+        text_allocated = other.text_allocated;
+        revision       = boost::move(other.revision);
+        md5_checksum   = boost::move(other.md5_checksum);
+        sha1_checksum  = boost::move(other.sha1_checksum);
 
-          other.text           = nullptr;
-          other.text_allocated = false;
-          other.text_len       = 0;
-        }
+        other.text           = nullptr;
+        other.text_allocated = false;
+        other.text_len       = 0;
 
         return *this;
       }
@@ -186,20 +225,30 @@ namespace SvnDump
         kind     = KIND_NONE;
         action   = ACTION_NONE;
 
-        pathname.clear();
-
-        if (text_allocated) {
-          delete[] text;
-          text_allocated = false;
-          text           = nullptr;
-        }
-        text_len = 0;
+        free_text();
+        text       = nullptr;
+        text_delta = false;
+        text_len   = 0;
 
+        pathname       = nullptr;
+        copy_from_path = nullptr;
+        copy_from_rev  = none;
         md5_checksum   = none;
         sha1_checksum  = none;
-        copy_from_rev  = none;
-        copy_from_path = none;
-        rev_log        = none;
+        revision.reset();
+      }
+
+      int get_rev_nr() const {
+        return revision ? revision->rev : -1;
+      }
+      std::string get_rev_author() const {
+        return revision ? revision->author : std::string();
+      }
+      std::time_t get_rev_date() const {
+        return revision ? revision->date : 0;
+      }
+      optional<std::string> get_rev_log() const {
+        return revision ? revision->log : none;
       }
 
       int get_txn_nr() const {
@@ -211,14 +260,14 @@ namespace SvnDump
       Kind get_kind() const {
         return kind;
       }
-      filesystem::path get_path() const {
-        return pathname;
+      const filesystem::path& get_path() const {
+        return pathname ? *pathname : PathTable::empty_path();
       }
       bool has_copy_from() const {
-        return copy_from_rev;
+        return static_cast<bool>(copy_from_rev);
       }
-      filesystem::path get_copy_from_path() const {
-        return *copy_from_path;
+      const filesystem::path& get_copy_from_path() const {
+        return copy_from_path ? *copy_from_path : PathTable::empty_path();
       }
       int get_copy_from_rev() const {
         return *copy_from_rev;
@@ -232,14 +281,26 @@ namespace SvnDump
       std::size_t get_text_length() const {
         return text_len;
       }
+      bool is_text_delta() const {
+        return text_delta;
+      }
+
+      /**
+       * Roughly how much memory this node holds on to.  Mapped texts
+       * belong to the file, and are not counted.
+       */
+      std::size_t get_memory_size() const {
+        return sizeof(*this) + (text_allocated ? text_len : 0);
+      }
+
       bool has_md5() const {
-        return md5_checksum;
+        return static_cast<bool>(md5_checksum);
       }
       std::string get_text_md5() const {
         return *md5_checksum;
       }
       bool has_sha1() const {
-        return sha1_checksum;
+        return static_cast<bool>(sha1_checksum);
       }
       std::string get_text_sha1() const {
         return *sha1_checksum;
@@ -247,45 +308,67 @@ namespace SvnDump
     };
 
   private:
-    Node curr_node;
+    Node        curr_node;
+    RevisionPtr curr_revision;
+    PathTable   paths;
 
   public:
-    File() : curr_rev(-1), handle(nullptr) {}
-    File(const filesystem::path& file) : curr_rev(-1), handle(nullptr) {
-      open(file);
+    File() : curr_rev(-1), last_rev(-1), handle(nullptr),
+             input_pipe(nullptr), map_beg(nullptr), map_cur(nullptr),
+             map_end(nullptr), map_advised(nullptr), use_index(false),
+             indexing(false), offset_read(0), nodes_read(0) {}
+    File(const filesystem::path& file, bool map_file = true,
+         bool _use_index = true)
+      : curr_rev(-1), last_rev(-1), handle(nullptr), input_pipe(nullptr),
+        map_beg(nullptr), map_cur(nullptr), map_end(nullptr),
+        map_advised(nullptr), use_index(false), indexing(false),
+        offset_read(0), nodes_read(0) {
+      open(file, map_file, _use_index);
     }
     ~File() {
-      if (handle)
+      if (handle || map_beg)
         close();
     }
 
-    void open(const filesystem::path& file) {
-      if (handle)
-        close();
+    void open(const filesystem::path& file, bool map_file = true,
+              bool _use_index = true);
+    void rewind();
+    void close();
 
-      handle = new filesystem::ifstream(file);
+    bool seek(int rev);
 
-      // Buffer up to 1 megabyte when reading the dump file; this is a
-      // nearly free 3% speed gain
-      static char read_buffer[1024 * 1024];
-      handle->rdbuf()->pubsetbuf(read_buffer, 1024 * 1024);
+    bool is_mapped() const {
+      return map_beg != nullptr;
     }
-    void rewind() {
-      handle->clear();
-      handle->seekg(0, std::ios::beg);
-      curr_node.reset();
-      curr_node.curr_txn = -1;
-      last_rev = curr_rev = -1;
+    bool is_pipe() const {
+      return input_pipe != nullptr;
     }
-    void close() {
-      delete handle;
-      handle = nullptr;
+    bool can_rewind() const {
+      return ! input_pipe || ! input_pipe->is_stdin();
+    }
+    bool has_index() const {
+      return index.is_complete();
+    }
+    const Index& get_index() const {
+      return index;
+    }
+    std::uint64_t get_offset() const;
+    std::uint64_t get_size() const;
+
+    /**
+     * The offset of the node last read, which may be read from another
+     * thread.  When reading through a pipe it is not known, and stays 0.
+     */
+    const std::atomic<std::uint64_t>& get_offset_read() const {
+      return offset_read;
     }
 
     int get_rev_nr() const {
       return curr_rev;
     }
     int get_last_rev_nr() const {
+      if (last_rev == -1 && index.is_complete())
+        return index.get_final_rev_nr();
       return last_rev;
     }
     Node& get_curr_node() {
@@ -304,8 +387,33 @@ namespace SvnDump
     bool read_next(const bool ignore_text = false,
                    const bool verify      = false);
 
+    void set_verify_report(const Verifier::report_function& report) {
+      verifier.set_report(report);
+    }
+
+    /**
+     * Wait for any outstanding checksum verification, report on this
+     * thread the mismatches not yet reported, and return the number of
+     * mismatches found so far.
+     */
+    std::size_t finish_verify() {
+      return verifier.finish();
+    }
+
   private:
-    void read_tags();
+    bool map(const filesystem::path& file);
+    void advise();
+
+    bool at_end() const {
+      return map_beg ? map_cur >= map_end : ! handle->good() || handle->eof();
+    }
+    int  peek() const {
+      return map_beg ? (map_cur < map_end ? *map_cur : EOF) : handle->peek();
+    }
+    void skip(std::size_t len);
+    void read_line(char * buf, std::size_t buflen, const char *& line,
+                   std::size_t& len, const char *& colon);
+    const char * read_block(char * buf, std::size_t len);
   };
 
   struct FilePrinter
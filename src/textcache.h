@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TEXTCACHE_H
+#define _TEXTCACHE_H
+
+#include "lrucache.h"
+#include "oidhash.h"
+
+/**
+ * A bounded, least-recently-used cache of file contents, keyed by the
+ * id of the Git blob holding them.  Applying a delta requires the full
+ * text of its base, which was usually produced by the delta just before
+ * it; keeping recent texts here avoids reading them back out of the
+ * object database each time.  Since the key is the content's own
+ * address, a hit is always exact, whatever path or revision produced
+ * it.
+ */
+class TextCache
+  : public LruCache<git_oid, std::string, Git::oid_hash, Git::oid_equal>
+{
+public:
+  TextCache(std::size_t max_bytes = 64 * 1024 * 1024)
+    : LruCache(max_bytes) {}
+
+  const std::string * find(const git_oid * oid) {
+    return LruCache::find(*oid);
+  }
+
+  void insert(const git_oid * oid, const std::string& text) {
+    if (text.length() > get_max_cost() / 4)
+      return;                   // would only push out everything else
+    LruCache::insert(*oid, text, text.length());
+  }
+};
+
+#endif // _TEXTCACHE_H
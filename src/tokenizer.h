@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TOKENIZER_H
+#define _TOKENIZER_H
+
+#include "system.hpp"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * Low-level helpers for tokenizing dump headers and property blocks.
+ *
+ * Searching for delimiters uses whichever vector instructions the
+ * compiler is targeting (AVX2, SSE2 or NEON), with a scalar fallback.
+ * Vector loads never extend past `end', so these are safe to use on a
+ * memory-mapped file.
+ */
+namespace SvnDump
+{
+  namespace detail
+  {
+    inline unsigned count_trailing_zeros(unsigned mask) {
+      return static_cast<unsigned>(__builtin_ctz(mask));
+    }
+
+#if defined(__ARM_NEON)
+    // Reduce a byte-wise comparison result to a 64-bit mask with four
+    // bits per byte.
+    inline std::uint64_t neon_mask(uint8x16_t cmp) {
+      uint8x8_t res = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+      return vget_lane_u64(vreinterpret_u64_u8(res), 0);
+    }
+#endif
+  }
+
+  /**
+   * Return the first occurrence of `c' in [p, end), or `end'.
+   */
+  inline const char * find_char(const char * p, const char * end, char c)
+  {
+#if defined(__AVX2__)
+    const __m256i needle = _mm256_set1_epi8(c);
+    for (; end - p >= 32; p += 32) {
+      __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      unsigned mask = static_cast<unsigned>
+        (_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+      if (mask)
+        return p + detail::count_trailing_zeros(mask);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i needle16 = _mm_set1_epi8(c);
+    for (; end - p >= 16; p += 16) {
+      __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+      unsigned mask = static_cast<unsigned>
+        (_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle16)));
+      if (mask)
+        return p + detail::count_trailing_zeros(mask);
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t needle16 = vdupq_n_u8(static_cast<uint8_t>(c));
+    for (; end - p >= 16; p += 16) {
+      uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t *>(p));
+      std::uint64_t mask = detail::neon_mask(vceqq_u8(block, needle16));
+      if (mask)
+        return p + (__builtin_ctzll(mask) >> 2);
+    }
+#endif
+    for (; p < end; ++p)
+      if (*p == c)
+        return p;
+    return end;
+  }
+
+  /**
+   * Return the first occurrence of either `a' or `b' in [p, end), or
+   * `end'.  This lets a header line be split at its colon and its
+   * newline in a single pass.
+   */
+  inline const char * find_either(const char * p, const char * end,
+                                  char a, char b)
+  {
+#if defined(__AVX2__)
+    const __m256i needle_a = _mm256_set1_epi8(a);
+    const __m256i needle_b = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32) {
+      __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      unsigned mask = static_cast<unsigned>
+        (_mm256_movemask_epi8(_mm256_or_si256
+                              (_mm256_cmpeq_epi8(block, needle_a),
+                               _mm256_cmpeq_epi8(block, needle_b))));
+      if (mask)
+        return p + detail::count_trailing_zeros(mask);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i needle16_a = _mm_set1_epi8(a);
+    const __m128i needle16_b = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16) {
+      __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+      unsigned mask = static_cast<unsigned>
+        (_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, needle16_a),
+                                        _mm_cmpeq_epi8(block, needle16_b))));
+      if (mask)
+        return p + detail::count_trailing_zeros(mask);
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t needle16_a = vdupq_n_u8(static_cast<uint8_t>(a));
+    const uint8x16_t needle16_b = vdupq_n_u8(static_cast<uint8_t>(b));
+    for (; end - p >= 16; p += 16) {
+      uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t *>(p));
+      std::uint64_t mask = detail::neon_mask
+        (vorrq_u8(vceqq_u8(block, needle16_a), vceqq_u8(block, needle16_b)));
+      if (mask)
+        return p + (__builtin_ctzll(mask) >> 2);
+    }
+#endif
+    for (; p < end; ++p)
+      if (*p == a || *p == b)
+        return p;
+    return end;
+  }
+
+  /**
+   * Parse a non-negative decimal number from [p, end), stopping at the
+   * first non-digit.
+   */
+  inline int parse_number(const char * p, const char * end)
+  {
+    int value = 0;
+    for (; p < end && static_cast<unsigned>(*p - '0') < 10; ++p)
+      value = value * 10 + (*p - '0');
+    return value;
+  }
+
+  inline int hex_value(char c)
+  {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+    return -1;
+  }
+
+  /**
+   * Decode a hex digest into `len' raw bytes.  A digest which is
+   * malformed decodes to all zeroes, and false is returned.
+   */
+  inline bool decode_hex(const std::string& hex, unsigned char * bytes,
+                         std::size_t len)
+  {
+    std::memset(bytes, 0, len);
+    if (hex.length() != len * 2)
+      return false;
+    for (std::size_t i = 0; i < len; ++i) {
+      int hi = hex_value(hex[i * 2]);
+      int lo = hex_value(hex[i * 2 + 1]);
+      if (hi < 0 || lo < 0) {
+        std::memset(bytes, 0, len);
+        return false;
+      }
+      bytes[i] = static_cast<unsigned char>((hi << 4) | lo);
+    }
+    return true;
+  }
+
+  /**
+   * The dump headers which the reader acts upon.  Anything else is
+   * HEADER_OTHER, and ignored.
+   */
+  enum HeaderKey {
+    HEADER_OTHER,
+    HEADER_NODE_PATH,
+    HEADER_NODE_KIND,
+    HEADER_NODE_ACTION,
+    HEADER_NODE_COPYFROM_REV,
+    HEADER_NODE_COPYFROM_PATH,
+    HEADER_PROP_CONTENT_LENGTH,
+    HEADER_REVISION_NUMBER,
+    HEADER_TEXT_CONTENT_LENGTH,
+    HEADER_TEXT_CONTENT_MD5,
+    HEADER_TEXT_CONTENT_SHA1,
+    HEADER_TEXT_DELTA
+  };
+
+#define HEADER_IS(literal)                                              \
+  (std::memcmp(key, literal, sizeof(literal) - 1) == 0)
+
+  /**
+   * Identify a header key without constructing a string.  The key's
+   * length and first character select at most one candidate, which is
+   * then confirmed with a single comparison.
+   */
+  inline HeaderKey classify_header(const char * key, std::size_t len)
+  {
+    switch (len) {
+    case 9:
+      if (key[5] == 'p' && HEADER_IS("Node-path"))
+        return HEADER_NODE_PATH;
+      if (key[5] == 'k' && HEADER_IS("Node-kind"))
+        return HEADER_NODE_KIND;
+      break;
+    case 10:
+      if (key[0] == 'T' && HEADER_IS("Text-delta"))
+        return HEADER_TEXT_DELTA;
+      break;
+    case 11:
+      if (HEADER_IS("Node-action"))
+        return HEADER_NODE_ACTION;
+      break;
+    case 15:
+      if (HEADER_IS("Revision-number"))
+        return HEADER_REVISION_NUMBER;
+      break;
+    case 16:
+      if (HEADER_IS("Text-content-md5"))
+        return HEADER_TEXT_CONTENT_MD5;
+      break;
+    case 17:
+      if (key[0] == 'N' && HEADER_IS("Node-copyfrom-rev"))
+        return HEADER_NODE_COPYFROM_REV;
+      if (key[0] == 'T' && HEADER_IS("Text-content-sha1"))
+        return HEADER_TEXT_CONTENT_SHA1;
+      break;
+    case 18:
+      if (HEADER_IS("Node-copyfrom-path"))
+        return HEADER_NODE_COPYFROM_PATH;
+      break;
+    case 19:
+      if (key[0] == 'P' && HEADER_IS("Prop-content-length"))
+        return HEADER_PROP_CONTENT_LENGTH;
+      if (key[5] == 'c' && HEADER_IS("Text-content-length"))
+        return HEADER_TEXT_CONTENT_LENGTH;
+      break;
+    }
+    return HEADER_OTHER;
+  }
+
+  /**
+   * The revision properties which the reader records.
+   */
+  enum PropertyKey {
+    PROPERTY_OTHER,
+    PROPERTY_LOG,
+    PROPERTY_DATE,
+    PROPERTY_AUTHOR,
+    PROPERTY_SYNC_LAST_MERGED_REV
+  };
+
+  inline PropertyKey classify_property(const char * key, std::size_t len)
+  {
+    switch (len) {
+    case 7:
+      if (HEADER_IS("svn:log"))
+        return PROPERTY_LOG;
+      break;
+    case 8:
+      if (HEADER_IS("svn:date"))
+        return PROPERTY_DATE;
+      break;
+    case 10:
+      if (HEADER_IS("svn:author"))
+        return PROPERTY_AUTHOR;
+      break;
+    case 24:
+      if (HEADER_IS("svn:sync-last-merged-rev"))
+        return PROPERTY_SYNC_LAST_MERGED_REV;
+      break;
+    }
+    return PROPERTY_OTHER;
+  }
+
+#undef HEADER_IS
+}
+
+#endif // _TOKENIZER_H
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TREECACHE_H
+#define _TREECACHE_H
+
+#include "gitutil.h"
+#include "lrucache.h"
+
+/**
+ * A bounded, least-recently-used cache of trees read back from the
+ * object database, keyed by their ids.  Past trees which have been
+ * spilled are kept only as the id of their root, and the subtrees which
+ * copies are made from are read back from there as they are needed;
+ * tags and branches are often made again and again from the same few
+ * directories, so keeping the most recent of them here saves reading
+ * them over and over.  A tree's name is not part of its id, so callers
+ * must give a hit the name they want.
+ */
+class TreeCache
+  : public LruCache<git_oid, Git::TreePtr, Git::oid_hash, Git::oid_equal>
+{
+public:
+  TreeCache(std::size_t max_trees = 256)
+    : LruCache(max_trees) {}
+
+  Git::TreePtr find(const git_oid * oid) {
+    Git::TreePtr * tree = LruCache::find(*oid);
+    return tree ? *tree : nullptr;
+  }
+
+  void insert(const git_oid * oid, Git::TreePtr tree) {
+    LruCache::insert(*oid, tree, 1);
+  }
+};
+
+#endif // _TREECACHE_H
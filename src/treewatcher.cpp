@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "treewatcher.h"
+
+#ifdef HAVE_TREE_WATCHER
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+  const std::uint32_t WATCH_MASK =
+    IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+    IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW;
+
+  // However busy the tree, changes are taken in at least this often
+  // once the first of them has come.
+  const int MAX_DEBOUNCES = 10;
+}
+
+TreeWatcher::TreeWatcher(function<bool(const filesystem::path&)> _ignore_dir)
+  : fd(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), ignore_dir(_ignore_dir)
+{
+  if (fd < 0)
+    throw std::runtime_error(std::string("Could not start watching files: ") +
+                             std::strerror(errno));
+}
+
+TreeWatcher::~TreeWatcher()
+{
+  ::close(fd);
+}
+
+/**
+ * Watch `dir' and every directory beneath it.  If `changed' is given,
+ * every file found along the way is added to it, since they may have
+ * been written before the watch on their directory began.
+ */
+bool TreeWatcher::add_watches(const filesystem::path& dir,
+                              std::set<filesystem::path> * changed)
+{
+  int wd = ::inotify_add_watch(fd, dir.empty() ? "." : dir.string().c_str(),
+                               WATCH_MASK);
+  if (wd < 0)
+    return errno == ENOENT || errno == ENOTDIR; // it went away already
+
+  // Watching a directory again, as when it has been moved, gives back
+  // the same descriptor, which must now map to the new path.
+  dirs[wd] = dir;
+
+  system::error_code ec;
+  for (filesystem::directory_iterator end,
+         entry(dir.empty() ? filesystem::path(".") : dir, ec);
+       entry != end;
+       entry.increment(ec)) {
+    if (ec)
+      break;
+
+    filesystem::path        pathname(dir / (*entry).path().filename());
+    filesystem::file_status status((*entry).symlink_status(ec));
+
+    if (filesystem::is_directory(status)) {
+      if (! ignore_dir(pathname) && ! add_watches(pathname, changed))
+        return false;
+    }
+    else if (changed != nullptr) {
+      changed->insert(pathname);
+    }
+  }
+  return true;
+}
+
+bool TreeWatcher::watch()
+{
+  return add_watches(filesystem::path(), nullptr);
+}
+
+/**
+ * Read whatever events are waiting, returning false if some were lost.
+ */
+bool TreeWatcher::read_events(std::set<filesystem::path>& changed)
+{
+  bool complete = true;
+
+  alignas(struct inotify_event) char buffer[64 * 1024];
+  while (true) {
+    ssize_t len = ::read(fd, buffer, sizeof buffer);
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN)
+        break;
+      throw std::runtime_error(std::string("Could not read file events: ") +
+                               std::strerror(errno));
+    }
+
+    for (const char * p = buffer; p < buffer + len; ) {
+      const struct inotify_event * event =
+        reinterpret_cast<const struct inotify_event *>(p);
+      p += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        complete = false;
+        continue;
+      }
+
+      dirs_map::iterator i = dirs.find(event->wd);
+      if (i == dirs.end())
+        continue;
+      if (event->mask & IN_IGNORED) {
+        dirs.erase(i);
+        continue;
+      }
+      if (event->len == 0)
+        continue;
+
+      filesystem::path pathname((*i).second / event->name);
+      changed.insert(pathname);
+
+      if ((event->mask & IN_ISDIR) &&
+          (event->mask & (IN_CREATE | IN_MOVED_TO)) &&
+          ! ignore_dir(pathname) && ! add_watches(pathname, &changed))
+        complete = false;
+    }
+  }
+  return complete;
+}
+
+bool TreeWatcher::wait(std::set<filesystem::path>& changed, int timeout,
+                       int debounce)
+{
+  bool complete = true;
+  int  wait_ms  = timeout * 1000;
+  int  waits    = 0;
+
+  while (waits <= MAX_DEBOUNCES) {
+    struct pollfd ready;
+    ready.fd      = fd;
+    ready.events  = POLLIN;
+    ready.revents = 0;
+
+    int result = ::poll(&ready, 1, wait_ms);
+    if (result < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error(std::string("Could not wait for file events: ") +
+                               std::strerror(errno));
+    }
+    if (result == 0)
+      break;
+
+    if (! read_events(changed))
+      complete = false;
+
+    wait_ms = debounce;
+    ++waits;
+  }
+  return complete;
+}
+
+#endif // HAVE_TREE_WATCHER
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TREEWATCHER_H
+#define _TREEWATCHER_H
+
+#include "system.hpp"
+
+using namespace boost;
+
+#ifdef HAVE_SYS_INOTIFY_H
+#define HAVE_TREE_WATCHER 1
+#endif
+
+#ifdef HAVE_TREE_WATCHER
+
+/**
+ * Watches a working tree for files being written, created, moved or
+ * removed, by way of inotify, so that git-monitor need only look at the
+ * paths which changed rather than walk the whole tree.  Every directory
+ * is watched, save those `ignore_dir' rejects (such as .git itself), and
+ * directories created later are watched as they appear.
+ *
+ * Paths are relative to the top of the tree, as a walk of "./" would
+ * give them.
+ */
+class TreeWatcher : public noncopyable
+{
+  typedef std::map<int, filesystem::path> dirs_map;
+
+  int                                     fd;
+  dirs_map                                dirs;  // by watch descriptor
+  function<bool(const filesystem::path&)> ignore_dir;
+
+  bool add_watches(const filesystem::path& dir,
+                   std::set<filesystem::path> * changed);
+  bool read_events(std::set<filesystem::path>& changed);
+
+public:
+  TreeWatcher(function<bool(const filesystem::path&)> _ignore_dir);
+  ~TreeWatcher();
+
+  /**
+   * Begin watching every directory of the tree, returning false if
+   * that is not possible, as when the system's limit on watches is
+   * reached.
+   */
+  bool watch();
+
+  /**
+   * Wait up to `timeout' seconds for something to change.  Once it
+   * does, go on gathering changes until none have come for `debounce'
+   * milliseconds, so that a burst of writes, such as an editor saving
+   * by way of a temporary file, is taken in at once.  The paths which
+   * changed are added to `changed': files written or removed, and
+   * directories created or removed, along with every file in those
+   * which were created.
+   *
+   * Returns false if events were lost because too many came at once, in
+   * which case the tree must be walked again to find what changed.
+   */
+  bool wait(std::set<filesystem::path>& changed, int timeout, int debounce);
+};
+
+#endif // HAVE_TREE_WATCHER
+
+#endif // _TREEWATCHER_H
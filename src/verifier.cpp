@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "verifier.h"
+#include "tokenizer.h"
+#include "stats.h"
+
+#ifndef ASSERTS
+#undef assert
+#define assert(x)
+#endif
+
+namespace SvnDump {
+
+namespace {
+  // A batch is handed to the workers once it holds this many bytes of
+  // text, or this many texts, whichever comes first.
+  const std::size_t BATCH_BYTES = 1024 * 1024;
+  const std::size_t BATCH_JOBS  = 256;
+
+#ifdef USE_THREADS
+  // The reader blocks once this much text is waiting to be verified, so
+  // that copied texts cannot pile up without bound.
+  const std::size_t MAX_IN_FLIGHT = 64 * 1024 * 1024;
+#endif
+}
+
+Verifier::Verifier() : current(nullptr), failures(0)
+#ifdef USE_THREADS
+                     , in_flight(0), stopping(false), worker_count(0)
+#endif
+{
+}
+
+Verifier::~Verifier()
+{
+  finish();
+#ifdef USE_THREADS
+  stop();
+#endif
+}
+
+void Verifier::submit(int rev, const std::string& pathname,
+                      const char * text, std::size_t text_len, bool stable,
+                      const optional<std::string>& md5_hex,
+                      const optional<std::string>& sha1_hex)
+{
+#ifdef HAVE_OPENSSL_EVP_H
+#ifndef USE_THREADS
+  // Without workers, the text is checked before the caller reuses it.
+  (void)stable;
+#endif
+
+  if (! md5_hex && ! sha1_hex)
+    return;
+
+  if (! current)
+    current = new Batch;
+
+  current->jobs.push_back(Job());
+  Job& job(current->jobs.back());
+
+  job.rev      = rev;
+  job.pathname = pathname;
+  job.text_len = text_len;
+  job.has_md5  = static_cast<bool>(md5_hex);
+  job.has_sha1 = static_cast<bool>(sha1_hex);
+  if (md5_hex)
+    decode_hex(*md5_hex, job.md5, sizeof(job.md5));
+  if (sha1_hex)
+    decode_hex(*sha1_hex, job.sha1, sizeof(job.sha1));
+
+#ifdef USE_THREADS
+  // The caller's buffer will be reused for the next node, so unless it
+  // is known to stay put, the workers need their own copy.
+  if (! stable) {
+    job.text   = nullptr;
+    job.offset = current->storage.size();
+    current->storage.insert(current->storage.end(), text, text + text_len);
+  } else
+#endif
+  {
+    job.text   = text;
+    job.offset = 0;
+  }
+  current->bytes += text_len;
+
+#ifdef USE_THREADS
+  if (current->bytes >= BATCH_BYTES || current->jobs.size() >= BATCH_JOBS)
+#endif
+    dispatch();
+#else // HAVE_OPENSSL_EVP_H
+  (void)rev;
+  (void)pathname;
+  (void)text;
+  (void)text_len;
+  (void)stable;
+  (void)md5_hex;
+  (void)sha1_hex;
+#endif // HAVE_OPENSSL_EVP_H
+}
+
+void Verifier::verify(Batch& batch)
+{
+#if defined(HAVE_LIBCRYPTO) && defined(HAVE_OPENSSL_EVP_H)
+  Stats::Timer timer(Stats::CHECKSUM);
+
+  unsigned char id[20];
+
+  for (std::vector<Job>::const_iterator i = batch.jobs.begin();
+       i != batch.jobs.end();
+       ++i) {
+    const unsigned char * text = reinterpret_cast<const unsigned char *>
+      ((*i).text ? (*i).text : batch.storage.data() + (*i).offset);
+
+    if ((*i).has_md5) {
+      EVP_Digest(text, (*i).text_len, id, nullptr, EVP_md5(), nullptr);
+      if (std::memcmp(id, (*i).md5, sizeof((*i).md5)) != 0) {
+        Failure failure = { (*i).rev, (*i).pathname, "MD5" };
+        batch.failures.push_back(failure);
+        continue;
+      }
+    }
+    if ((*i).has_sha1) {
+      EVP_Digest(text, (*i).text_len, id, nullptr, EVP_sha1(), nullptr);
+      if (std::memcmp(id, (*i).sha1, sizeof((*i).sha1)) != 0) {
+        Failure failure = { (*i).rev, (*i).pathname, "SHA1" };
+        batch.failures.push_back(failure);
+      }
+    }
+  }
+#else
+  (void)batch;
+#endif
+}
+
+#ifndef USE_THREADS
+
+void Verifier::dispatch()
+{
+  if (! current)
+    return;
+
+  verify(*current);
+
+  failures += current->failures.size();
+  unreported.insert(unreported.end(), current->failures.begin(),
+                    current->failures.end());
+
+  delete current;
+  current = nullptr;
+}
+
+void Verifier::wait()
+{
+  dispatch();
+}
+
+#else // USE_THREADS
+
+void Verifier::start()
+{
+  worker_count = thread::hardware_concurrency();
+  if (worker_count == 0)
+    worker_count = 1;
+
+  for (unsigned i = 0; i < worker_count; ++i)
+    workers.create_thread(bind(&Verifier::work, this));
+}
+
+void Verifier::stop()
+{
+  { mutex::scoped_lock lock(the_mutex);
+    stopping = true;
+  }
+  work_available.notify_all();
+  workers.join_all();
+}
+
+void Verifier::dispatch()
+{
+  if (! current)
+    return;
+
+  if (worker_count == 0)
+    start();
+
+  { mutex::scoped_lock lock(the_mutex);
+
+    while (in_flight >= MAX_IN_FLIGHT)
+      work_finished.wait(lock);
+
+    in_flight += current->bytes;
+    queued.push_back(current);
+    in_order.push_back(current);
+  }
+  work_available.notify_one();
+
+  current = nullptr;
+}
+
+void Verifier::work()
+{
+  for (;;) {
+    Batch * batch;
+
+    { mutex::scoped_lock lock(the_mutex);
+
+      while (queued.empty() && ! stopping)
+        work_available.wait(lock);
+
+      if (queued.empty())
+        return;
+
+      batch = queued.front();
+      queued.pop_front();
+    }
+
+    verify(*batch);
+
+    { mutex::scoped_lock lock(the_mutex);
+      batch->done = true;
+      report_finished();
+    }
+    work_finished.notify_all();
+  }
+}
+
+/**
+ * Collect the failures of, and release, every finished batch at the
+ * head of the line.  A batch which finishes early waits here until all
+ * the batches ahead of it are done, which keeps reports in revision
+ * order.  Must be called with `the_mutex' held.
+ */
+void Verifier::report_finished()
+{
+  while (! in_order.empty() && in_order.front()->done) {
+    Batch * batch = in_order.front();
+    in_order.pop_front();
+
+    failures += batch->failures.size();
+    unreported.insert(unreported.end(), batch->failures.begin(),
+                      batch->failures.end());
+
+    assert(in_flight >= batch->bytes);
+    in_flight -= batch->bytes;
+    delete batch;
+  }
+}
+
+void Verifier::wait()
+{
+  dispatch();
+
+  mutex::scoped_lock lock(the_mutex);
+  while (! in_order.empty())
+    work_finished.wait(lock);
+}
+
+#endif // USE_THREADS
+
+std::size_t Verifier::finish()
+{
+  wait();
+
+  // Every batch is done, so nothing else touches these any more.
+  for (const Failure& failure : unreported)
+    if (report)
+      report(failure);
+  unreported.clear();
+
+  return failures;
+}
+
+} // namespace SvnDump
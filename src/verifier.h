@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2011, BoostPro Computing.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of BoostPro Computing nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _VERIFIER_H
+#define _VERIFIER_H
+
+#include "system.hpp"
+
+using namespace boost;
+
+namespace SvnDump
+{
+  /**
+   * Checks node texts against the MD5 and SHA1 digests recorded in the
+   * dump.  Texts are gathered into batches, one or more per revision,
+   * which a pool of worker threads hashes while the reader moves on.
+   * Expected digests are decoded from hex once, when a text is
+   * submitted, and compared as raw bytes.
+   *
+   * Mismatches are reported through `report' strictly in the order the
+   * texts were submitted, which is revision order, no matter which
+   * worker happened to finish first.  They are collected until finish()
+   * and reported on the thread calling it, so that `report' may use a
+   * StatusDisplay which neither the workers nor the dump's reader share.
+   * Without USE_THREADS, each batch is simply verified on the calling
+   * thread.
+   */
+  class Verifier : public noncopyable
+  {
+  public:
+    struct Failure {
+      int         rev;
+      std::string pathname;
+      const char * digest;      // "MD5" or "SHA1"
+    };
+
+    typedef function<void(const Failure&)> report_function;
+
+  private:
+    struct Job {
+      int           rev;
+      std::string   pathname;
+      const char *  text;       // nullptr if the text was copied
+      std::size_t   offset;     // into the batch's storage if copied
+      std::size_t   text_len;
+      bool          has_md5;
+      bool          has_sha1;
+      unsigned char md5[16];
+      unsigned char sha1[20];
+    };
+
+    struct Batch {
+      std::vector<Job>     jobs;
+      std::vector<char>    storage;
+      std::vector<Failure> failures;
+      std::size_t          bytes;
+      bool                 done;
+
+      Batch() : bytes(0), done(false) {}
+    };
+
+    Batch *              current;
+    std::size_t          failures;
+    std::vector<Failure> unreported;
+    report_function      report;
+
+    void dispatch();
+    static void verify(Batch& batch);
+
+#ifdef USE_THREADS
+    std::deque<Batch *> queued;     // waiting for a worker
+    std::deque<Batch *> in_order;   // every batch not yet reported
+    std::size_t         in_flight;  // bytes held by `in_order'
+    bool                stopping;
+    mutex               the_mutex;
+    condition_variable  work_available;
+    condition_variable  work_finished;
+    thread_group        workers;
+    unsigned            worker_count;
+
+    void start();
+    void stop();
+    void work();
+    void report_finished();
+#endif
+
+  public:
+    Verifier();
+    ~Verifier();
+
+    void set_report(const report_function& _report) {
+      report = _report;
+    }
+
+    /**
+     * Queue a text for verification.  If `stable' is true the text is
+     * guaranteed to outlive the verification (for example, because it
+     * points into a mapped file); otherwise a copy is taken if it will
+     * be needed after this call returns.
+     */
+    void submit(int rev, const std::string& pathname,
+                const char * text, std::size_t text_len, bool stable,
+                const optional<std::string>& md5_hex,
+                const optional<std::string>& sha1_hex);
+
+    /**
+     * Wait until every submitted text has been verified, reporting
+     * nothing yet.
+     */
+    void wait();
+
+    /**
+     * Wait until every submitted text has been verified, then report
+     * every mismatch not yet reported.  Returns the total number of
+     * mismatches seen so far.
+     */
+    std::size_t finish();
+  };
+}
+
+#endif // _VERIFIER_H